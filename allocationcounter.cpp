@@ -0,0 +1,99 @@
+#include "allocationcounter.h"
+
+#include <errno.h>
+#include <stddef.h>
+
+// glibc's own entry points, the wrappers below forward to them. free() is wrapped as well so
+// that memory never crosses into an allocator preloaded with LD_PRELOAD; the executable's
+// symbols win over a preloaded library's, for allocation and release alike.
+extern "C" void * __libc_malloc(size_t size);
+extern "C" void * __libc_calloc(size_t n, size_t size);
+extern "C" void * __libc_realloc(void * ptr, size_t size);
+extern "C" void * __libc_memalign(size_t alignment, size_t size);
+extern "C" void * __libc_valloc(size_t size);
+extern "C" void * __libc_pvalloc(size_t size);
+extern "C" void __libc_free(void * ptr);
+
+namespace
+{
+QAtomicInt counting;
+QAtomicInteger<quint64> allocations;
+
+inline void count()
+{
+    if (0 != counting.loadAcquire())
+        allocations.fetchAndAddRelaxed(1);
+}
+}
+
+extern "C" void * malloc(size_t size)
+{
+    count();
+    return __libc_malloc(size);
+}
+
+extern "C" void * calloc(size_t n, size_t size)
+{
+    count();
+    return __libc_calloc(n, size);
+}
+
+extern "C" void * realloc(void * ptr, size_t size)
+{
+    count();
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void * memalign(size_t alignment, size_t size)
+{
+    count();
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void * aligned_alloc(size_t alignment, size_t size)
+{
+    count();
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void ** ptr, size_t alignment, size_t size)
+{
+    if (0 == alignment || 0 != (alignment & (alignment - 1)) || 0 != alignment % sizeof(void*))
+        return EINVAL;
+
+    count();
+    void * p = __libc_memalign(alignment, size);
+    if (0 == p && 0 != size)
+        return ENOMEM;
+    *ptr = p;
+    return 0;
+}
+
+extern "C" void * valloc(size_t size)
+{
+    count();
+    return __libc_valloc(size);
+}
+
+extern "C" void * pvalloc(size_t size)
+{
+    count();
+    return __libc_pvalloc(size);
+}
+
+extern "C" void free(void * ptr)
+{
+    __libc_free(ptr);
+}
+
+void AllocationCounter::start()
+{
+    allocations.store(0);
+    counting.storeRelease(1);
+}
+
+quint64 AllocationCounter::stop()
+{
+    counting.storeRelease(0);
+    return allocations.load();
+}
@@ -0,0 +1,17 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QtGlobal>
+
+// Counts heap allocations (the malloc family and everything built on it, operator new and Qt
+// containers included) between start() and stop(), on all threads. Only linked into
+// CONFIG+=bench builds: it takes over the allocator entry points of the whole process and routes
+// them to glibc, whatever allocator would otherwise be in use.
+class AllocationCounter
+{
+public:
+    static void start();
+    static quint64 stop();
+};
+
+#endif // ALLOCATIONCOUNTER_H
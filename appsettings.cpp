@@ -0,0 +1,48 @@
+#include "appsettings.h"
+#include "devicebenchmark.h"
+
+namespace
+{
+QHash<QString, QVariant> makeDefaults()
+{
+    QHash<QString, QVariant> d;
+
+    d["/Settings/Notifications/ShowAdded"] = true;
+    d["/Settings/Notifications/ShowRemoved"] = true;
+    d["/Settings/Notifications/ShowMounted"] = true;
+    d["/Settings/Notifications/ShowUnmounted"] = true;
+
+    d["/Settings/Actions/MountAdded"] = true;
+    d["/Settings/Actions/ShowSystemInternal"] = true;
+    d["/Settings/Actions/ExecuteViewMounted"] = true;
+    d["/Settings/Actions/ForceUnmount"] = false;
+    d["/Settings/Actions/ViewCommand"] = "xdg-open %m";
+    d["/Settings/Actions/DeviceFormatString"] = "%n (%f) on %m";
+
+    d["/Settings/Monitor/SampleInterval"] = 1000;
+    d["/Settings/Monitor/TooltipFormatString"] = "%n: R %r MB/s, W %w MB/s, %o IOPS, %q in flight";
+
+    d["/Settings/Index/Enabled"] = false;
+
+    d["/Settings/Benchmark/SizeMB"] = int(DeviceBenchmark::DefaultSizeMB);
+    d["/Settings/Benchmark/QueueDepth"] = int(DeviceBenchmark::DefaultQueueDepth);
+
+    return d;
+}
+}
+
+AppSettings::AppSettings(QObject *parent) :
+    QSettings("Vladislav Nickolaev", "MOUNTain", parent)
+{
+}
+
+QVariant AppSettings::get(const QString &key) const
+{
+    return value(key, defaultValue(key));
+}
+
+QVariant AppSettings::defaultValue(const QString &key)
+{
+    static const QHash<QString, QVariant> defaults = makeDefaults();
+    return defaults.value(key);
+}
@@ -0,0 +1,19 @@
+#ifndef APPSETTINGS_H
+#define APPSETTINGS_H
+
+#include <QtCore>
+#include <QSettings>
+
+// The application's settings store. Defaults live here only, so the tray and the settings dialog
+// agree on what an unset key means.
+class AppSettings : public QSettings
+{
+public:
+    explicit AppSettings(QObject * parent = 0);
+
+    // Value of a full key ("/Settings/..."), or its default if it was never written.
+    QVariant get(const QString& key) const;
+    static QVariant defaultValue(const QString& key);
+};
+
+#endif // APPSETTINGS_H
@@ -0,0 +1,286 @@
+#include "automountrules.h"
+#include "appsettings.h"
+
+const char * AUTOMOUNT_RULES_KEY = "/Settings/Automount/Rules";
+// Matching runs in microseconds, the dry run repeats it to get a readable figure per device.
+const int DRY_RUN_REPEAT = 1000;
+
+namespace
+{
+const char * ACTION_NAMES[] = { "Mount", "Ignore", "OpenView", "Sync" };
+const char * TYPE_NAMES[] = { "HDD", "USB", "FLOPPY", "OPTICAL", "OTHER", "IMAGE" };
+const int TYPE_COUNT = sizeof(TYPE_NAMES) / sizeof(TYPE_NAMES[0]);
+
+QString fileSystemKey(const QString& fs)
+{
+    return fs.isEmpty() ? QString("none") : fs.toLower();
+}
+
+QStringList splitList(const QString& str)
+{
+    QStringList items;
+    foreach (const QString& item, str.split(",", QString::SkipEmptyParts))
+    {
+        if (!item.trimmed().isEmpty())
+            items << item.trimmed();
+    }
+    return items;
+}
+}
+
+AutomountRules::AutomountRules()
+{
+}
+
+AutomountRules::AutomountRules(const QList<AutomountRule> &rules) :
+    m_rules(rules)
+{
+    QHash<QString, int> patterns;
+    m_labelIndex.fill(-1, m_rules.size());
+
+    for (int i = 0; i < m_rules.size(); ++i)
+    {
+        AutomountRule& rule = m_rules[i];
+        rule.uuid = rule.uuid.toLower();
+        for (int f = 0; f < rule.fileSystems.size(); ++f)
+            rule.fileSystems[f] = fileSystemKey(rule.fileSystems.at(f));
+
+        if (!rule.label.isEmpty())
+        {
+            // Rules written for one family of sticks tend to repeat the same pattern.
+            QHash<QString, int>::const_iterator itr = patterns.constFind(rule.label);
+            if (patterns.constEnd() == itr)
+            {
+                QRegularExpression re("^(?:" + rule.label + ")$", QRegularExpression::CaseInsensitiveOption);
+                if (!re.isValid())
+                {
+                    qWarning() << "Automount rule " << i + 1 << " skipped, bad label pattern: " << re.errorString();
+                    continue;
+                }
+                re.optimize();
+                itr = patterns.insert(rule.label, m_labels.size());
+                m_labels << re;
+            }
+            m_labelIndex[i] = itr.value();
+        }
+
+        if (!rule.uuid.isEmpty())
+            m_byUuid[rule.uuid] << i;
+        else if (!rule.fileSystems.isEmpty())
+        {
+            foreach (const QString& fs, rule.fileSystems)
+                m_byFileSystem[fs] << i;
+        }
+        else
+            m_rest << i;
+    }
+}
+
+QList<AutomountRule> AutomountRules::load(const QSettings *settings)
+{
+    // Same layout as QSettings::beginWriteArray(), which needs a non-const object to read back.
+    QList<AutomountRule> rules;
+    int size = settings->value(QString(AUTOMOUNT_RULES_KEY) + "/size").toInt();
+
+    for (int i = 1; i <= size; ++i)
+    {
+        QString prefix = QString(AUTOMOUNT_RULES_KEY) + "/" + QString::number(i) + "/";
+        AutomountRule rule;
+        rule.name = settings->value(prefix + "Name").toString();
+        rule.uuid = settings->value(prefix + "Uuid").toString();
+        rule.label = settings->value(prefix + "Label").toString();
+        rule.fileSystems = splitList(settings->value(prefix + "FileSystems").toString());
+        rule.minSize = settings->value(prefix + "MinSize").toULongLong();
+        rule.maxSize = settings->value(prefix + "MaxSize").toULongLong();
+        rule.options = splitList(settings->value(prefix + "Options").toString());
+
+        QString type = settings->value(prefix + "Type").toString();
+        for (int t = 0; t < TYPE_COUNT; ++t)
+        {
+            if (0 == type.compare(TYPE_NAMES[t], Qt::CaseInsensitive))
+                rule.type = t;
+        }
+
+        QString location = settings->value(prefix + "Location").toString();
+        if (0 == location.compare("Internal", Qt::CaseInsensitive))
+            rule.location = AutomountRule::Internal;
+        else if (0 == location.compare("External", Qt::CaseInsensitive))
+            rule.location = AutomountRule::External;
+
+        QString action = settings->value(prefix + "Action").toString();
+        for (int a = AutomountRule::Mount; a <= AutomountRule::Sync; ++a)
+        {
+            if (0 == action.compare(ACTION_NAMES[a], Qt::CaseInsensitive))
+                rule.action = AutomountRule::Action(a);
+        }
+
+        rules.append(rule);
+    }
+    return rules;
+}
+
+void AutomountRules::save(QSettings *settings, const QList<AutomountRule> &rules)
+{
+    settings->remove(AUTOMOUNT_RULES_KEY);
+    settings->beginWriteArray(AUTOMOUNT_RULES_KEY, rules.size());
+
+    for (int i = 0; i < rules.size(); ++i)
+    {
+        const AutomountRule& rule = rules.at(i);
+        settings->setArrayIndex(i);
+        settings->setValue("Name", rule.name);
+        settings->setValue("Uuid", rule.uuid);
+        settings->setValue("Label", rule.label);
+        settings->setValue("FileSystems", rule.fileSystems.join(","));
+        settings->setValue("Type", rule.type >= 0 && rule.type < TYPE_COUNT ? QString(TYPE_NAMES[rule.type]) : QString());
+        settings->setValue("Location", AutomountRule::Internal == rule.location ? "Internal" :
+                                       (AutomountRule::External == rule.location ? "External" : ""));
+        settings->setValue("MinSize", rule.minSize);
+        settings->setValue("MaxSize", rule.maxSize);
+        settings->setValue("Action", actionName(rule.action));
+        settings->setValue("Options", rule.options.join(","));
+    }
+
+    settings->endArray();
+}
+
+int AutomountRules::size() const
+{
+    return m_rules.size();
+}
+
+const AutomountRule &AutomountRules::rule(int index) const
+{
+    return m_rules.at(index);
+}
+
+int AutomountRules::match(const DeviceInfo &dev) const
+{
+    static const QVector<int> none;
+
+    QHash<QString, QVector<int> >::const_iterator uuid_itr = dev.uuid.isEmpty() ? m_byUuid.constEnd()
+                                                                               : m_byUuid.constFind(dev.uuid.toLower());
+    QHash<QString, QVector<int> >::const_iterator fs_itr = m_byFileSystem.constFind(fileSystemKey(dev.fileSystem));
+
+    // Each candidate list is in rule order, walking them together keeps the first match first.
+    const QVector<int> * lists[] = { m_byUuid.constEnd() == uuid_itr ? &none : &uuid_itr.value(),
+                                     m_byFileSystem.constEnd() == fs_itr ? &none : &fs_itr.value(),
+                                     &m_rest };
+    int pos[] = { 0, 0, 0 };
+
+    forever
+    {
+        int next = -1;
+        int from = -1;
+        for (int l = 0; l < 3; ++l)
+        {
+            if (pos[l] < lists[l]->size() && (next < 0 || lists[l]->at(pos[l]) < next))
+            {
+                next = lists[l]->at(pos[l]);
+                from = l;
+            }
+        }
+
+        if (next < 0)
+            return -1;
+
+        ++pos[from];
+        if (matches(next, dev))
+            return next;
+    }
+}
+
+bool AutomountRules::matches(int index, const DeviceInfo &dev) const
+{
+    const AutomountRule& rule = m_rules.at(index);
+
+    if (!rule.fileSystems.isEmpty() && !rule.fileSystems.contains(fileSystemKey(dev.fileSystem)))
+        return false;
+    if (rule.type >= 0 && rule.type != dev.type)
+        return false;
+    if ((AutomountRule::Internal == rule.location && !dev.isSystem) || (AutomountRule::External == rule.location && dev.isSystem))
+        return false;
+    if (dev.sizeBytes < rule.minSize || (0 != rule.maxSize && dev.sizeBytes > rule.maxSize))
+        return false;
+
+    int label = m_labelIndex.at(index);
+    return label < 0 || m_labels.at(label).match(dev.name).hasMatch();
+}
+
+QString AutomountRules::actionName(AutomountRule::Action action)
+{
+    return ACTION_NAMES[action];
+}
+
+int AutomountRules::dryRunFromCommandLine(const QString &device, int padding)
+{
+    QTextStream out(stdout);
+    const QString only = "all" == device ? QString() : device;
+    AppSettings settings;
+    QList<AutomountRule> rules = load(&settings);
+    const int configured = rules.size();
+
+    // Rules no real device matches, appended after the configured ones so the verdict stays the same
+    // while the timing shows how matching holds up against a large rule set.
+    for (int i = 0; i < padding; ++i)
+    {
+        AutomountRule rule;
+        rule.name = "padding " + QString::number(i + 1);
+        if (0 == i % 3)
+            rule.uuid = QUuid::createUuid().toString().mid(1, 36);
+        else if (1 == i % 3)
+            rule.label = "mountain-padding-" + QString::number(i) + "-.*";
+        else
+            rule.fileSystems << "padding" + QString::number(i);
+        rules.append(rule);
+    }
+
+    QElapsedTimer t;
+    t.start();
+    AutomountRules compiled(rules);
+    qint64 compile_time = t.nsecsElapsed();
+
+    DeviceWatcher watcher;
+    if (!watcher.good())
+        return 1;
+
+    bool mount_added = settings.get("/Settings/Actions/MountAdded").toBool();
+    out << configured << " rules, " << padding << " padding, compiled in "
+        << QString::number(compile_time / 1e6, 'f', 2) << " ms\n";
+
+    int shown = 0;
+    foreach (const DeviceWatcher::DeviceInfoPtr& dev, watcher.devices())
+    {
+        if (!only.isEmpty() && only != dev->fileName && only != dev->udisksPath)
+            continue;
+        ++shown;
+
+        int fired = -1;
+        t.restart();
+        for (int i = 0; i < DRY_RUN_REPEAT; ++i)
+            fired = compiled.match(*dev);
+        qint64 match_time = t.nsecsElapsed() / DRY_RUN_REPEAT;
+
+        QString verdict;
+        if (fired < 0)
+            verdict = QString("no rule, MountAdded: ") + (mount_added ? "Mount" : "Ignore");
+        else
+        {
+            const AutomountRule& rule = compiled.rule(fired);
+            verdict = QString("rule %1 \"%2\": %3").arg(fired + 1).arg(rule.name).arg(actionName(rule.action));
+            if (!rule.options.isEmpty())
+                verdict += " " + rule.options.join(",");
+        }
+
+        out << dev->fileName << " (" << dev->name << ", " << fileSystemKey(dev->fileSystem) << "): " << verdict
+            << ", " << QString::number(match_time / 1e3, 'f', 2) << " us\n";
+    }
+    out.flush();
+
+    if (!only.isEmpty() && 0 == shown)
+    {
+        qCritical() << "Unknown device " << device;
+        return 1;
+    }
+    return 0;
+}
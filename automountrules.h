@@ -0,0 +1,69 @@
+#ifndef AUTOMOUNTRULES_H
+#define AUTOMOUNTRULES_H
+
+#include <QtCore>
+
+#include "devicewatcher.h"
+
+// One entry of the ordered automount rule set. Empty or zero fields match anything; the label is a
+// regular expression matched case-insensitively against the whole device name, file system "none"
+// matches devices without a recognised one.
+struct AutomountRule
+{
+    enum Action
+    {
+        Mount, Ignore, OpenView, Sync
+    };
+
+    enum Location
+    {
+        Anywhere, Internal, External
+    };
+
+    AutomountRule() : type(-1), location(Anywhere), minSize(0), maxSize(0), action(Mount) {}
+
+    QString name;
+    QString uuid;
+    QString label;
+    QStringList fileSystems;
+    int type;
+    Location location;
+    qulonglong minSize;
+    qulonglong maxSize;
+    Action action;
+    QStringList options;
+};
+
+// Rule set compiled for matching on hotplug: rules bound to a UUID or a file system are reached
+// through hashes and labels are precompiled, so an event only checks rules that can apply to it.
+// The first rule in settings order that matches wins.
+class AutomountRules
+{
+public:
+    AutomountRules();
+    explicit AutomountRules(const QList<AutomountRule>& rules);
+
+    static QList<AutomountRule> load(const QSettings * settings);
+    static void save(QSettings * settings, const QList<AutomountRule>& rules);
+
+    int size() const;
+    const AutomountRule& rule(int index) const;
+    // Index of the rule that fires for dev, -1 if none does.
+    int match(const DeviceInfo& dev) const;
+
+    static QString actionName(AutomountRule::Action action);
+    static int dryRunFromCommandLine(const QString& device, int padding);
+
+private:
+    QList<AutomountRule> m_rules;
+    // Per rule index into m_labels, -1 when the rule has no label.
+    QVector<int> m_labelIndex;
+    QVector<QRegularExpression> m_labels;
+    QHash<QString, QVector<int> > m_byUuid;
+    QHash<QString, QVector<int> > m_byFileSystem;
+    QVector<int> m_rest;
+
+    bool matches(int index, const DeviceInfo& dev) const;
+};
+
+#endif // AUTOMOUNTRULES_H
@@ -0,0 +1,206 @@
+#include <string.h>
+#include <algorithm>
+
+#include "contentindex.h"
+
+// Approximate cost of a QMultiHash entry: node (next, hash, key, value) plus its bucket.
+const int HASH_ENTRY_BYTES = 32;
+const int MIN_UNSORTED_NODES = 4096;
+
+const quint32 ContentIndex::NoNode;
+
+ContentIndex::ContentIndex(const QString &root) :
+    m_root(QFile::encodeName(root)),
+    m_removed(0),
+    m_sortedCount(0)
+{
+    Node n;
+    n.parent = NoNode;
+    n.name = intern(QByteArray());
+    m_nodes.append(n);
+}
+
+quint32 ContentIndex::rootNode() const
+{
+    return 0;
+}
+
+quint32 ContentIndex::addNode(quint32 parent, const QByteArray &name)
+{
+    Node n;
+    n.parent = parent;
+    n.name = intern(name);
+
+    // A file created during a walk shows up both in the walk and as an inotify event.
+    quint32 existing = findChild(parent, n.name);
+    if (NoNode != existing)
+        return existing;
+
+    m_nodes.append(n);
+    m_unsorted.insert(quint64(parent) << 32 | n.name, m_nodes.size() - 1);
+    return m_nodes.size() - 1;
+}
+
+quint32 ContentIndex::removeNode(quint32 parent, const QByteArray &name)
+{
+    quint32 name_id = lookupName(name);
+    if (NoNode == name_id)
+        return NoNode;
+
+    quint32 node = findChild(parent, name_id);
+    if (NoNode != node)
+    {
+        // Descendants stay in place but can't be reached anymore, path() skips them.
+        m_nodes[node].parent = NoNode;
+        ++m_removed;
+    }
+    return node;
+}
+
+bool ContentIndex::path(quint32 node, QByteArray &path) const
+{
+    QVarLengthArray<quint32, 32> chain;
+
+    while (0 != node)
+    {
+        if (NoNode == node || node >= quint32(m_nodes.size()))
+            return false;
+        chain.append(m_nodes.at(node).name);
+        node = m_nodes.at(node).parent;
+    }
+
+    path = m_root;
+    for (int i = chain.size() - 1; i >= 0; --i)
+    {
+        path += '/';
+        path += m_names.constData() + m_nameOffsets.at(chain.at(i));
+    }
+    return true;
+}
+
+QStringList ContentIndex::search(const QByteArray &needle, int limit)
+{
+    QStringList results;
+
+    if (needle.isEmpty())
+        return results;
+
+    if (m_sortedCount != m_nodes.size())
+        rebuildByName();
+
+    QByteArray lower = needle.toLower();
+    const char * base = m_lowerNames.constData();
+    size_t len = m_lowerNames.size();
+    size_t pos = 0;
+    QByteArray p;
+
+    while (results.size() < limit && pos < len)
+    {
+        const char * hit = static_cast<const char*>(::memmem(base + pos, len - pos, lower.constData(), lower.size()));
+        if (0 == hit)
+            break;
+
+        quint32 name_id = std::upper_bound(m_nameOffsets.constBegin(), m_nameOffsets.constEnd(), quint32(hit - base))
+                - m_nameOffsets.constBegin() - 1;
+
+        for (quint32 i = m_byNameStart.at(name_id); i < m_byNameStart.at(name_id + 1) && results.size() < limit; ++i)
+        {
+            if (path(m_byName.at(i), p))
+                results.append(QFile::decodeName(p));
+        }
+
+        // Names are unique, so continue right after the one that matched.
+        pos = m_nameOffsets.at(name_id) + ::strlen(m_names.constData() + m_nameOffsets.at(name_id)) + 1;
+    }
+
+    return results;
+}
+
+void ContentIndex::squeeze()
+{
+    rebuildByName();
+    m_nodes.squeeze();
+    m_names.squeeze();
+    m_lowerNames.squeeze();
+    m_nameOffsets.squeeze();
+}
+
+qint64 ContentIndex::fileCount() const
+{
+    return m_nodes.size() - 1 - m_removed;
+}
+
+qint64 ContentIndex::memoryBytes() const
+{
+    return qint64(m_nodes.capacity()) * sizeof(Node)
+            + m_names.capacity() + m_lowerNames.capacity()
+            + qint64(m_nameOffsets.capacity()) * sizeof(quint32)
+            + qint64(m_nameLookup.size() + m_unsorted.size()) * HASH_ENTRY_BYTES
+            + qint64(m_byName.capacity() + m_byNameStart.capacity()) * sizeof(quint32);
+}
+
+quint32 ContentIndex::intern(const QByteArray &name)
+{
+    quint32 id = lookupName(name);
+    if (NoNode != id)
+        return id;
+
+    id = m_nameOffsets.size();
+    m_nameOffsets.append(m_names.size());
+    m_names.append(name.constData(), name.size()).append('\0');
+    m_lowerNames.append(name.toLower()).append('\0');
+    m_nameLookup.insert(qHash(name), id);
+    return id;
+}
+
+quint32 ContentIndex::lookupName(const QByteArray &name) const
+{
+    QMultiHash<uint, quint32>::const_iterator itr = m_nameLookup.find(qHash(name));
+
+    for (; m_nameLookup.end() != itr && itr.key() == qHash(name); ++itr)
+    {
+        if (name == m_names.constData() + m_nameOffsets.at(itr.value()))
+            return itr.value();
+    }
+    return NoNode;
+}
+
+quint32 ContentIndex::findChild(quint32 parent, quint32 name)
+{
+    if (m_nodes.size() - m_sortedCount > qMax(MIN_UNSORTED_NODES, m_nodes.size() / 8))
+        rebuildByName();
+
+    if (name + 1 < quint32(m_byNameStart.size()))
+    {
+        for (quint32 i = m_byNameStart.at(name); i < m_byNameStart.at(name + 1); ++i)
+        {
+            if (m_nodes.at(m_byName.at(i)).parent == parent)
+                return m_byName.at(i);
+        }
+    }
+
+    // Removed nodes keep their entry, the parent check tells them apart.
+    quint32 node = m_unsorted.value(quint64(parent) << 32 | name, NoNode);
+    if (NoNode != node && m_nodes.at(node).parent == parent)
+        return node;
+    return NoNode;
+}
+
+void ContentIndex::rebuildByName()
+{
+    // Counting sort by name id, linear in the number of nodes.
+    m_byNameStart.fill(0, m_nameOffsets.size() + 1);
+
+    for (int i = 1; i < m_nodes.size(); ++i)
+        ++m_byNameStart[m_nodes.at(i).name + 1];
+    for (int i = 1; i < m_byNameStart.size(); ++i)
+        m_byNameStart[i] += m_byNameStart.at(i - 1);
+
+    QVector<quint32> next(m_byNameStart);
+    m_byName.resize(m_nodes.size() - 1);
+    for (int i = 1; i < m_nodes.size(); ++i)
+        m_byName[next[m_nodes.at(i).name]++] = i;
+
+    m_sortedCount = m_nodes.size();
+    m_unsorted.clear();
+}
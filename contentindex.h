@@ -0,0 +1,57 @@
+#ifndef CONTENTINDEX_H
+#define CONTENTINDEX_H
+
+#include <QtCore>
+
+class ContentIndex
+{
+public:
+    static const quint32 NoNode = 0xFFFFFFFF;
+
+    explicit ContentIndex(const QString& root);
+
+    quint32 rootNode() const;
+    // Returns the existing node if parent already has a child of that name.
+    quint32 addNode(quint32 parent, const QByteArray& name);
+    quint32 removeNode(quint32 parent, const QByteArray& name);
+    bool path(quint32 node, QByteArray& path) const;
+
+    QStringList search(const QByteArray& needle, int limit);
+    void squeeze();
+
+    qint64 fileCount() const;
+    qint64 memoryBytes() const;
+
+private:
+    struct Node
+    {
+        quint32 parent;
+        quint32 name;
+    };
+
+    QByteArray m_root;
+    QVector<Node> m_nodes;
+    qint64 m_removed;
+
+    // Interned path components: '\0' terminated names packed in one buffer, plus a
+    // lower case copy with identical offsets that search() scans with memmem().
+    QByteArray m_names;
+    QByteArray m_lowerNames;
+    QVector<quint32> m_nameOffsets;
+    QMultiHash<uint, quint32> m_nameLookup;
+
+    // Nodes sorted by name id; nodes of name i are m_byName[m_byNameStart[i]..m_byNameStart[i + 1]).
+    // Covers nodes below m_sortedCount only, newer ones are scanned linearly until the next rebuild.
+    QVector<quint32> m_byName;
+    QVector<quint32> m_byNameStart;
+    int m_sortedCount;
+    // (parent, name id) of the nodes added since the last rebuild, so findChild() needn't scan them.
+    QHash<quint64, quint32> m_unsorted;
+
+    quint32 intern(const QByteArray& name);
+    quint32 lookupName(const QByteArray& name) const;
+    quint32 findChild(quint32 parent, quint32 name);
+    void rebuildByName();
+};
+
+#endif // CONTENTINDEX_H
@@ -0,0 +1,422 @@
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "contentindexer.h"
+#include "contentindex.h"
+#include "dirwalker.h"
+#include "iomonitor.h"
+
+const int INDEX_WALK_THREADS = 2;
+const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+const int THROTTLE_CHECK_DIRS = 64;
+const int THROTTLE_SLEEP = 200;
+
+struct ContentIndexer::IndexedDevice
+{
+    IndexedDevice() : index(0), inotifyFd(-1), notifier(0), builder(0), ready(false) {}
+
+    ~IndexedDevice()
+    {
+        // May run from within the notifier's own activated() signal.
+        if (0 != notifier)
+        {
+            notifier->setEnabled(false);
+            notifier->deleteLater();
+        }
+        if (inotifyFd >= 0)
+            ::close(inotifyFd);
+        delete index;
+    }
+
+    DeviceInfo device;
+    QString mountPath;
+    ContentIndex * index;
+    int inotifyFd;
+    QSocketNotifier * notifier;
+    QHash<int, quint32> watches;
+    // Guards index and watches against the builder, and walks.
+    QMutex mutex;
+    // Directories still to be walked by the builder: absolute path and the node they go under.
+    QList<QPair<QByteArray, quint32> > walks;
+    IndexBuilder * builder;
+    // Set once the first walk of the whole device is done, subtree walks don't clear it.
+    bool ready;
+};
+
+class ContentIndexer::IndexVisitor : public DirWalker::Visitor
+{
+public:
+    IndexVisitor(IndexedDevice * d, const QByteArray& root, quint32 base) :
+        m_pdevice(d), m_root(root), m_base(base), m_lastSectors(0) {}
+
+    // Back off while the device is being written to, that's somebody copying files.
+    void setThrottle(const QString& dev_file) { m_devFile = dev_file; }
+
+    void visit(const QByteArray& rel_dir, const QVector<DirWalker::Entry>& entries)
+    {
+        throttle();
+
+        QByteArray dir_path = rel_dir.isEmpty() ? m_root : m_root + '/' + rel_dir;
+        QMutexLocker lock(&m_pdevice->mutex);
+        quint32 dir = rel_dir.isEmpty() ? m_base : m_dirs.value(rel_dir, ContentIndex::NoNode);
+
+        if (ContentIndex::NoNode == dir)
+            return;
+
+        foreach (const DirWalker::Entry& e, entries)
+        {
+            quint32 id = m_pdevice->index->addNode(dir, e.name);
+            if (!e.isDir)
+                continue;
+
+            m_dirs.insert(DirWalker::join(rel_dir, e.name), id);
+            int wd = ::inotify_add_watch(m_pdevice->inotifyFd, (dir_path + '/' + e.name).constData(), WATCH_MASK);
+            if (wd >= 0)
+                m_pdevice->watches.insert(wd, id);
+        }
+    }
+
+private:
+    IndexedDevice * m_pdevice;
+    QByteArray m_root;
+    quint32 m_base;
+    QHash<QByteArray, quint32> m_dirs;
+    QString m_devFile;
+    QAtomicInt m_visited;
+    QAtomicInteger<quint64> m_lastSectors;
+
+    void throttle()
+    {
+        if (m_devFile.isEmpty() || 0 != m_visited.fetchAndAddRelaxed(1) % THROTTLE_CHECK_DIRS)
+            return;
+
+        unsigned long long sectors;
+        if (!IoMonitor::readWriteSectors(m_devFile, sectors))
+            return;
+
+        quint64 last = m_lastSectors.fetchAndStoreRelaxed(sectors);
+        if (0 != last && sectors != last)
+            QThread::msleep(THROTTLE_SLEEP);
+    }
+};
+
+// Works through the walks queued on a device, the whole mount point first and then directories
+// created or moved in while it's indexed, so the GUI thread never walks a tree itself.
+class ContentIndexer::IndexBuilder : public QThread
+{
+public:
+    IndexBuilder(IndexedDevice * d, QObject * parent) : QThread(parent), m_pdevice(d), m_elapsed(0) {}
+
+    void cancel() { m_cancel.store(1); }
+    bool cancelled() const { return 0 != m_cancel.load(); }
+    qint64 elapsed() const { return m_elapsed; }
+
+protected:
+    void run()
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        while (!cancelled())
+        {
+            QPair<QByteArray, quint32> walk;
+            {
+                QMutexLocker lock(&m_pdevice->mutex);
+                if (m_pdevice->walks.isEmpty())
+                    break;
+                walk = m_pdevice->walks.takeFirst();
+            }
+
+            IndexVisitor visitor(m_pdevice, walk.first, walk.second);
+            visitor.setThrottle(m_pdevice->device.fileName);
+
+            DirWalker walker(QFile::decodeName(walk.first), INDEX_WALK_THREADS);
+            walker.setCancelFlag(&m_cancel);
+            walker.setIdleIoPriority(true);
+            walker.walk(&visitor);
+        }
+
+        // Subtree walks only append, the index is compacted once after the full one.
+        QMutexLocker lock(&m_pdevice->mutex);
+        if (!m_pdevice->ready)
+            m_pdevice->index->squeeze();
+        m_elapsed = timer.elapsed();
+    }
+
+private:
+    IndexedDevice * m_pdevice;
+    QAtomicInt m_cancel;
+    qint64 m_elapsed;
+};
+
+ContentIndexer::ContentIndexer(DeviceWatcher *watcher, QObject *parent) :
+    QObject(parent),
+    m_pdevWatcher(watcher),
+    m_enabled(false)
+{
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceRemoved(DeviceInfoPtr)), this, SLOT(slotDeviceRemoved(DeviceInfoPtr)));
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceUnmounted(DeviceInfoPtr, ErrorCode)),
+                     this, SLOT(slotDeviceUnmounted(DeviceInfoPtr, ErrorCode)));
+}
+
+ContentIndexer::~ContentIndexer()
+{
+    QList<IndexedDevice*> devices = m_devices.values() + m_dropped;
+
+    foreach (IndexedDevice * d, devices)
+    {
+        if (0 != d->builder)
+        {
+            d->builder->cancel();
+            d->builder->wait();
+            delete d->builder;
+        }
+        delete d;
+    }
+}
+
+void ContentIndexer::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+
+    if (!m_enabled)
+    {
+        foreach (const QString& path, m_devices.keys())
+            dropDevice(path);
+    }
+}
+
+bool ContentIndexer::enabled() const
+{
+    return m_enabled;
+}
+
+QStringList ContentIndexer::search(const QString &text, int limit)
+{
+    QStringList results;
+    QByteArray needle = QFile::encodeName(text);
+
+    foreach (IndexedDevice * d, m_devices)
+    {
+        if (results.size() >= limit)
+            break;
+        if (d->ready)
+        {
+            QMutexLocker lock(&d->mutex);
+            results += d->index->search(needle, limit - results.size());
+        }
+    }
+    return results;
+}
+
+QString ContentIndexer::memoryReport() const
+{
+    qint64 files = 0;
+    qint64 bytes = 0;
+
+    foreach (IndexedDevice * d, m_devices)
+    {
+        if (!d->ready)
+            continue;
+        QMutexLocker lock(&d->mutex);
+        files += d->index->fileCount();
+        bytes += d->index->memoryBytes();
+    }
+
+    QString report = QString::number(files) + " files indexed, " + QString::number(bytes / 1024) + " kB";
+    if (files > 0)
+        report += ", " + QString::number(double(bytes) * 1000000 / files / (1024 * 1024), 'f', 1) + " MB per million files";
+    return report;
+}
+
+void ContentIndexer::addDevice(const DeviceInfo &dev, const QString &mount_path)
+{
+    if (!m_enabled || mount_path.isEmpty() || m_devices.contains(dev.udisksPath))
+        return;
+
+    IndexedDevice * d = new IndexedDevice();
+    d->device = dev;
+    d->mountPath = mount_path;
+    d->index = new ContentIndex(mount_path);
+    d->inotifyFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (d->inotifyFd < 0)
+        qWarning() << "inotify is not available, index of " << mount_path << " won't be updated.";
+
+    QByteArray root = QFile::encodeName(mount_path);
+    int wd = ::inotify_add_watch(d->inotifyFd, root.constData(), WATCH_MASK);
+    if (wd >= 0)
+        d->watches.insert(wd, d->index->rootNode());
+    d->walks.append(qMakePair(root, d->index->rootNode()));
+
+    m_devices.insert(dev.udisksPath, d);
+    startBuilder(d);
+}
+
+void ContentIndexer::startBuilder(IndexedDevice *d)
+{
+    d->builder = new IndexBuilder(d, this);
+    QObject::connect(d->builder, SIGNAL(finished()), this, SLOT(slotBuilderFinished()));
+    d->builder->start(QThread::IdlePriority);
+}
+
+void ContentIndexer::dropDevice(const QString &dev_path)
+{
+    IndexedDevice * d = m_devices.take(dev_path);
+    if (0 == d)
+        return;
+
+    // A running walk can't be abandoned, it still writes to the index; it's freed once it stops.
+    // Its inotify fd stays open for the walk's watches, but nobody reads it any more and a
+    // level-triggered notifier would keep firing until then.
+    if (0 != d->builder)
+    {
+        if (0 != d->notifier)
+        {
+            d->notifier->setEnabled(false);
+            d->notifier->deleteLater();
+            d->notifier = 0;
+        }
+        d->builder->cancel();
+        m_dropped.append(d);
+    }
+    else delete d;
+}
+
+void ContentIndexer::slotBuilderFinished()
+{
+    IndexBuilder * builder = static_cast<IndexBuilder*>(sender());
+    builder->deleteLater();
+
+    foreach (IndexedDevice * d, m_dropped)
+    {
+        if (builder == d->builder)
+        {
+            m_dropped.removeOne(d);
+            delete d;
+            return;
+        }
+    }
+
+    foreach (IndexedDevice * d, m_devices)
+    {
+        if (builder != d->builder)
+            continue;
+
+        d->builder = 0;
+
+        if (!d->ready)
+        {
+            d->ready = true;
+            if (d->inotifyFd >= 0)
+            {
+                d->notifier = new QSocketNotifier(d->inotifyFd, QSocketNotifier::Read);
+                QObject::connect(d->notifier, SIGNAL(activated(int)), this, SLOT(slotInotify(int)));
+            }
+
+            qDebug() << "Indexed " << d->mountPath << " in " << builder->elapsed() << "ms: " << d->index->fileCount()
+                     << " files, " << d->index->memoryBytes() / 1024 << "kB";
+            emit indexReady(d->device);
+        }
+
+        // Walks queued after the builder found its list empty.
+        QMutexLocker lock(&d->mutex);
+        bool more = !d->walks.isEmpty();
+        lock.unlock();
+        if (more)
+            startBuilder(d);
+        return;
+    }
+}
+
+void ContentIndexer::slotInotify(int fd)
+{
+    foreach (IndexedDevice * d, m_devices)
+    {
+        if (fd == d->inotifyFd)
+        {
+            handleEvents(d);
+            return;
+        }
+    }
+}
+
+void ContentIndexer::slotDeviceRemoved(const DeviceInfoPtr &dev)
+{
+    dropDevice(dev->udisksPath);
+}
+
+void ContentIndexer::slotDeviceUnmounted(const DeviceInfoPtr &dev, ErrorCode e)
+{
+    if (OK == e)
+        dropDevice(dev->udisksPath);
+}
+
+void ContentIndexer::handleEvents(IndexedDevice *d)
+{
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool overflow = false;
+    bool queued = false;
+    ssize_t n;
+
+    QMutexLocker lock(&d->mutex);
+    while ((n = ::read(d->inotifyFd, buf, sizeof(buf))) > 0)
+    {
+        for (char * p = buf; p < buf + n; )
+        {
+            const struct inotify_event * ev = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                overflow = true;
+                continue;
+            }
+            if (ev->mask & IN_IGNORED)
+            {
+                d->watches.remove(ev->wd);
+                continue;
+            }
+
+            QHash<int, quint32>::const_iterator itr = d->watches.find(ev->wd);
+            if (d->watches.end() == itr || 0 == ev->len)
+                continue;
+
+            quint32 dir = *itr;
+            QByteArray name(ev->name);
+
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                d->index->removeNode(dir, name);
+            }
+            else if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+            {
+                quint32 id = d->index->addNode(dir, name);
+                QByteArray path;
+
+                if (!(ev->mask & IN_ISDIR) || !d->index->path(id, path))
+                    continue;
+
+                // A directory moved in brings its contents along, they don't generate events.
+                int wd = ::inotify_add_watch(d->inotifyFd, path.constData(), WATCH_MASK);
+                if (wd >= 0)
+                    d->watches.insert(wd, id);
+
+                d->walks.append(qMakePair(path, id));
+                queued = true;
+            }
+        }
+    }
+    lock.unlock();
+
+    if (queued && 0 == d->builder && !overflow)
+        startBuilder(d);
+
+    if (overflow)
+    {
+        qDebug() << "inotify queue overflow, reindexing " << d->mountPath;
+        DeviceInfo dev = d->device;
+        QString mount_path = d->mountPath;
+        dropDevice(dev.udisksPath);
+        addDevice(dev, mount_path);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef CONTENTINDEXER_H
+#define CONTENTINDEXER_H
+
+#include <QObject>
+#include <QtCore>
+
+#include "devicewatcher.h"
+
+class ContentIndexer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ContentIndexer(DeviceWatcher * watcher, QObject *parent = 0);
+    ~ContentIndexer();
+
+    void setEnabled(bool enabled);
+    bool enabled() const;
+
+    QStringList search(const QString& text, int limit);
+    QString memoryReport() const;
+
+signals:
+    void indexReady(const DeviceInfo& dev);
+
+public slots:
+    void addDevice(const DeviceInfo& dev, const QString& mount_path);
+    void dropDevice(const QString& dev_path);
+
+private slots:
+    void slotBuilderFinished();
+    void slotInotify(int fd);
+    void slotDeviceRemoved(const DeviceInfoPtr& dev);
+    void slotDeviceUnmounted(const DeviceInfoPtr& dev, ErrorCode e);
+
+private:
+    struct IndexedDevice;
+    class IndexVisitor;
+    class IndexBuilder;
+
+    DeviceWatcher * m_pdevWatcher;
+    QMap<QString, IndexedDevice*> m_devices;
+    QList<IndexedDevice*> m_dropped;
+    bool m_enabled;
+
+    void startBuilder(IndexedDevice * d);
+    void handleEvents(IndexedDevice * d);
+};
+
+#endif // CONTENTINDEXER_H
@@ -0,0 +1,217 @@
+#include "devicebench.h"
+
+#include <QMenu>
+
+#include "allocationcounter.h"
+#include "devicemenu.h"
+
+int DeviceBench::benchmarkFromCommandLine(int count)
+{
+    QTextStream out(stdout);
+    QElapsedTimer t;
+    count = qMax(count, 1);
+    const int drives = qMax(1, count / 4);
+
+    QVector<DeviceWatcher::DeviceInfoPtr> devs;
+    devs.reserve(count);
+    for (int i = 0; i < count; ++i)
+    {
+        // Mostly USB sticks, some with several partitions, and a tail of images and optical drives.
+        DeviceInfo * d = new DeviceInfo();
+        int drive = i % drives;
+        d->udisksPath = "/org/freedesktop/UDisks/devices/bench" + QString::number(i);
+        d->fileName = "/dev/bench" + QString::number(i);
+        d->drivePath = "/org/freedesktop/UDisks/devices/drive" + QString::number(drive);
+        d->driveFile = "/dev/drive" + QString::number(drive);
+        d->uuid = QUuid::createUuid().toString().mid(1, 36);
+        d->name = "Volume " + QString::number(i);
+        d->fileSystem = i % 3 ? "vfat" : "ext4";
+        d->sizeBytes = 8ULL << 30;
+        d->isMounted = false;
+        d->isSystem = false;
+        d->type = 0 == drive % 10 ? DeviceInfo::IMAGE : (0 == drive % 17 ? DeviceInfo::OPTICAL : DeviceInfo::USB);
+        devs << DeviceWatcher::DeviceInfoPtr(d);
+    }
+
+    // Baseline is the layout DeviceWatcher had before, a QMap keyed by path and scanned for anything else.
+    QMap<QString, DeviceWatcher::DeviceInfoPtr> map;
+    t.start();
+    foreach (const DeviceWatcher::DeviceInfoPtr& d, devs)
+        map.insert(d->udisksPath, d);
+    qint64 map_insert = t.nsecsElapsed();
+
+    DeviceStore store;
+    t.restart();
+    foreach (const DeviceWatcher::DeviceInfoPtr& d, devs)
+        store.insert(d);
+    qint64 store_insert = t.nsecsElapsed();
+
+    const int lookups = qMin(count, 1000);
+
+    t.restart();
+    for (int i = 0; i < lookups; ++i)
+    {
+        const QString& uuid = devs.at(i * (count / lookups))->uuid;
+        foreach (const DeviceWatcher::DeviceInfoPtr& d, map)
+        {
+            if (uuid == d->uuid)
+                break;
+        }
+    }
+    qint64 map_uuid = t.nsecsElapsed();
+
+    t.restart();
+    for (int i = 0; i < lookups; ++i)
+        store.byUuid(devs.at(i * (count / lookups))->uuid);
+    qint64 store_uuid = t.nsecsElapsed();
+
+    t.restart();
+    for (int i = 0; i < lookups; ++i)
+    {
+        const QString& drive = devs.at(i * (count / lookups))->drivePath;
+        QList<DeviceWatcher::DeviceInfoPtr> parts;
+        foreach (const DeviceWatcher::DeviceInfoPtr& d, map)
+        {
+            if (drive == d->drivePath)
+                parts << d;
+        }
+    }
+    qint64 map_drive = t.nsecsElapsed();
+
+    t.restart();
+    for (int i = 0; i < lookups; ++i)
+        store.byDrive(devs.at(i * (count / lookups))->drivePath);
+    qint64 store_drive = t.nsecsElapsed();
+
+    t.restart();
+    for (int i = 0; i < lookups; ++i)
+    {
+        DeviceInfo * d = new DeviceInfo(*devs.at(i * (count / lookups)));
+        d->isMounted = true;
+        store.insert(DeviceWatcher::DeviceInfoPtr(d));
+    }
+    qint64 store_change = t.nsecsElapsed();
+
+    DeviceStore removal = store;
+    t.restart();
+    foreach (const DeviceWatcher::DeviceInfoPtr& d, devs)
+        removal.remove(d->udisksPath);
+    qint64 store_remove = t.nsecsElapsed();
+
+    out << count << " devices on " << drives << " drives\n";
+    out << QString("insert: map %1 ms, store %2 ms\n").arg(map_insert / 1e6, 0, 'f', 2).arg(store_insert / 1e6, 0, 'f', 2);
+    out << QString("%1 uuid lookups: scan %2 ms, store %3 ms\n").arg(lookups).arg(map_uuid / 1e6, 0, 'f', 2).arg(store_uuid / 1e6, 0, 'f', 2);
+    out << QString("%1 drive lookups: scan %2 ms, store %3 ms\n").arg(lookups).arg(map_drive / 1e6, 0, 'f', 2).arg(store_drive / 1e6, 0, 'f', 2);
+    out << QString("%1 changes: store %2 ms\n").arg(lookups).arg(store_change / 1e6, 0, 'f', 2);
+    out << QString("remove all: store %1 ms\n").arg(store_remove / 1e6, 0, 'f', 2);
+    out.flush();
+
+    // One hotplug event is a new record for a changed device followed by three readers walking
+    // the device list (I/O monitor, tray menu, indexer). "before" is a hand-written replay of what
+    // DeviceWatcher did until records became shared snapshots, not the old code itself: separately
+    // allocated records and control blocks in a QMap, devices() handing out values(), receivers
+    // copying the record.
+    const int events = lookups;
+    QMap<QString, std::shared_ptr<DeviceInfo> > old_table;
+    foreach (const DeviceWatcher::DeviceInfoPtr& d, devs)
+        old_table.insert(d->udisksPath, std::shared_ptr<DeviceInfo>(new DeviceInfo(*d)));
+
+    AllocationCounter::start();
+    t.restart();
+    for (int i = 0; i < events; ++i)
+    {
+        std::shared_ptr<DeviceInfo> rec(new DeviceInfo(*devs.at(i * (count / events))));
+        rec->isMounted = !rec->isMounted;
+        old_table.insert(rec->udisksPath, rec);
+
+        for (int r = 0; r < 3; ++r)
+        {
+            QList<std::shared_ptr<DeviceInfo> > list = old_table.values();
+            DeviceInfo copy = *list.first();
+            Q_UNUSED(copy);
+        }
+    }
+    qint64 before_time = t.nsecsElapsed();
+    quint64 before_allocs = AllocationCounter::stop();
+
+    DeviceStore table;
+    foreach (const DeviceWatcher::DeviceInfoPtr& d, devs)
+        table.insert(d);
+    table.publish();
+
+    AllocationCounter::start();
+    t.restart();
+    for (int i = 0; i < events; ++i)
+    {
+        std::shared_ptr<DeviceInfo> rec = std::make_shared<DeviceInfo>(*devs.at(i * (count / events)));
+        rec->isMounted = !rec->isMounted;
+        table.insert(table.seal(rec));
+        table.publish();
+
+        for (int r = 0; r < 3; ++r)
+        {
+            DeviceSnapshotPtr snap = table.snapshot();
+            const DeviceInfo& view = *snap->at(0);
+            Q_UNUSED(view);
+        }
+    }
+    qint64 after_time = t.nsecsElapsed();
+    quint64 after_allocs = AllocationCounter::stop();
+
+    // "after" covers the store update, publishing and the copy-on-write of the chunk the next
+    // update touches, which is where sharing the table with snapshots costs.
+    out << "hotplug event (\"before\" replays the old record handling, it doesn't run the old code;"
+           " \"after\" includes the store update and publish):\n";
+    out << QString("  before %1 allocations, %2 us; after %3 allocations, %4 us\n")
+           .arg(double(before_allocs) / events, 0, 'f', 1).arg(before_time / 1e3 / events, 0, 'f', 1)
+           .arg(double(after_allocs) / events, 0, 'f', 1).arg(after_time / 1e3 / events, 0, 'f', 1);
+    out.flush();
+
+    // Menu entries get a title and one action, about what a real unmounted device has.
+    QMenu tray;
+    DeviceMenu dev_menu;
+    QObject::connect(&dev_menu, &DeviceMenu::populate, [&store](QMenu * menu, const QStringList& paths) {
+        foreach (const QString& path, paths)
+        {
+            QMenu * m = new QMenu(store.byPath(path)->name, menu);
+            m->addAction("Mount");
+            menu->addMenu(m);
+        }
+    });
+
+    t.restart();
+    foreach (const DeviceWatcher::DeviceInfoPtr& d, store.all())
+    {
+        QMenu * m = new QMenu(d->name, &tray);
+        m->addAction("Mount");
+        tray.addMenu(m);
+    }
+    qint64 flat_build = t.nsecsElapsed();
+    tray.clear();
+    qDeleteAll(tray.findChildren<QMenu*>(QString(), Qt::FindDirectChildrenOnly));
+
+    t.restart();
+    dev_menu.build(&tray, store.all());
+    qint64 grouped_build = t.nsecsElapsed();
+
+    QMenu * largest = 0;
+    for (QHash<QMenu*, DeviceMenu::Group>::const_iterator itr = dev_menu.m_groups.constBegin(); itr != dev_menu.m_groups.constEnd(); ++itr)
+    {
+        if (0 == largest || itr->devices.size() > dev_menu.m_groups.value(largest).devices.size())
+            largest = itr.key();
+    }
+
+    t.restart();
+    if (0 != largest)
+        QMetaObject::invokeMethod(largest, "aboutToShow");
+    qint64 group_open = t.nsecsElapsed();
+
+    t.restart();
+    dev_menu.m_pfilterEdit->setText("volume 12");
+    qint64 filter = t.nsecsElapsed();
+
+    out << QString("menu: flat %1 ms, grouped %2 ms, largest group %3 ms (%4 entries), filter %5 ms\n")
+           .arg(flat_build / 1e6, 0, 'f', 2).arg(grouped_build / 1e6, 0, 'f', 2).arg(group_open / 1e6, 0, 'f', 2)
+           .arg(0 != largest ? largest->actions().size() : 0).arg(filter / 1e6, 0, 'f', 2);
+    return 0;
+}
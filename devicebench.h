@@ -0,0 +1,12 @@
+#ifndef DEVICEBENCH_H
+#define DEVICEBENCH_H
+
+// Device store and tray menu timings against synthetic devices, for --bench-devices. Only built
+// with CONFIG+=bench, next to the allocation counter it reports from.
+class DeviceBench
+{
+public:
+    static int benchmarkFromCommandLine(int count);
+};
+
+#endif // DEVICEBENCH_H
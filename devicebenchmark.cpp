@@ -0,0 +1,426 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/statvfs.h>
+#include <algorithm>
+
+#include "devicebenchmark.h"
+
+const size_t SEQ_BLOCK = 4 * 1024 * 1024;
+const size_t RANDOM_BLOCK = 4096;
+const size_t BUFFER_ALIGNMENT = 4096;
+const qint64 RANDOM_TEST_NSEC = 5000000000LL;
+const int MAX_QUEUE_DEPTH = 64;
+const int MAX_HISTORY = 20;
+const char * SCRATCH_FILE = ".mountain-benchmark.tmp";
+const char * BENCHMARKS_KEY = "/Benchmarks/";
+
+namespace
+{
+
+inline qint64 nowNs()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+inline quint64 xorshift(quint64& s)
+{
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+char * allocBuffer(size_t size)
+{
+    void * p = 0;
+    if (::posix_memalign(&p, BUFFER_ALIGNMENT, size) != 0)
+        return 0;
+
+    // Random contents, some controllers compress or deduplicate zeroes.
+    quint64 seed = nowNs() | 1;
+    for (size_t i = 0; i + sizeof(quint64) <= size; i += sizeof(quint64))
+    {
+        quint64 v = xorshift(seed);
+        memcpy(static_cast<char*>(p) + i, &v, sizeof(v));
+    }
+    return static_cast<char*>(p);
+}
+
+LatencyPercentiles percentiles(QVector<quint32>& lat_us)
+{
+    LatencyPercentiles p;
+    if (lat_us.isEmpty())
+        return p;
+
+    std::sort(lat_us.begin(), lat_us.end());
+    p.p50 = lat_us.at(lat_us.size() * 50 / 100);
+    p.p95 = lat_us.at(lat_us.size() * 95 / 100);
+    p.p99 = lat_us.at(lat_us.size() * 99 / 100);
+    return p;
+}
+
+}
+
+class BenchmarkWorker : public JobWorker
+{
+public:
+    BenchmarkWorker(const QString& target, bool raw, qint64 size, int queue_depth, QObject * parent) :
+        JobWorker(parent), m_target(target), m_fd(-1)
+    {
+        result.raw = raw;
+        result.sizeBytes = size;
+        result.queueDepth = queue_depth;
+    }
+
+    void cancel() { m_cancel.store(1); }
+    bool cancelled() const { return 0 != m_cancel.load(); }
+
+    QString stage() const
+    {
+        QMutexLocker lock(&m_mutex);
+        return m_stage;
+    }
+
+    BenchmarkResult result;
+    QString error;
+
+protected:
+    void run();
+
+private:
+    class RandomThread : public QThread
+    {
+    public:
+        RandomThread(BenchmarkWorker * worker, bool write, int index) :
+            m_pworker(worker), m_write(write), m_index(index), ops(0), failed(false) {}
+
+        QVector<quint32> latencies;
+        qint64 ops;
+        bool failed;
+
+    protected:
+        void run() { m_pworker->randomLoop(this, m_write, m_index); }
+
+    private:
+        BenchmarkWorker * m_pworker;
+        bool m_write;
+        int m_index;
+    };
+
+    QString m_target;
+    int m_fd;
+    qint64 m_deadline;
+    QAtomicInt m_cancel;
+    mutable QMutex m_mutex;
+    QString m_stage;
+
+    void setStage(const QString& stage);
+    bool openTarget();
+    bool sequential(bool write, double& mbps);
+    bool random(bool write, double& iops, LatencyPercentiles& lat);
+    void randomLoop(RandomThread * t, bool write, int index);
+    bool fail(const QString& what);
+};
+
+void BenchmarkWorker::run()
+{
+    result.when = QDateTime::currentDateTime();
+
+    if (!openTarget())
+        return;
+
+    bool ok = true;
+
+    if (!result.raw)
+        ok = sequential(true, result.seqWriteMBps);
+    ok = ok && sequential(false, result.seqReadMBps);
+    ok = ok && random(false, result.randReadIops, result.randReadLatency);
+    if (!result.raw)
+        ok = ok && random(true, result.randWriteIops, result.randWriteLatency);
+
+    ::close(m_fd);
+    if (!result.raw)
+        ::unlink(QFile::encodeName(m_target).constData());
+}
+
+void BenchmarkWorker::setStage(const QString &stage)
+{
+    QMutexLocker lock(&m_mutex);
+    m_stage = stage;
+}
+
+bool BenchmarkWorker::openTarget()
+{
+    QByteArray path = QFile::encodeName(m_target);
+    int flags = result.raw ? O_RDONLY : O_RDWR | O_CREAT | O_TRUNC;
+
+    // O_DIRECT keeps the page cache out of the numbers; tmpfs and a few FUSE filesystems
+    // refuse it, those are measured through the cache and flagged in the result.
+    m_fd = ::open(path.constData(), flags | O_DIRECT | O_CLOEXEC, 0600);
+    if (m_fd < 0 && EINVAL == errno)
+    {
+        result.direct = false;
+        m_fd = ::open(path.constData(), flags | O_CLOEXEC, 0600);
+    }
+    if (m_fd < 0)
+        return fail("Can't open " + m_target);
+
+    if (result.raw)
+    {
+        off_t size = ::lseek(m_fd, 0, SEEK_END);
+        if (size > 0)
+            result.sizeBytes = qMin<qint64>(result.sizeBytes, size);
+    }
+
+    result.sizeBytes -= result.sizeBytes % SEQ_BLOCK;
+    if (result.sizeBytes < qint64(SEQ_BLOCK))
+    {
+        ::close(m_fd);
+        return fail("Not enough space for a benchmark on " + m_target);
+    }
+    return true;
+}
+
+bool BenchmarkWorker::sequential(bool write, double &mbps)
+{
+    setStage(write ? "sequential write" : "sequential read");
+
+    char * buf = allocBuffer(SEQ_BLOCK);
+    if (0 == buf)
+        return fail("Out of memory");
+
+    qint64 start = nowNs();
+    bool ok = true;
+
+    for (off_t offset = 0; offset < result.sizeBytes && !cancelled(); offset += SEQ_BLOCK)
+    {
+        ssize_t n = write ? ::pwrite(m_fd, buf, SEQ_BLOCK, offset) : ::pread(m_fd, buf, SEQ_BLOCK, offset);
+        if (n != ssize_t(SEQ_BLOCK))
+        {
+            ok = fail(write ? "Write failed" : "Read failed");
+            break;
+        }
+    }
+
+    // Whatever the device still buffers counts towards the write.
+    if (ok && write && ::fdatasync(m_fd) < 0)
+        ok = fail("Flush failed");
+
+    double secs = (nowNs() - start) / 1e9;
+    mbps = secs > 0 ? result.sizeBytes / secs / (1024 * 1024) : 0;
+    free(buf);
+    return ok && !cancelled();
+}
+
+bool BenchmarkWorker::random(bool write, double &iops, LatencyPercentiles &lat)
+{
+    setStage(QString(write ? "random 4K write" : "random 4K read") + ", queue depth " + QString::number(result.queueDepth));
+
+    // One synchronous thread per outstanding request, which gives the same queue depth as an
+    // asynchronous submitter without depending on io_uring being available.
+    QList<RandomThread*> threads;
+    m_deadline = nowNs() + RANDOM_TEST_NSEC;
+    qint64 start = nowNs();
+
+    for (int i = 0; i < result.queueDepth; ++i)
+    {
+        threads.append(new RandomThread(this, write, i));
+        threads.last()->start();
+    }
+
+    QVector<quint32> latencies;
+    qint64 ops = 0;
+    bool failed = false;
+
+    foreach (RandomThread * t, threads)
+    {
+        t->wait();
+        latencies += t->latencies;
+        ops += t->ops;
+        failed = failed || t->failed;
+        delete t;
+    }
+
+    if (write && ::fdatasync(m_fd) < 0)
+        failed = true;
+
+    double secs = (nowNs() - start) / 1e9;
+    iops = secs > 0 ? ops / secs : 0;
+    lat = percentiles(latencies);
+
+    if (failed)
+        return fail(write ? "Write failed" : "Read failed");
+    return !cancelled();
+}
+
+void BenchmarkWorker::randomLoop(RandomThread *t, bool write, int index)
+{
+    char * buf = allocBuffer(RANDOM_BLOCK);
+    if (0 == buf)
+    {
+        t->failed = true;
+        return;
+    }
+
+    quint64 seed = (nowNs() ^ (quint64(index + 1) * 0x9E3779B97F4A7C15ULL)) | 1;
+    quint64 blocks = result.sizeBytes / RANDOM_BLOCK;
+    t->latencies.reserve(1 << 16);
+
+    while (!cancelled())
+    {
+        off_t offset = off_t(xorshift(seed) % blocks) * RANDOM_BLOCK;
+        qint64 begin = nowNs();
+
+        ssize_t n = write ? ::pwrite(m_fd, buf, RANDOM_BLOCK, offset) : ::pread(m_fd, buf, RANDOM_BLOCK, offset);
+        qint64 end = nowNs();
+
+        if (n != ssize_t(RANDOM_BLOCK))
+        {
+            t->failed = true;
+            break;
+        }
+
+        t->latencies.append(quint32(qMin<qint64>((end - begin) / 1000, 0xFFFFFFFF)));
+        ++t->ops;
+
+        if (end >= m_deadline)
+            break;
+    }
+
+    free(buf);
+}
+
+bool BenchmarkWorker::fail(const QString &what)
+{
+    if (error.isEmpty())
+        error = what + ": " + QString::fromLocal8Bit(strerror(errno));
+    return false;
+}
+
+DeviceBenchmark::DeviceBenchmark(DeviceWatcher *watcher, QObject *parent) :
+    JobManager(watcher, parent)
+{
+}
+
+QList<BenchmarkResult> DeviceBenchmark::history(const QString &uuid)
+{
+    QSettings settings("Vladislav Nickolaev", "MOUNTain");
+    QList<BenchmarkResult> runs;
+
+    int size = settings.beginReadArray(BENCHMARKS_KEY + uuid);
+    for (int i = 0; i < size; ++i)
+    {
+        settings.setArrayIndex(i);
+
+        BenchmarkResult r;
+        r.when = settings.value("When").toDateTime();
+        r.raw = settings.value("Raw").toBool();
+        r.direct = settings.value("Direct", true).toBool();
+        r.sizeBytes = settings.value("SizeBytes").toLongLong();
+        r.queueDepth = settings.value("QueueDepth").toInt();
+        r.seqReadMBps = settings.value("SeqReadMBps").toDouble();
+        r.seqWriteMBps = settings.value("SeqWriteMBps").toDouble();
+        r.randReadIops = settings.value("RandReadIops").toDouble();
+        r.randWriteIops = settings.value("RandWriteIops").toDouble();
+        r.randReadLatency.p50 = settings.value("RandReadP50").toDouble();
+        r.randReadLatency.p95 = settings.value("RandReadP95").toDouble();
+        r.randReadLatency.p99 = settings.value("RandReadP99").toDouble();
+        r.randWriteLatency.p50 = settings.value("RandWriteP50").toDouble();
+        r.randWriteLatency.p95 = settings.value("RandWriteP95").toDouble();
+        r.randWriteLatency.p99 = settings.value("RandWriteP99").toDouble();
+        runs.append(r);
+    }
+    settings.endArray();
+    return runs;
+}
+
+void DeviceBenchmark::saveResult(const QString &uuid, const BenchmarkResult &result)
+{
+    QList<BenchmarkResult> runs = history(uuid);
+    runs.append(result);
+    while (runs.size() > MAX_HISTORY)
+        runs.removeFirst();
+
+    QSettings settings("Vladislav Nickolaev", "MOUNTain");
+    settings.remove(BENCHMARKS_KEY + uuid);
+    settings.beginWriteArray(BENCHMARKS_KEY + uuid, runs.size());
+
+    for (int i = 0; i < runs.size(); ++i)
+    {
+        const BenchmarkResult& r = runs.at(i);
+        settings.setArrayIndex(i);
+        settings.setValue("When", r.when);
+        settings.setValue("Raw", r.raw);
+        settings.setValue("Direct", r.direct);
+        settings.setValue("SizeBytes", r.sizeBytes);
+        settings.setValue("QueueDepth", r.queueDepth);
+        settings.setValue("SeqReadMBps", r.seqReadMBps);
+        settings.setValue("SeqWriteMBps", r.seqWriteMBps);
+        settings.setValue("RandReadIops", r.randReadIops);
+        settings.setValue("RandWriteIops", r.randWriteIops);
+        settings.setValue("RandReadP50", r.randReadLatency.p50);
+        settings.setValue("RandReadP95", r.randReadLatency.p95);
+        settings.setValue("RandReadP99", r.randReadLatency.p99);
+        settings.setValue("RandWriteP50", r.randWriteLatency.p50);
+        settings.setValue("RandWriteP95", r.randWriteLatency.p95);
+        settings.setValue("RandWriteP99", r.randWriteLatency.p99);
+    }
+    settings.endArray();
+}
+
+bool DeviceBenchmark::start(const DeviceInfo &dev, bool raw, int size_mb, int queue_depth, QString &error)
+{
+    if (isRunning(dev.udisksPath))
+    {
+        error = "A benchmark of this device is already running.";
+        return false;
+    }
+
+    QString target;
+    qint64 size = qint64(size_mb > 0 ? size_mb : DefaultSizeMB) * 1024 * 1024;
+
+    if (raw)
+    {
+        target = dev.fileName;
+    }
+    else
+    {
+        if (!dev.isMounted)
+        {
+            error = "Device is not mounted.";
+            return false;
+        }
+
+        struct statvfs st;
+        if (::statvfs(QFile::encodeName(dev.mountPoint).constData(), &st) == 0)
+            size = qMin<qint64>(size, qint64(st.f_bavail) * st.f_frsize * 8 / 10);
+        target = dev.mountPoint + "/" + SCRATCH_FILE;
+    }
+
+    return startJob(dev.udisksPath, dev, new BenchmarkWorker(target, raw, size,
+                    queue_depth > 0 ? qMin(queue_depth, MAX_QUEUE_DEPTH) : DefaultQueueDepth, this));
+}
+
+QString DeviceBenchmark::stage(const QString &dev_path) const
+{
+    BenchmarkWorker * w = static_cast<BenchmarkWorker*>(worker(dev_path));
+    return 0 == w ? QString() : w->stage();
+}
+
+void DeviceBenchmark::jobFinished(const DeviceInfo &dev, JobWorker *job_worker)
+{
+    BenchmarkWorker * worker = static_cast<BenchmarkWorker*>(job_worker);
+    bool ok = !worker->cancelled() && worker->error.isEmpty();
+    QString error = worker->cancelled() ? "Benchmark cancelled." : worker->error;
+
+    if (ok && !dev.uuid.isEmpty())
+        saveResult(dev.uuid, worker->result);
+
+    emit finished(dev, ok, worker->result, error);
+}
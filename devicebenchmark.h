@@ -0,0 +1,60 @@
+#ifndef DEVICEBENCHMARK_H
+#define DEVICEBENCHMARK_H
+
+#include <QObject>
+#include <QtCore>
+
+#include "jobmanager.h"
+
+struct LatencyPercentiles
+{
+    LatencyPercentiles() : p50(0), p95(0), p99(0) {}
+
+    double p50;
+    double p95;
+    double p99;
+};
+
+struct BenchmarkResult
+{
+    BenchmarkResult() : raw(false), direct(true), sizeBytes(0), queueDepth(0),
+        seqReadMBps(0), seqWriteMBps(0), randReadIops(0), randWriteIops(0) {}
+
+    QDateTime when;
+    bool raw;
+    bool direct;
+    qint64 sizeBytes;
+    int queueDepth;
+    double seqReadMBps;
+    double seqWriteMBps;
+    double randReadIops;
+    double randWriteIops;
+    LatencyPercentiles randReadLatency;
+    LatencyPercentiles randWriteLatency;
+};
+
+class DeviceBenchmark : public JobManager
+{
+    Q_OBJECT
+public:
+    enum Defaults
+    {
+        DefaultSizeMB = 256, DefaultQueueDepth = 4
+    };
+
+    explicit DeviceBenchmark(DeviceWatcher * watcher, QObject *parent = 0);
+
+    static QList<BenchmarkResult> history(const QString& uuid);
+    static void saveResult(const QString& uuid, const BenchmarkResult& r);
+
+    bool start(const DeviceInfo& dev, bool raw, int size_mb, int queue_depth, QString& error);
+    QString stage(const QString& dev_path) const;
+
+signals:
+    void finished(const DeviceInfo& dev, bool ok, BenchmarkResult result, QString error);
+
+protected:
+    void jobFinished(const DeviceInfo& dev, JobWorker * worker);
+};
+
+#endif // DEVICEBENCHMARK_H
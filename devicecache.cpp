@@ -0,0 +1,146 @@
+#include "devicecache.h"
+
+const char * DeviceCache::SERVICE = "org.mountain.DeviceCache";
+const char * DeviceCache::PATH = "/org/mountain/DeviceCache";
+const char * DeviceCache::INTERFACE = "org.mountain.DeviceCache";
+
+// Enough for a burst of hotplug events while a client is busy, anything older costs a snapshot.
+const int CHANGE_HISTORY = 512;
+
+DeviceCache::DeviceCache(DeviceWatcher *watcher, QObject *parent) :
+    QObject(parent),
+    m_pdevWatcher(watcher),
+    m_generation(0)
+{
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceAdded(DeviceInfoPtr)), this, SLOT(slotDeviceChanged(DeviceInfoPtr)));
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceChanged(DeviceInfoPtr)), this, SLOT(slotDeviceChanged(DeviceInfoPtr)));
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceRemoved(DeviceInfoPtr)), this, SLOT(slotDeviceRemoved(DeviceInfoPtr)));
+}
+
+bool DeviceCache::registerService()
+{
+    QDBusConnection bus = QDBusConnection::systemBus();
+
+    if (!bus.registerObject(PATH, this, QDBusConnection::ExportScriptableSlots | QDBusConnection::ExportScriptableSignals))
+    {
+        qWarning() << "Can't register " << PATH << ": " << bus.lastError().message();
+        return false;
+    }
+
+    if (!bus.registerService(SERVICE))
+    {
+        qWarning() << "Can't own " << SERVICE << ": " << bus.lastError().message();
+        return false;
+    }
+    return true;
+}
+
+QVariantMap DeviceCache::toMap(const DeviceInfo &dev)
+{
+    QVariantMap map;
+    map["Name"] = dev.name;
+    map["Uuid"] = dev.uuid;
+    map["Size"] = qulonglong(dev.sizeBytes);
+    map["FileSystem"] = dev.fileSystem;
+    map["IsMounted"] = dev.isMounted;
+    map["MountPoint"] = dev.mountPoint;
+    map["IsSystem"] = dev.isSystem;
+    map["Path"] = dev.udisksPath;
+    map["File"] = dev.fileName;
+    map["DrivePath"] = dev.drivePath;
+    map["DriveFile"] = dev.driveFile;
+    map["ImageFile"] = dev.imageFile;
+    map["Type"] = int(dev.type);
+    return map;
+}
+
+DeviceInfo DeviceCache::fromMap(const QVariantMap &map)
+{
+    DeviceInfo dev;
+    dev.name = map.value("Name").toString();
+    dev.uuid = map.value("Uuid").toString();
+    dev.sizeBytes = map.value("Size").toULongLong();
+    dev.fileSystem = map.value("FileSystem").toString();
+    dev.isMounted = map.value("IsMounted").toBool();
+    dev.mountPoint = map.value("MountPoint").toString();
+    dev.isSystem = map.value("IsSystem").toBool();
+    dev.udisksPath = map.value("Path").toString();
+    dev.fileName = map.value("File").toString();
+    dev.drivePath = map.value("DrivePath").toString();
+    dev.driveFile = map.value("DriveFile").toString();
+    dev.imageFile = map.value("ImageFile").toString();
+
+    int type = map.value("Type").toInt();
+    dev.type = type >= DeviceInfo::HDD && type <= DeviceInfo::IMAGE ? DeviceInfo::DeviceType(type) : DeviceInfo::OTHER;
+    return dev;
+}
+
+int DeviceCache::serveFromCommandLine()
+{
+    DeviceWatcher watcher(0, false);
+    if (!watcher.good())
+        return 1;
+
+    DeviceCache cache(&watcher);
+    if (!cache.registerService())
+        return 1;
+
+    qDebug() << "Serving " << watcher.devices().size() << " devices as " << SERVICE;
+    return QCoreApplication::exec();
+}
+
+QVariantList DeviceCache::Snapshot(uint &generation)
+{
+    QVariantList devices;
+    foreach (const DeviceWatcher::DeviceInfoPtr& dev, m_pdevWatcher->devices())
+        devices << toMap(*dev);
+
+    generation = m_generation;
+    return devices;
+}
+
+QVariantList DeviceCache::Changes(uint since, uint &generation, bool &complete)
+{
+    QVariantList changes;
+    generation = m_generation;
+
+    // Generations only ever count up, history reaching back to since + 1 is all a client needs.
+    complete = since == m_generation
+            || (since < m_generation && !m_changes.isEmpty() && m_changes.head().generation <= since + 1);
+    if (!complete)
+        return changes;
+
+    foreach (const Change& c, m_changes)
+    {
+        if (c.generation > since)
+            changes << c.device;
+    }
+    return changes;
+}
+
+void DeviceCache::slotDeviceChanged(const DeviceInfoPtr &dev)
+{
+    record(dev->udisksPath, toMap(*dev));
+}
+
+void DeviceCache::slotDeviceRemoved(const DeviceInfoPtr &dev)
+{
+    QVariantMap gone;
+    gone["Path"] = dev->udisksPath;
+    gone["Removed"] = true;
+    record(dev->udisksPath, gone);
+}
+
+void DeviceCache::record(const QString &path, const QVariantMap &device)
+{
+    Change c;
+    c.generation = ++m_generation;
+    c.path = path;
+    c.device = device;
+
+    m_changes.enqueue(c);
+    if (m_changes.size() > CHANGE_HISTORY)
+        m_changes.dequeue();
+
+    emit Changed(c.generation, path, device);
+}
@@ -0,0 +1,57 @@
+#ifndef DEVICECACHE_H
+#define DEVICECACHE_H
+
+#include <QObject>
+#include <QtCore>
+#include <QtDBus>
+
+#include "devicewatcher.h"
+
+// System bus front for one DeviceWatcher, so tray instances of every session share a single
+// udisks subscription. Clients take a snapshot, then follow Changed; each change carries a
+// generation number and a gap is filled from Changes() or, if history ran out, a new snapshot.
+// Removed devices are sent as a map holding only Path and Removed.
+class DeviceCache : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.mountain.DeviceCache")
+public:
+    static const char * SERVICE;
+    static const char * PATH;
+    static const char * INTERFACE;
+
+    explicit DeviceCache(DeviceWatcher * watcher, QObject *parent = 0);
+
+    bool registerService();
+
+    static QVariantMap toMap(const DeviceInfo& dev);
+    static DeviceInfo fromMap(const QVariantMap& map);
+    static int serveFromCommandLine();
+
+public slots:
+    Q_SCRIPTABLE QVariantList Snapshot(uint& generation);
+    Q_SCRIPTABLE QVariantList Changes(uint since, uint& generation, bool& complete);
+
+signals:
+    Q_SCRIPTABLE void Changed(uint generation, QString path, QVariantMap device);
+
+private slots:
+    void slotDeviceChanged(const DeviceInfoPtr& dev);
+    void slotDeviceRemoved(const DeviceInfoPtr& dev);
+
+private:
+    struct Change
+    {
+        uint generation;
+        QString path;
+        QVariantMap device;
+    };
+
+    DeviceWatcher * m_pdevWatcher;
+    uint m_generation;
+    QQueue<Change> m_changes;
+
+    void record(const QString& path, const QVariantMap& device);
+};
+
+#endif // DEVICECACHE_H
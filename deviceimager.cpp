@@ -0,0 +1,496 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "deviceimager.h"
+#include "hasher.h"
+#include "imageformat.h"
+
+const int MAX_THREADS = 16;
+const size_t BUFFER_ALIGNMENT = 4096;
+const char * PARTIAL_SUFFIX = ".mountain-part";
+const char * CHECKSUM_SUFFIX = ".xxh64";
+
+namespace
+{
+
+ssize_t readFull(int fd, char * buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = ::read(fd, buf + done, len - done);
+        if (n < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        if (0 == n)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+bool writeFull(int fd, const char * buf, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::pwrite(fd, buf, len, offset);
+        if (n < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+QString formatMB(qint64 bytes)
+{
+    return QString::number(bytes / (1024.0 * 1024.0), 'f', 0) + " MB";
+}
+
+}
+
+class ImageCreateWorker::CompressThread : public QThread
+{
+public:
+    explicit CompressThread(ImageCreateWorker * worker) : m_pworker(worker) {}
+
+protected:
+    void run() { m_pworker->compressLoop(); }
+
+private:
+    ImageCreateWorker * m_pworker;
+};
+
+class ImageCreateWorker::WriterThread : public QThread
+{
+public:
+    explicit WriterThread(ImageCreateWorker * worker) : m_pworker(worker) {}
+
+protected:
+    void run() { m_pworker->writeLoop(); }
+
+private:
+    ImageCreateWorker * m_pworker;
+};
+
+ImageCreateWorker::ImageCreateWorker(const QString &source, const QString &output, int threads, QObject *parent) :
+    JobWorker(parent),
+    m_source(source),
+    m_output(output),
+    m_compressed(!output.endsWith(".img") && !output.endsWith(".raw")),
+    m_threads(qBound(1, threads, MAX_THREADS)),
+    m_out(-1),
+    m_finishedAt(-1),
+    m_chunkCount(-1)
+{
+    // Two chunks per compressor keep every thread busy while the writer catches up on the oldest one.
+    m_slots.resize(m_threads * 2 + 2);
+    m_free.release(m_slots.size());
+
+    for (int i = 0; i < m_slots.size(); ++i)
+    {
+        void * p = 0;
+        if (::posix_memalign(&p, BUFFER_ALIGNMENT, ImageFormat::ChunkSize) != 0)
+            p = 0;
+        m_slots[i].data = static_cast<char*>(p);
+        m_done.append(new QSemaphore());
+    }
+}
+
+ImageCreateWorker::~ImageCreateWorker()
+{
+    foreach (const Slot& s, m_slots)
+        free(s.data);
+    qDeleteAll(m_done);
+}
+
+void ImageCreateWorker::cancel()
+{
+    m_cancel.store(1);
+}
+
+bool ImageCreateWorker::cancelled() const
+{
+    return 0 != m_cancel.load();
+}
+
+ImageCreateProgress ImageCreateWorker::progress() const
+{
+    ImageCreateProgress p;
+    p.bytesDone = m_bytesDone.load();
+    p.bytesTotal = m_bytesTotal.load();
+    p.bytesWritten = m_bytesWritten.load();
+    p.bytesZero = m_bytesZero.load();
+    p.threads = m_compressed ? m_threads : 0;
+    p.readStallMs = m_readStall.load();
+    p.compressStallMs = m_compressStall.load();
+
+    qint64 finished_at = m_finishedAt.load();
+    p.elapsedMs = finished_at >= 0 ? finished_at : m_clock.elapsed();
+    p.mbps = p.elapsedMs > 0 ? p.bytesDone * 1000.0 / p.elapsedMs / (1024 * 1024) : 0;
+    return p;
+}
+
+QString ImageCreateWorker::error() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_error;
+}
+
+QString ImageCreateWorker::output() const
+{
+    return m_output;
+}
+
+void ImageCreateWorker::run()
+{
+    m_clock.start();
+
+    foreach (const Slot& s, m_slots)
+    {
+        if (0 == s.data)
+        {
+            fail("Out of memory");
+            return;
+        }
+    }
+
+    QByteArray source = QFile::encodeName(m_source);
+    int in = ::open(source.constData(), O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (in < 0 && EINVAL == errno)
+        in = ::open(source.constData(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+    {
+        fail("Can't open " + m_source, errno);
+        return;
+    }
+
+    off_t size = ::lseek(in, 0, SEEK_END);
+    ::lseek(in, 0, SEEK_SET);
+    ::posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    m_bytesTotal.store(size);
+
+    // Written under a temporary name, a half finished image never looks like a backup.
+    QByteArray tmp = QFile::encodeName(m_output + PARTIAL_SUFFIX);
+    m_out = ::open(tmp.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_out < 0)
+    {
+        fail("Can't create " + m_output, errno);
+        ::close(in);
+        return;
+    }
+
+    QList<QThread*> compressors;
+    for (int i = 0; i < (m_compressed ? m_threads : 1); ++i)
+    {
+        compressors.append(new CompressThread(this));
+        compressors.last()->start();
+    }
+    WriterThread writer(this);
+    writer.start();
+
+    QScopedPointer<Hasher> hasher(Hasher::create(Hasher::XXH64));
+
+    for (qint64 i = 0; ; ++i)
+    {
+        qint64 t0 = m_clock.elapsed();
+        m_free.acquire();
+        m_readStall.fetchAndAddRelaxed(m_clock.elapsed() - t0);
+
+        Slot& s = m_slots[i % m_slots.size()];
+        s.len = 0;
+        s.zero = false;
+
+        if (0 == m_stop.load() && !cancelled())
+        {
+            s.len = readFull(in, s.data, ImageFormat::ChunkSize);
+            if (s.len < 0)
+            {
+                fail("Reading " + m_source + " failed", errno);
+                s.len = 0;
+            }
+        }
+
+        if (s.len > 0)
+            hasher->update(s.data, s.len);
+        else
+        {
+            // The empty chunk marks the end, the writer needs the digest once it gets there.
+            m_digest.resize(Hasher::digestSize(Hasher::XXH64));
+            hasher->final(reinterpret_cast<unsigned char*>(m_digest.data()));
+            m_chunkCount.store(i + 1);
+            m_todo.release(compressors.size() + 1);
+            break;
+        }
+
+        m_todo.release();
+    }
+
+    foreach (QThread * t, compressors)
+        t->wait();
+    qDeleteAll(compressors);
+    writer.wait();
+    ::close(in);
+
+    if (cancelled())
+        fail("Cancelled");
+
+    bool ok = error().isEmpty() && finish(size);
+    if (::close(m_out) < 0 && ok)
+        ok = fail("Writing " + m_output + " failed", errno);
+
+    if (ok && ::rename(tmp.constData(), QFile::encodeName(m_output).constData()) < 0)
+        ok = fail("Can't rename " + m_output, errno);
+    if (!ok)
+        ::unlink(tmp.constData());
+
+    m_finishedAt.store(m_clock.elapsed());
+}
+
+void ImageCreateWorker::compressLoop()
+{
+    forever
+    {
+        qint64 t0 = m_clock.elapsed();
+        m_todo.acquire();
+        m_compressStall.fetchAndAddRelaxed(m_clock.elapsed() - t0);
+
+        // Tokens beyond the end marker only wake the threads up to exit.
+        qint64 i = m_nextTask.fetchAndAddOrdered(1);
+        qint64 count = m_chunkCount.load();
+        if (count >= 0 && i >= count)
+            break;
+
+        Slot& s = m_slots[i % m_slots.size()];
+        if (s.len > 0 && 0 == m_stop.load())
+        {
+            if (m_compressed)
+                s.zero = ImageFormat::Zero == ImageFormat::encodeChunk(s.data, s.len, s.record);
+            else s.zero = ImageFormat::isZero(s.data, s.len);
+        }
+
+        m_done.at(i % m_slots.size())->release();
+    }
+}
+
+void ImageCreateWorker::writeLoop()
+{
+    off_t in_pos = 0;
+    off_t out_pos = 0;
+
+    if (m_compressed)
+    {
+        QByteArray h = ImageFormat::header(m_bytesTotal.load());
+        if (!writeFull(m_out, h.constData(), h.size(), 0))
+        {
+            fail("Writing " + m_output + " failed", errno);
+            m_stop.store(1);
+        }
+        out_pos = h.size();
+    }
+
+    for (qint64 i = 0; ; ++i)
+    {
+        int slot = i % m_slots.size();
+        m_done.at(slot)->acquire();
+        Slot& s = m_slots[slot];
+
+        if (0 == s.len)
+        {
+            if (m_compressed && 0 == m_stop.load())
+            {
+                QByteArray end = ImageFormat::record(ImageFormat::End, m_digest.constData(), m_digest.size());
+                if (!writeFull(m_out, end.constData(), end.size(), out_pos))
+                    fail("Writing " + m_output + " failed", errno);
+                m_bytesWritten.fetchAndAddRelaxed(end.size());
+            }
+            m_free.release();
+            break;
+        }
+
+        if (0 == m_stop.load())
+        {
+            bool ok = true;
+
+            if (m_compressed)
+            {
+                ok = writeFull(m_out, s.record.constData(), s.record.size(), out_pos);
+                out_pos += s.record.size();
+                m_bytesWritten.fetchAndAddRelaxed(s.record.size());
+            }
+            else if (!s.zero)
+            {
+                // Zero chunks of a raw image are left as holes.
+                ok = writeFull(m_out, s.data, s.len, in_pos);
+                m_bytesWritten.fetchAndAddRelaxed(s.len);
+            }
+
+            if (!ok)
+            {
+                fail("Writing " + m_output + " failed", errno);
+                m_stop.store(1);
+            }
+        }
+
+        if (s.zero)
+            m_bytesZero.fetchAndAddRelaxed(s.len);
+
+        in_pos += s.len;
+        m_bytesDone.store(in_pos);
+        m_free.release();
+    }
+}
+
+bool ImageCreateWorker::finish(qint64 size)
+{
+    if (!m_compressed && ::ftruncate(m_out, size) < 0)
+        return fail("Can't set size of " + m_output, errno);
+    if (::fsync(m_out) < 0)
+        return fail("Writing " + m_output + " failed", errno);
+
+    if (!m_compressed)
+    {
+        // Same line xxhsum prints, so "xxhsum -c" can check the raw image later.
+        QFile sum(m_output + CHECKSUM_SUFFIX);
+        if (!sum.open(QIODevice::WriteOnly | QIODevice::Truncate)
+                || sum.write(m_digest.toHex() + "  " + QFile::encodeName(QFileInfo(m_output).fileName()) + "\n") < 0)
+            return fail("Can't write " + sum.fileName());
+    }
+    return true;
+}
+
+bool ImageCreateWorker::fail(const QString &what, int err)
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_error.isEmpty())
+    {
+        m_error = what;
+        if (0 != err)
+            m_error += ": " + QString::fromLocal8Bit(strerror(err));
+    }
+    return false;
+}
+
+DeviceImager::DeviceImager(DeviceWatcher *watcher, QObject *parent) :
+    JobManager(watcher, parent)
+{
+}
+
+int DeviceImager::createFromCommandLine(const QString &source, const QString &output, int threads)
+{
+    QTextStream err(stderr);
+    ImageCreateWorker worker(source, output, threads > 0 ? threads : QThread::idealThreadCount());
+    worker.start();
+
+    while (!worker.wait(500))
+    {
+        ImageCreateProgress p = worker.progress();
+        err << "\r" << formatMB(p.bytesDone) << " of " << formatMB(p.bytesTotal) << ", "
+            << QString::number(p.mbps, 'f', 1) << " MB/s   ";
+        err.flush();
+    }
+
+    err << "\n";
+
+    if (!worker.error().isEmpty())
+    {
+        err << worker.error() << "\n";
+        return 1;
+    }
+
+    err << summary(worker.progress()) << "\n";
+    return 0;
+}
+
+QString DeviceImager::summary(const ImageCreateProgress &p)
+{
+    QString str = formatMB(p.bytesDone) + " read in " + QString::number(p.elapsedMs / 1000.0, 'f', 1) + " s ("
+            + QString::number(p.mbps, 'f', 1) + " MB/s), " + formatMB(p.bytesWritten) + " written, "
+            + formatMB(p.bytesZero) + " of zeroes.";
+
+    if (p.threads > 0 && p.elapsedMs > 0)
+    {
+        // Whichever side waited longer is not the bottleneck.
+        double read_stall = double(p.readStallMs) / p.elapsedMs;
+        double compress_stall = double(p.compressStallMs) / p.threads / p.elapsedMs;
+        str += " " + QString::number(p.threads) + " compression threads, limited by "
+                + (read_stall > compress_stall ? "compression" : "device read speed") + " (reader waited "
+                + QString::number(read_stall * 100, 'f', 0) + "%, compressors waited "
+                + QString::number(compress_stall * 100, 'f', 0) + "%).";
+    }
+    return str;
+}
+
+bool DeviceImager::start(const DeviceInfo &dev, const QString &output, QString &error)
+{
+    if (isRunning(jobKey(dev)))
+    {
+        error = "An image of this drive is already being created.";
+        return false;
+    }
+
+    // The image is restored onto the whole drive, so that is what gets read, partition table
+    // included. Every filesystem on it has to hold still for that.
+    QString source = dev.driveFile.isEmpty() ? dev.fileName : dev.driveFile;
+    QStringList mounted;
+    if (dev.isMounted)
+        mounted << dev.fileName;
+    foreach (const DeviceWatcher::DeviceInfoPtr& part, m_pdevWatcher->drivePartitions(dev.drivePath))
+    {
+        if (part->isMounted && !mounted.contains(part->fileName))
+            mounted << part->fileName;
+    }
+
+    if (!mounted.isEmpty())
+    {
+        error = "Unmount " + mounted.join(", ") + " first, a mounted filesystem can change while " + source
+                + " is being imaged.";
+        return false;
+    }
+
+    return startJob(jobKey(dev), dev, new ImageCreateWorker(source, output, QThread::idealThreadCount(), this));
+}
+
+QString DeviceImager::jobKey(const DeviceInfo &dev) const
+{
+    return dev.drivePath.isEmpty() ? dev.udisksPath : dev.drivePath;
+}
+
+ImageCreateProgress DeviceImager::progress(const QString &drive_path) const
+{
+    ImageCreateWorker * w = static_cast<ImageCreateWorker*>(worker(drive_path));
+    return 0 == w ? ImageCreateProgress() : w->progress();
+}
+
+void DeviceImager::jobFinished(const DeviceInfo &dev, JobWorker *job_worker)
+{
+    ImageCreateWorker * worker = static_cast<ImageCreateWorker*>(job_worker);
+    bool ok = worker->error().isEmpty();
+    QString message = ok ? QFileInfo(worker->output()).fileName() + ": " + summary(worker->progress()) : worker->error();
+
+    emit finished(dev, ok, message);
+}
+
+void DeviceImager::deviceMounted(const DeviceInfoPtr &dev, ErrorCode e)
+{
+    if (OK == e)
+        cancel(jobKey(*dev));
+}
+
+void DeviceImager::deviceUnmounted(const DeviceInfoPtr &dev, ErrorCode e)
+{
+    Q_UNUSED(dev);
+    Q_UNUSED(e);
+}
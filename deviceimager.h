@@ -0,0 +1,114 @@
+#ifndef DEVICEIMAGER_H
+#define DEVICEIMAGER_H
+
+#include <QObject>
+#include <QtCore>
+
+#include "jobmanager.h"
+
+struct ImageCreateProgress
+{
+    ImageCreateProgress() : bytesDone(0), bytesTotal(0), bytesWritten(0), bytesZero(0), mbps(0), threads(0),
+        elapsedMs(0), readStallMs(0), compressStallMs(0) {}
+
+    qint64 bytesDone;
+    qint64 bytesTotal;
+    qint64 bytesWritten;
+    qint64 bytesZero;
+    double mbps;
+    int threads;
+    qint64 elapsedMs;
+    // Time the reader waited for a free buffer, compression or output couldn't keep up.
+    qint64 readStallMs;
+    // Time the compressors waited for data, summed over threads, the device couldn't keep up.
+    qint64 compressStallMs;
+};
+
+class ImageCreateWorker : public JobWorker
+{
+public:
+    ImageCreateWorker(const QString& source, const QString& output, int threads, QObject * parent = 0);
+    ~ImageCreateWorker();
+
+    void cancel();
+    bool cancelled() const;
+    ImageCreateProgress progress() const;
+    QString error() const;
+    QString output() const;
+
+protected:
+    void run();
+
+private:
+    class CompressThread;
+    class WriterThread;
+
+    struct Slot
+    {
+        Slot() : data(0), len(0), zero(false) {}
+
+        char * data;
+        qint64 len;
+        bool zero;
+        QByteArray record;
+    };
+
+    QString m_source;
+    QString m_output;
+    bool m_compressed;
+    int m_threads;
+    int m_out;
+    QAtomicInt m_cancel;
+    QAtomicInt m_stop;
+    QAtomicInteger<qint64> m_bytesDone;
+    QAtomicInteger<qint64> m_bytesTotal;
+    QAtomicInteger<qint64> m_bytesWritten;
+    QAtomicInteger<qint64> m_bytesZero;
+    QAtomicInteger<qint64> m_readStall;
+    QAtomicInteger<qint64> m_compressStall;
+    QAtomicInteger<qint64> m_finishedAt;
+    QElapsedTimer m_clock;
+    mutable QMutex m_mutex;
+    QString m_error;
+    QByteArray m_digest;
+
+    // Chunks travel reader -> any compressor -> writer, the writer takes them back in read order.
+    QVector<Slot> m_slots;
+    QSemaphore m_free;
+    QSemaphore m_todo;
+    QVector<QSemaphore*> m_done;
+    QAtomicInteger<qint64> m_nextTask;
+    QAtomicInteger<qint64> m_chunkCount;
+
+    void compressLoop();
+    void writeLoop();
+    bool finish(qint64 size);
+    bool fail(const QString& what, int err = 0);
+};
+
+class DeviceImager : public JobManager
+{
+    Q_OBJECT
+public:
+    explicit DeviceImager(DeviceWatcher * watcher, QObject *parent = 0);
+
+    static int createFromCommandLine(const QString& source, const QString& output, int threads);
+    static QString summary(const ImageCreateProgress& p);
+
+    // Images the whole drive dev is on, the form ImageWriter restores.
+    bool start(const DeviceInfo& dev, const QString& output, QString& error);
+    ImageCreateProgress progress(const QString& drive_path) const;
+
+    QString jobKey(const DeviceInfo& dev) const;
+
+signals:
+    void finished(const DeviceInfo& dev, bool ok, QString message);
+
+protected:
+    void jobFinished(const DeviceInfo& dev, JobWorker * worker);
+    // Unmounting is what the image needs, only a mount makes the source change under it.
+    void deviceMounted(const DeviceInfoPtr& dev, ErrorCode e);
+    void deviceUnmounted(const DeviceInfoPtr& dev, ErrorCode e);
+};
+
+#endif // DEVICEIMAGER_H
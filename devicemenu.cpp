@@ -0,0 +1,221 @@
+#include "devicemenu.h"
+
+// Up to this many devices are listed flat, like they always were.
+const int FLAT_MENU_LIMIT = 20;
+const int FILTER_RESULTS_LIMIT = 30;
+// Longer lists in a group are split into submenus of this many entries, by file name range.
+const int MENU_CHUNK_SIZE = 25;
+
+namespace
+{
+QString groupTitle(DeviceInfo::DeviceType type)
+{
+    //HDD, USB, FLOPPY, OPTICAL, OTHER, IMAGE
+    static QString group_names[] = { "Internal disks", "USB disks", "Floppy disks", "Optical disks", "Other devices", "Disk images" };
+    return group_names[type];
+}
+
+bool matches(const DeviceInfo& dev, const QString& text)
+{
+    return dev.name.contains(text, Qt::CaseInsensitive) || dev.fileName.contains(text, Qt::CaseInsensitive)
+            || dev.uuid.contains(text, Qt::CaseInsensitive) || dev.driveFile.contains(text, Qt::CaseInsensitive);
+}
+}
+
+DeviceMenu::DeviceMenu(QObject *parent) :
+    QObject(parent),
+    m_pmenu(0),
+    m_pcontainer(0),
+    m_presults(0),
+    m_grouped(false)
+{
+    m_pfilterEdit = new QLineEdit();
+    m_pfilterEdit->setPlaceholderText("Filter devices...");
+    m_pfilterEdit->setClearButtonEnabled(true);
+    QObject::connect(m_pfilterEdit, SIGNAL(textChanged(QString)), this, SLOT(slotFilterChanged(QString)));
+
+    m_pactFilter = new QWidgetAction(this);
+    m_pactFilter->setDefaultWidget(m_pfilterEdit);
+
+    m_pactFilterEnd = new QAction(this);
+    m_pactFilterEnd->setSeparator(true);
+}
+
+DeviceMenu::~DeviceMenu()
+{
+    delete m_presults;
+    delete m_pcontainer;
+}
+
+void DeviceMenu::build(QMenu *menu, const QVector<DeviceWatcher::DeviceInfoPtr> &devices)
+{
+    // Everything made for the previous build hangs off these two, so nothing survives a reload.
+    // The tray menu may be open while devices come and go, hence no immediate delete.
+    if (0 != m_presults)
+        m_presults->deleteLater();
+    if (0 != m_pcontainer)
+        m_pcontainer->deleteLater();
+
+    m_pmenu = menu;
+    m_pcontainer = new QMenu();
+    m_presults = 0;
+    m_groups.clear();
+    m_devices.clear();
+    m_devices.reserve(devices.size());
+
+    QStringList paths;
+    foreach (const DeviceWatcher::DeviceInfoPtr& dev, devices)
+    {
+        m_devices.insert(dev->udisksPath, dev);
+        paths << dev->udisksPath;
+    }
+
+    m_grouped = devices.size() > FLAT_MENU_LIMIT;
+
+    if (!m_grouped)
+    {
+        paths.sort();
+        emit populate(m_pcontainer, paths);
+        moveActions(m_pcontainer, 0);
+        return;
+    }
+
+    QMap<int, Group> groups;
+    foreach (const DeviceWatcher::DeviceInfoPtr& dev, devices)
+    {
+        Group& g = groups[dev->type];
+        g.devices << dev->udisksPath;
+        g.drives[dev->drivePath] << dev->udisksPath;
+    }
+
+    m_pmenu->addAction(m_pactFilter);
+    m_pmenu->addAction(m_pactFilterEnd);
+
+    for (QMap<int, Group>::const_iterator itr = groups.constBegin(); itr != groups.constEnd(); ++itr)
+    {
+        QString title = groupTitle(DeviceInfo::DeviceType(itr.key())) + " (" + QString::number(itr->devices.size()) + ")";
+        QMenu * group_menu = new QMenu(title, m_pcontainer);
+        QObject::connect(group_menu, SIGNAL(aboutToShow()), this, SLOT(slotGroupAboutToShow()));
+        m_groups.insert(group_menu, *itr);
+        m_pmenu->addMenu(group_menu);
+    }
+
+    // A rebuild while the user is typing keeps the results in step with the devices.
+    if (!m_pfilterEdit->text().isEmpty())
+        slotFilterChanged(m_pfilterEdit->text());
+}
+
+bool DeviceMenu::grouped() const
+{
+    return m_grouped;
+}
+
+void DeviceMenu::slotGroupAboutToShow()
+{
+    QMenu * group_menu = qobject_cast<QMenu*>(sender());
+    if (!m_groups.contains(group_menu) || !group_menu->isEmpty())
+        return;
+
+    // Copied, drive and chunk menus are added to m_groups below.
+    const Group group = m_groups.value(group_menu);
+
+    // Type groups split into one submenu per drive with several partitions, drive menus list their partitions.
+    QStringList singles;
+    QList<QMenu*> drive_menus;
+
+    if (group.drives.size() > 1)
+    {
+        for (QMap<QString, QStringList>::const_iterator d = group.drives.constBegin(); d != group.drives.constEnd(); ++d)
+        {
+            if (1 == d->size())
+            {
+                singles << d->first();
+                continue;
+            }
+
+            DeviceWatcher::DeviceInfoPtr first = m_devices.value(d->first());
+            QString drive_name = first->driveFile.isEmpty() ? d.key() : first->driveFile;
+
+            QMenu * drive_menu = new QMenu(drive_name + " (" + QString::number(d->size()) + ")", group_menu);
+            QObject::connect(drive_menu, SIGNAL(aboutToShow()), this, SLOT(slotGroupAboutToShow()));
+
+            Group g;
+            g.devices = *d;
+            m_groups.insert(drive_menu, g);
+            drive_menus << drive_menu;
+        }
+    }
+    else singles = group.devices;
+
+    foreach (QMenu * drive_menu, drive_menus)
+        group_menu->addMenu(drive_menu);
+
+    QStringList sorted = sortedPaths(singles);
+    if (sorted.size() <= MENU_CHUNK_SIZE)
+    {
+        emit populate(group_menu, sorted);
+        return;
+    }
+
+    // Loop, dm or iSCSI devices are a drive each and all end up here; hundreds of them listed flat
+    // would be the very menu grouping is meant to avoid.
+    for (int i = 0; i < sorted.size(); i += MENU_CHUNK_SIZE)
+    {
+        QStringList chunk = sorted.mid(i, MENU_CHUNK_SIZE);
+        QString title = m_devices.value(chunk.first())->fileName + " - " + m_devices.value(chunk.last())->fileName;
+
+        QMenu * chunk_menu = new QMenu(title, group_menu);
+        QObject::connect(chunk_menu, SIGNAL(aboutToShow()), this, SLOT(slotGroupAboutToShow()));
+
+        Group g;
+        g.devices = chunk;
+        m_groups.insert(chunk_menu, g);
+        group_menu->addMenu(chunk_menu);
+    }
+}
+
+void DeviceMenu::slotFilterChanged(const QString &text)
+{
+    if (0 != m_presults)
+        m_presults->deleteLater();
+    m_presults = 0;
+
+    QString needle = text.trimmed();
+    if (needle.isEmpty() || !m_grouped)
+        return;
+
+    QStringList found;
+    foreach (const DeviceWatcher::DeviceInfoPtr& dev, m_devices)
+    {
+        if (matches(*dev, needle))
+        {
+            found << dev->udisksPath;
+            if (found.size() >= FILTER_RESULTS_LIMIT)
+                break;
+        }
+    }
+
+    m_presults = new QMenu();
+    emit populate(m_presults, sortedPaths(found));
+    moveActions(m_presults, m_pactFilterEnd);
+}
+
+QStringList DeviceMenu::sortedPaths(const QStringList &paths) const
+{
+    QMap<QString, QString> by_file;
+    foreach (const QString& path, paths)
+    {
+        DeviceWatcher::DeviceInfoPtr dev = m_devices.value(path);
+        by_file.insertMulti(0 != dev ? dev->fileName : path, path);
+    }
+    return by_file.values();
+}
+
+void DeviceMenu::moveActions(QMenu *from, QAction *before)
+{
+    // The submenus stay owned by from, only their entries show up in the tray menu.
+    QList<QAction*> actions = from->actions();
+    m_pmenu->insertActions(before, actions);
+    foreach (QAction * act, actions)
+        from->removeAction(act);
+}
@@ -0,0 +1,55 @@
+#ifndef DEVICEMENU_H
+#define DEVICEMENU_H
+
+#include <QObject>
+#include <QtCore>
+#include <QMenu>
+#include <QLineEdit>
+#include <QWidgetAction>
+
+#include "devicewatcher.h"
+
+// Device section of the tray menu. A handful of devices is listed as is, larger sets are grouped
+// by type and by drive, with groups filled only when opened and a filter box on top.
+class DeviceMenu : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DeviceMenu(QObject *parent = 0);
+    ~DeviceMenu();
+
+    void build(QMenu * menu, const QVector<DeviceWatcher::DeviceInfoPtr>& devices);
+    bool grouped() const;
+
+signals:
+    // Receiver adds one submenu per device path to menu, parented to it.
+    void populate(QMenu * menu, const QStringList& dev_paths);
+
+private slots:
+    void slotGroupAboutToShow();
+    void slotFilterChanged(const QString& text);
+
+private:
+    friend class DeviceBench;
+
+    struct Group
+    {
+        QStringList devices;
+        QMap<QString, QStringList> drives;
+    };
+
+    QMenu * m_pmenu;
+    QMenu * m_pcontainer;
+    QMenu * m_presults;
+    QLineEdit * m_pfilterEdit;
+    QWidgetAction * m_pactFilter;
+    QAction * m_pactFilterEnd;
+    QHash<QString, DeviceWatcher::DeviceInfoPtr> m_devices;
+    QHash<QMenu*, Group> m_groups;
+    bool m_grouped;
+
+    QStringList sortedPaths(const QStringList& paths) const;
+    void moveActions(QMenu * from, QAction * before);
+};
+
+#endif // DEVICEMENU_H
@@ -0,0 +1,213 @@
+#include "devicestore.h"
+#include "devicewatcher.h"
+
+const int MIN_SWEEP_AT = 64;
+
+DeviceStore::DeviceStore() :
+    m_version(0),
+    m_snapshot(0),
+    m_sweepAt(MIN_SWEEP_AT)
+{
+    publish();
+}
+
+DeviceStore::~DeviceStore()
+{
+    delete m_snapshot.load();
+    qDeleteAll(m_retired);
+}
+
+DeviceStore::DeviceInfoPtr DeviceStore::seal(const std::shared_ptr<DeviceInfo> &dev)
+{
+    intern(dev->fileSystem);
+    intern(dev->drivePath);
+    intern(dev->driveFile);
+    intern(dev->imageFile);
+    return dev;
+}
+
+DeviceStore::DeviceInfoPtr DeviceStore::insert(const DeviceInfoPtr &dev)
+{
+    QHash<QString, int>::const_iterator itr = m_byPath.find(dev->udisksPath);
+    if (m_byPath.end() != itr)
+    {
+        int slot = *itr;
+        DeviceInfoPtr old = m_devices.at(slot);
+        unindex(slot);
+        store(slot, dev);
+        index(slot);
+        return old;
+    }
+
+    store(m_devices.size(), dev);
+    index(m_devices.size() - 1);
+    return DeviceInfoPtr();
+}
+
+DeviceStore::DeviceInfoPtr DeviceStore::remove(const QString &udisks_path)
+{
+    QHash<QString, int>::const_iterator itr = m_byPath.find(udisks_path);
+    if (m_byPath.end() == itr)
+        return DeviceInfoPtr();
+
+    int slot = *itr;
+    int last = m_devices.size() - 1;
+    DeviceInfoPtr dev = m_devices.at(slot);
+
+    unindex(slot);
+    if (slot != last)
+    {
+        unindex(last);
+        store(slot, m_devices.at(last));
+        index(slot);
+    }
+    removeLast();
+    return dev;
+}
+
+DeviceStore::DeviceInfoPtr DeviceStore::byPath(const QString &udisks_path) const
+{
+    int slot = m_byPath.value(udisks_path, -1);
+    return slot >= 0 ? m_devices.at(slot) : DeviceInfoPtr();
+}
+
+DeviceStore::DeviceInfoPtr DeviceStore::byUuid(const QString &uuid) const
+{
+    int slot = m_byUuid.value(uuid, -1);
+    return slot >= 0 ? m_devices.at(slot) : DeviceInfoPtr();
+}
+
+DeviceStore::DeviceInfoPtr DeviceStore::byFile(const QString &file_name) const
+{
+    int slot = m_byFile.value(file_name, -1);
+    return slot >= 0 ? m_devices.at(slot) : DeviceInfoPtr();
+}
+
+QList<DeviceStore::DeviceInfoPtr> DeviceStore::byDrive(const QString &drive_path) const
+{
+    QList<DeviceInfoPtr> devs;
+    for (QMultiHash<QString, int>::const_iterator itr = m_byDrive.find(drive_path);
+         itr != m_byDrive.end() && itr.key() == drive_path; ++itr)
+        devs.append(m_devices.at(*itr));
+    return devs;
+}
+
+const QVector<DeviceStore::DeviceInfoPtr> &DeviceStore::all() const
+{
+    return m_devices;
+}
+
+int DeviceStore::size() const
+{
+    return m_devices.size();
+}
+
+quint64 DeviceStore::version() const
+{
+    return m_version;
+}
+
+DeviceSnapshotPtr DeviceStore::snapshot() const
+{
+    // While m_readers is raised publish() frees nothing, so the holder stays valid until the
+    // reference below is taken. Copying a shared_ptr is a plain atomic increment.
+    m_readers.ref();
+    DeviceSnapshotPtr snap = *m_snapshot.loadAcquire();
+    m_readers.deref();
+    return snap;
+}
+
+void DeviceStore::publish()
+{
+    std::shared_ptr<DeviceSnapshot> snap = std::make_shared<DeviceSnapshot>();
+    snap->version = ++m_version;
+    snap->size = m_devices.size();
+    snap->chunks = m_chunks;
+
+    DeviceSnapshotPtr * old = m_snapshot.fetchAndStoreOrdered(new DeviceSnapshotPtr(snap));
+    if (0 != old)
+        m_retired.append(old);
+
+    // A reader that shows up from here on can only load the new holder.
+    if (0 == m_readers.fetchAndAddOrdered(0))
+    {
+        qDeleteAll(m_retired);
+        m_retired.clear();
+    }
+}
+
+void DeviceStore::index(int slot)
+{
+    const DeviceInfo& dev = *m_devices.at(slot);
+    m_byPath.insert(dev.udisksPath, slot);
+    m_byFile.insert(dev.fileName, slot);
+    m_byDrive.insert(dev.drivePath, slot);
+    if (!dev.uuid.isEmpty())
+        m_byUuid.insert(dev.uuid, slot);
+}
+
+void DeviceStore::unindex(int slot)
+{
+    const DeviceInfo& dev = *m_devices.at(slot);
+    m_byPath.remove(dev.udisksPath);
+    m_byFile.remove(dev.fileName);
+    m_byDrive.remove(dev.drivePath, slot);
+    m_byUuid.remove(dev.uuid, slot);
+}
+
+void DeviceStore::intern(QString &s)
+{
+    if (s.isEmpty())
+        return;
+
+    QSet<QString>::const_iterator itr = m_strings.constFind(s);
+    if (m_strings.constEnd() != itr)
+    {
+        s = *itr;
+        return;
+    }
+
+    if (m_strings.size() >= m_sweepAt)
+        sweepStrings();
+    m_strings.insert(s);
+}
+
+void DeviceStore::sweepStrings()
+{
+    // A string only the set holds is in no record, snapshot or index. Records are never changed
+    // after seal(), so nothing but intern() can pick the set's copy up again.
+    QSet<QString>::iterator itr = m_strings.begin();
+    while (m_strings.end() != itr)
+    {
+        if (itr->isDetached())
+            itr = m_strings.erase(itr);
+        else ++itr;
+    }
+    m_sweepAt = qMax(MIN_SWEEP_AT, 2 * m_strings.size());
+}
+
+void DeviceStore::store(int slot, const DeviceInfoPtr &dev)
+{
+    int c = slot / DeviceSnapshot::ChunkSize;
+    int i = slot % DeviceSnapshot::ChunkSize;
+
+    if (slot == m_devices.size())
+        m_devices.append(dev);
+    else m_devices[slot] = dev;
+
+    // Chunks are implicitly shared with the published snapshot, writing detaches only this one.
+    if (c == m_chunks.size())
+        m_chunks.append(QVector<DeviceInfoPtr>());
+    QVector<DeviceInfoPtr>& chunk = m_chunks[c];
+    if (i == chunk.size())
+        chunk.append(dev);
+    else chunk[i] = dev;
+}
+
+void DeviceStore::removeLast()
+{
+    m_devices.removeLast();
+    m_chunks.last().removeLast();
+    if (m_chunks.last().isEmpty())
+        m_chunks.removeLast();
+}
@@ -0,0 +1,95 @@
+#ifndef DEVICESTORE_H
+#define DEVICESTORE_H
+
+#include <QtCore>
+#include <memory>
+
+struct DeviceInfo;
+
+// Device records never change once stored, an update replaces the whole record. A handle is
+// therefore a consistent view of the device for as long as it is held, on any thread.
+typedef std::shared_ptr<const DeviceInfo> DeviceInfoPtr;
+
+// The device table as of one version. Published snapshots are never modified. Records are kept
+// in chunks shared with the store, a change after publishing copies only the chunk it touches.
+struct DeviceSnapshot
+{
+    enum
+    {
+        ChunkSize = 64
+    };
+
+    DeviceSnapshot() : version(0), size(0) {}
+
+    const DeviceInfoPtr& at(int i) const { return chunks.at(i / ChunkSize).at(i % ChunkSize); }
+
+    quint64 version;
+    int size;
+    QVector<QVector<DeviceInfoPtr> > chunks;
+};
+
+typedef std::shared_ptr<const DeviceSnapshot> DeviceSnapshotPtr;
+
+// Device table for DeviceWatcher. Records sit in one vector (removal swaps the last one in),
+// hashes map udisks path, UUID, device file and drive to their slot, and strings that repeat
+// across devices (filesystem, drive, ...) share one copy.
+class DeviceStore
+{
+public:
+    typedef ::DeviceInfoPtr DeviceInfoPtr;
+
+    DeviceStore();
+    ~DeviceStore();
+
+    // Interns the strings shared between devices, the record is read-only from here on.
+    DeviceInfoPtr seal(const std::shared_ptr<DeviceInfo>& dev);
+
+    // Replaces a record with the same udisks path, returns the old one.
+    DeviceInfoPtr insert(const DeviceInfoPtr& dev);
+    DeviceInfoPtr remove(const QString& udisks_path);
+
+    DeviceInfoPtr byPath(const QString& udisks_path) const;
+    // Cloned filesystems share a UUID, any one of the devices carrying it is returned.
+    DeviceInfoPtr byUuid(const QString& uuid) const;
+    DeviceInfoPtr byFile(const QString& file_name) const;
+    QList<DeviceInfoPtr> byDrive(const QString& drive_path) const;
+
+    const QVector<DeviceInfoPtr>& all() const;
+    int size() const;
+    quint64 version() const;
+
+    // Makes the table as it is now visible to snapshot(), once per batch of changes.
+    void publish();
+    // Safe to call from any thread while the owning thread keeps changing the table. Readers
+    // only take an atomic reference, never a lock: publish() swaps the pointer and frees
+    // replaced snapshots later, once no reader is between loading and referencing one.
+    DeviceSnapshotPtr snapshot() const;
+
+private:
+    Q_DISABLE_COPY(DeviceStore)
+
+    QVector<DeviceInfoPtr> m_devices;
+    // The same records in snapshot chunks, see DeviceSnapshot.
+    QVector<QVector<DeviceInfoPtr> > m_chunks;
+    quint64 m_version;
+    QAtomicPointer<DeviceSnapshotPtr> m_snapshot;
+    mutable QAtomicInt m_readers;
+    QList<DeviceSnapshotPtr*> m_retired;
+    QHash<QString, int> m_byPath;
+    QMultiHash<QString, int> m_byUuid;
+    QHash<QString, int> m_byFile;
+    QMultiHash<QString, int> m_byDrive;
+    // Strings no record refers to any more are swept out once the set has doubled since the last
+    // sweep, loop and dm devices bring new drive and image paths on every attach.
+    QSet<QString> m_strings;
+    int m_sweepAt;
+
+    void index(int slot);
+    void unindex(int slot);
+    void store(int slot, const DeviceInfoPtr& dev);
+    void removeLast();
+    void intern(QString& s);
+    void sweepStrings();
+};
+
+#endif // DEVICESTORE_H
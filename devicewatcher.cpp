@@ -1,43 +1,43 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "devicecache.h"
 #include "devicewatcher.h"
 #include "interfaces/udisksdeviceinterface.h"
 
 const char * UDISKS_SERVICE = "org.freedesktop.UDisks";
 const char * UDISKS_PATH = "/org/freedesktop/UDisks";
+const char * UDISKS2_SERVICE = "org.freedesktop.UDisks2";
+const char * UDISKS2_MANAGER_PATH = "/org/freedesktop/UDisks2/Manager";
+const char * UDISKS2_MANAGER_INTERFACE = "org.freedesktop.UDisks2.Manager";
 const char * DEVPATH_PROPERTY = "DevicePath";
+const char * FILE_PROPERTY = "ImageFile";
 
-DeviceWatcher::DeviceWatcher(QObject *parent) :
-    QObject(parent)
+DeviceWatcher::DeviceWatcher(QObject *parent, bool use_cache) :
+    QObject(parent),
+    m_pcache(0),
+    m_cacheGeneration(0)
 {
+    qRegisterMetaType<DeviceInfoPtr>("DeviceInfoPtr");
+
     m_interface = new UdisksInterface(UDISKS_SERVICE, UDISKS_PATH, QDBusConnection::systemBus(), this);
     m_good = false;
 
-    QObject::connect(m_interface, SIGNAL(DeviceAdded(QDBusObjectPath)), this, SLOT(slotDeviceAdded(QDBusObjectPath)));
-    QObject::connect(m_interface, SIGNAL(DeviceRemoved(QDBusObjectPath)), this, SLOT(slotDeviceRemoved(QDBusObjectPath)));
-    QObject::connect(m_interface, SIGNAL(DeviceChanged(QDBusObjectPath)), this, SLOT(slotDeviceChanged(QDBusObjectPath)));
-
-    QDBusPendingReply< QList<QDBusObjectPath> > devs = m_interface->EnumerateDevices();
-    devs.waitForFinished();
+    // With a cache service running the device table comes from it, which spares udisks one
+    // enumeration and one property fetch per change for every session. Mounting still goes to
+    // udisks directly, authorization is per session.
+    if (use_cache && QDBusConnection::systemBus().interface()->isServiceRegistered(DeviceCache::SERVICE))
+        m_good = loadCache();
 
-    if (!devs.isValid())
-    {
-        qWarning() << devs.error();
-    }
-    else
-    {
-        m_good = true;
-        DeviceInfoPtr device;
-        foreach (QDBusObjectPath p, devs.value())
-        {
-            device = getDeviceInfoByPath(p);
-
-            if (0 != device)
-            {
-                m_devices.insert(p.path(), device);
-                qDebug() << "Storage device detected: " << p.path();
-            }
-        }
+    if (!m_good)
+        m_good = enumerate();
+}
 
-    }
+bool DeviceWatcher::cached() const
+{
+    return 0 != m_pcache;
 }
 
 bool DeviceWatcher::good() const
@@ -45,11 +45,11 @@ bool DeviceWatcher::good() const
     return m_good;
 }
 
-void DeviceWatcher::mountDevice(const QString& dev_path)
+void DeviceWatcher::mountDevice(const QString& dev_path, const QStringList& options)
 {
     UdisksDeviceInterface device(UDISKS_SERVICE, dev_path, QDBusConnection::systemBus());
 
-    QDBusPendingCall mount_call = device.FilesystemMount("", QStringList());
+    QDBusPendingCall mount_call = device.FilesystemMount("", options);
     QDBusPendingCallWatcher* watcher = new QDBusPendingCallWatcher(mount_call, this);
     watcher->setProperty(DEVPATH_PROPERTY, dev_path);
     QObject::connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), this, SLOT(slotDeviceMounted(QDBusPendingCallWatcher*)));
@@ -69,17 +69,77 @@ void DeviceWatcher::unmountDevice(const QString &dev_path, bool force)
     QObject::connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), this, SLOT(slotDeviceUnmounted(QDBusPendingCallWatcher*)));
 }
 
-QList<DeviceWatcher::DeviceInfoPtr> DeviceWatcher::devices() const
+QVector<DeviceWatcher::DeviceInfoPtr> DeviceWatcher::devices() const
 {
-    return m_devices.values();
+    return m_devices.all();
+}
+
+DeviceSnapshotPtr DeviceWatcher::snapshot() const
+{
+    return m_devices.snapshot();
 }
 
 DeviceWatcher::DeviceInfoPtr DeviceWatcher::getDevice(const QString &path)
 {
-    DeviceMap::iterator itr = m_devices.find(path);
-    if (m_devices.end() == itr)
-        return DeviceInfoPtr();
-    return *itr;
+    return m_devices.byPath(path);
+}
+
+DeviceWatcher::DeviceInfoPtr DeviceWatcher::findDevice(const QString &key) const
+{
+    DeviceInfoPtr dev = m_devices.byPath(key);
+    if (0 == dev)
+        dev = m_devices.byFile(key);
+    if (0 == dev)
+        dev = m_devices.byUuid(key);
+    if (0 != dev)
+        return dev;
+
+    // Labels aren't indexed, they are neither unique nor asked for often.
+    foreach (const DeviceInfoPtr& d, m_devices.all())
+    {
+        if (key == d->name)
+            return d;
+    }
+    return DeviceInfoPtr();
+}
+
+QList<DeviceWatcher::DeviceInfoPtr> DeviceWatcher::drivePartitions(const QString &drive_path) const
+{
+    return m_devices.byDrive(drive_path);
+}
+
+void DeviceWatcher::setupLoop(const QString &file, bool read_only)
+{
+    // udisks1 can only tear loop devices down, setting one up goes through udisks2 which is
+    // usually running next to it. The new device then shows up through the udisks1 signals as usual.
+    int fd = ::open(QFile::encodeName(file).constData(), (read_only ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+    if (fd < 0)
+    {
+        emit loopSetUp(file, QString(), InvalidRequest, QString::fromLocal8Bit(strerror(errno)));
+        return;
+    }
+
+    QVariantMap options;
+    options.insert("read-only", read_only);
+
+    QDBusMessage msg = QDBusMessage::createMethodCall(UDISKS2_SERVICE, UDISKS2_MANAGER_PATH, UDISKS2_MANAGER_INTERFACE, "LoopSetup");
+    msg << QVariant::fromValue(QDBusUnixFileDescriptor(fd)) << options;
+    ::close(fd);
+
+    QDBusPendingCall setup_call = QDBusConnection::systemBus().asyncCall(msg);
+    QDBusPendingCallWatcher* watcher = new QDBusPendingCallWatcher(setup_call, this);
+    watcher->setProperty(FILE_PROPERTY, file);
+    QObject::connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), this, SLOT(slotLoopSetUp(QDBusPendingCallWatcher*)));
+}
+
+void DeviceWatcher::teardownLoop(const QString &drive_path)
+{
+    UdisksDeviceInterface device(UDISKS_SERVICE, drive_path, QDBusConnection::systemBus());
+
+    QDBusPendingCall teardown_call = device.LinuxLoopDeviceTeardown(QStringList());
+    QDBusPendingCallWatcher* watcher = new QDBusPendingCallWatcher(teardown_call, this);
+    watcher->setProperty(DEVPATH_PROPERTY, drive_path);
+    QObject::connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), this, SLOT(slotLoopTornDown(QDBusPendingCallWatcher*)));
 }
 
 void DeviceWatcher::slotDeviceAdded(const QDBusObjectPath & p)
@@ -88,8 +148,9 @@ void DeviceWatcher::slotDeviceAdded(const QDBusObjectPath & p)
 
     if (0 != dev)
     {
-        m_devices.insert(p.path(), dev);
-        emit deviceAdded(*dev);
+        m_devices.insert(dev);
+        m_devices.publish();
+        emit deviceAdded(dev);
         qDebug() << "Device added: " << p.path();
     }
 }
@@ -97,35 +158,35 @@ void DeviceWatcher::slotDeviceAdded(const QDBusObjectPath & p)
 void DeviceWatcher::slotDeviceChanged(const QDBusObjectPath & p)
 {
     DeviceInfoPtr dev = getDeviceInfoByPath(p);
-    DeviceMap::iterator itr = m_devices.find(p.path());
 
     if (0 != dev)
     {
-        m_devices.insert(p.path(), dev);
+        DeviceInfoPtr old = m_devices.insert(dev);
+        m_devices.publish();
 
-        if (m_devices.end() == itr)
-            emit deviceAdded(*dev);
-        else emit deviceChanged(*dev);
+        if (0 == old)
+            emit deviceAdded(dev);
+        else emit deviceChanged(dev);
     }
     else
     {
-        if (m_devices.end() != itr)
+        DeviceInfoPtr d = m_devices.remove(p.path());
+        if (0 != d)
         {
-            DeviceInfoPtr d = *itr;
-            emit deviceRemoved(*d);
-            m_devices.erase(itr);
+            m_devices.publish();
+            emit deviceRemoved(d);
         }
     }
 }
 
 void DeviceWatcher::slotDeviceRemoved(const QDBusObjectPath & p)
 {
-    DeviceInfoPtr dev = m_devices.value(p.path());
+    DeviceInfoPtr dev = m_devices.remove(p.path());
 
     if (0 != dev)
     {
-        m_devices.remove(p.path());
-        emit deviceRemoved(*dev);
+        m_devices.publish();
+        emit deviceRemoved(dev);
         qDebug() << "Device removed: " << p.path();
     }
 }
@@ -136,8 +197,10 @@ void DeviceWatcher::slotDeviceMounted(QDBusPendingCallWatcher *w)
     QString path = w->property(DEVPATH_PROPERTY).toString();
     const QString& mount_path = r.isValid() ? r.value() : "";
 
-    DeviceMap::iterator itr = m_devices.find(path);
-    emit deviceMounted(**itr, mount_path, codeFromError(r.error()));
+    // The device may have gone away while the call was running.
+    DeviceInfoPtr dev = m_devices.byPath(path);
+    if (0 != dev)
+        emit deviceMounted(dev, mount_path, codeFromError(r.error()));
     w->deleteLater();
 }
 
@@ -145,20 +208,217 @@ void DeviceWatcher::slotDeviceUnmounted(QDBusPendingCallWatcher *w)
 {
     QDBusPendingReply<> r = *w;
     QString path = w->property(DEVPATH_PROPERTY).toString();
-    DeviceMap::iterator itr = m_devices.find(path);
-    emit deviceUnmounted(**itr, codeFromError(r.error()));
+    DeviceInfoPtr dev = m_devices.byPath(path);
+    if (0 != dev)
+        emit deviceUnmounted(dev, codeFromError(r.error()));
+    w->deleteLater();
+}
+
+void DeviceWatcher::slotLoopSetUp(QDBusPendingCallWatcher *w)
+{
+    QDBusPendingReply<QDBusObjectPath> r = *w;
+
+    // udisks2 names the block device like the kernel does, udisks1 keeps it under its own tree.
+    QString drive_path;
+    if (r.isValid())
+        drive_path = QString(UDISKS_PATH) + "/devices/" + r.value().path().section('/', -1);
+    emit loopSetUp(w->property(FILE_PROPERTY).toString(), drive_path, codeFromError(r.error()), r.error().message());
+    w->deleteLater();
+}
+
+void DeviceWatcher::slotLoopTornDown(QDBusPendingCallWatcher *w)
+{
+    QDBusPendingReply<> r = *w;
+    emit loopTornDown(w->property(DEVPATH_PROPERTY).toString(), codeFromError(r.error()));
     w->deleteLater();
 }
 
+bool DeviceWatcher::enumerate()
+{
+    QObject::connect(m_interface, SIGNAL(DeviceAdded(QDBusObjectPath)), this, SLOT(slotDeviceAdded(QDBusObjectPath)));
+    QObject::connect(m_interface, SIGNAL(DeviceRemoved(QDBusObjectPath)), this, SLOT(slotDeviceRemoved(QDBusObjectPath)));
+    QObject::connect(m_interface, SIGNAL(DeviceChanged(QDBusObjectPath)), this, SLOT(slotDeviceChanged(QDBusObjectPath)));
+
+    QDBusPendingReply< QList<QDBusObjectPath> > devs = m_interface->EnumerateDevices();
+    devs.waitForFinished();
+
+    if (!devs.isValid())
+    {
+        qWarning() << devs.error();
+        return false;
+    }
+
+    QList<DeviceInfoPtr> found;
+    foreach (QDBusObjectPath p, devs.value())
+    {
+        DeviceInfoPtr device = getDeviceInfoByPath(p);
+
+        if (0 != device)
+        {
+            found.append(device);
+            qDebug() << "Storage device detected: " << p.path();
+        }
+    }
+
+    replaceAll(found);
+    return true;
+}
+
+bool DeviceWatcher::loadCache()
+{
+    QDBusConnection bus = QDBusConnection::systemBus();
+    m_pcache = new QDBusInterface(DeviceCache::SERVICE, DeviceCache::PATH, DeviceCache::INTERFACE, bus, this);
+
+    // Subscribed before the snapshot is taken, a change racing it then shows up as a generation gap.
+    bus.connect(DeviceCache::SERVICE, DeviceCache::PATH, DeviceCache::INTERFACE, "Changed",
+                this, SLOT(slotCacheChanged(uint, QString, QVariantMap)));
+
+    if (!loadSnapshot())
+    {
+        dropCache();
+        return false;
+    }
+
+    QDBusServiceWatcher * watcher = new QDBusServiceWatcher(DeviceCache::SERVICE, bus, QDBusServiceWatcher::WatchForUnregistration, m_pcache);
+    QObject::connect(watcher, SIGNAL(serviceUnregistered(QString)), this, SLOT(slotCacheGone()));
+    qDebug() << "Using device cache, " << m_devices.size() << " devices";
+    return true;
+}
+
+bool DeviceWatcher::loadSnapshot()
+{
+    QDBusMessage reply = m_pcache->call("Snapshot");
+    if (QDBusMessage::ReplyMessage != reply.type() || reply.arguments().size() < 2)
+    {
+        qWarning() << "Device cache snapshot failed: " << reply.errorMessage();
+        return false;
+    }
+
+    QList<DeviceInfoPtr> found;
+    foreach (const QVariant& v, qdbus_cast<QVariantList>(reply.arguments().at(0)))
+        found.append(m_devices.seal(std::make_shared<DeviceInfo>(DeviceCache::fromMap(qdbus_cast<QVariantMap>(v)))));
+
+    m_cacheGeneration = reply.arguments().at(1).toUInt();
+    replaceAll(found);
+    return true;
+}
+
+bool DeviceWatcher::syncCache()
+{
+    QDBusMessage reply = m_pcache->call("Changes", m_cacheGeneration);
+    if (QDBusMessage::ReplyMessage != reply.type() || reply.arguments().size() < 3 || !reply.arguments().at(2).toBool())
+        return loadSnapshot();
+
+    foreach (const QVariant& v, qdbus_cast<QVariantList>(reply.arguments().at(0)))
+        applyCached(qdbus_cast<QVariantMap>(v));
+
+    m_cacheGeneration = reply.arguments().at(1).toUInt();
+    return true;
+}
+
+void DeviceWatcher::dropCache()
+{
+    QDBusConnection::systemBus().disconnect(DeviceCache::SERVICE, DeviceCache::PATH, DeviceCache::INTERFACE, "Changed",
+                                            this, SLOT(slotCacheChanged(uint, QString, QVariantMap)));
+    m_pcache->deleteLater();
+    m_pcache = 0;
+}
+
+void DeviceWatcher::applyCached(const QVariantMap &device)
+{
+    if (device.value("Removed").toBool())
+    {
+        DeviceInfoPtr d = m_devices.remove(device.value("Path").toString());
+        if (0 != d)
+        {
+            m_devices.publish();
+            emit deviceRemoved(d);
+        }
+        return;
+    }
+
+    DeviceInfoPtr dev = m_devices.seal(std::make_shared<DeviceInfo>(DeviceCache::fromMap(device)));
+    DeviceInfoPtr old = m_devices.insert(dev);
+    m_devices.publish();
+
+    if (0 == old)
+        emit deviceAdded(dev);
+    else emit deviceChanged(dev);
+}
+
+void DeviceWatcher::replaceAll(const QList<DeviceInfoPtr> &devices)
+{
+    QSet<QString> paths;
+    foreach (const DeviceInfoPtr& dev, devices)
+        paths.insert(dev->udisksPath);
+
+    QList<DeviceInfoPtr> removed, added, changed;
+
+    foreach (const DeviceInfoPtr& old, m_devices.all())
+    {
+        if (!paths.contains(old->udisksPath))
+        {
+            m_devices.remove(old->udisksPath);
+            removed.append(old);
+        }
+    }
+
+    // Resyncs hand over the whole table, only what actually differs is announced.
+    foreach (const DeviceInfoPtr& dev, devices)
+    {
+        DeviceInfoPtr old = m_devices.insert(dev);
+        if (0 == old)
+            added.append(dev);
+        else if (DeviceCache::toMap(*old) != DeviceCache::toMap(*dev))
+            changed.append(dev);
+    }
+
+    // One version for the whole batch, receivers see the finished table.
+    m_devices.publish();
+
+    foreach (const DeviceInfoPtr& dev, removed)
+        emit deviceRemoved(dev);
+    foreach (const DeviceInfoPtr& dev, added)
+        emit deviceAdded(dev);
+    foreach (const DeviceInfoPtr& dev, changed)
+        emit deviceChanged(dev);
+}
+
+void DeviceWatcher::slotCacheChanged(uint generation, QString path, QVariantMap device)
+{
+    Q_UNUSED(path);
+
+    if (0 == m_pcache || generation <= m_cacheGeneration)
+        return;
+
+    // A gap means signals were lost, Changes() or a snapshot catch up to at least this one.
+    if (generation != m_cacheGeneration + 1)
+    {
+        syncCache();
+        return;
+    }
+
+    applyCached(device);
+    m_cacheGeneration = generation;
+}
+
+void DeviceWatcher::slotCacheGone()
+{
+    // The service stopped, from here on this session watches udisks on its own.
+    qWarning() << "Device cache went away, watching udisks directly";
+    dropCache();
+    m_good = enumerate();
+}
+
 DeviceWatcher::DeviceInfoPtr DeviceWatcher::getDeviceInfoByPath(const QDBusObjectPath & p)
 {
     UdisksDeviceInterface dev_interface(UDISKS_SERVICE, p.path(), QDBusConnection::systemBus());
 
-    DeviceInfoPtr dev;
+    std::shared_ptr<DeviceInfo> dev;
 
     if ("filesystem" == dev_interface.idUsage())
     {
-        dev = DeviceInfoPtr(new DeviceInfo());
+        dev = std::make_shared<DeviceInfo>();
         const QString& dev_label = dev_interface.idLabel();
         const QString& dev_file = dev_interface.deviceFile();
 
@@ -171,11 +431,25 @@ DeviceWatcher::DeviceInfoPtr DeviceWatcher::getDeviceInfoByPath(const QDBusObjec
         dev->isMounted = dev_interface.deviceIsMounted();
         dev->isSystem = dev_interface.deviceIsSystemInternal();
         if (dev->isMounted) dev->mountPoint = dev_interface.deviceMountPaths().first();
-        dev->type = detectDeviceType(dev_interface);
-    }
-    return dev;
-
 
+        if (dev_interface.deviceIsPartition())
+        {
+            UdisksDeviceInterface drive(UDISKS_SERVICE, dev_interface.partitionSlave().path(), QDBusConnection::systemBus());
+            dev->drivePath = drive.path();
+            dev->driveFile = drive.deviceFile();
+            if (drive.deviceIsLinuxLoop())
+                dev->imageFile = drive.linuxLoopFilename();
+        }
+        else
+        {
+            dev->drivePath = dev->udisksPath;
+            dev->driveFile = dev->fileName;
+            if (dev_interface.deviceIsLinuxLoop())
+                dev->imageFile = dev_interface.linuxLoopFilename();
+        }
+        dev->type = dev->imageFile.isEmpty() ? detectDeviceType(dev_interface) : DeviceInfo::IMAGE;
+    }
+    return 0 != dev ? m_devices.seal(dev) : DeviceInfoPtr();
 }
 
 DeviceInfo::DeviceType DeviceWatcher::detectDeviceType(const UdisksDeviceInterface& i)
@@ -216,23 +490,27 @@ ErrorCode DeviceWatcher::codeFromError(QDBusError error)
     {
         if (QDBusError::Other == error.type())
         {
-            if  ("org.freedesktop.UDisks.Error.NotAuthorized" == error.name())
+            // udisks2 uses the same error names under its own prefix, with a few NotAuthorized variants.
+            QString name = error.name();
+            name.replace("org.freedesktop.UDisks2.", "org.freedesktop.UDisks.");
+
+            if  (name.startsWith("org.freedesktop.UDisks.Error.NotAuthorized"))
             {
                 err = NotAuthorized;
             }
-            else if ("org.freedesktop.UDisks.Error.Busy" == error.name())
+            else if ("org.freedesktop.UDisks.Error.Busy" == name)
             {
                 err = Busy;
             }
-            else if ("org.freedesktop.UDisks.Error.Failed" == error.name())
+            else if ("org.freedesktop.UDisks.Error.Failed" == name)
             {
                 err = Failed;
             }
-            else if ("org.freedesktop.UDisks.Error.Cancelled" == error.name())
+            else if ("org.freedesktop.UDisks.Error.Cancelled" == name)
             {
                 err = Cancelled;
             }
-            else if ("org.freedesktop.UDisks.Error.FilesystemDriverMissing" == error.name())
+            else if ("org.freedesktop.UDisks.Error.FilesystemDriverMissing" == name)
             {
                 err = UnknownFileSystem;
             }
@@ -4,8 +4,8 @@
 #include <QObject>
 #include <QtCore>
 #include <QtDBus>
-#include <tr1/memory>
 
+#include "devicestore.h"
 #include "interfaces/udisksinterface.h"
 #include "interfaces/udisksdeviceinterface.h"
 
@@ -15,7 +15,7 @@ struct DeviceInfo
 {
     enum DeviceType
     {
-        HDD, USB, FLOPPY, OPTICAL, OTHER
+        HDD, USB, FLOPPY, OPTICAL, OTHER, IMAGE
     };
 
     QString name;
@@ -27,42 +27,72 @@ struct DeviceInfo
     bool isSystem;
     QString udisksPath;
     QString fileName;
+    QString drivePath;
+    QString driveFile;
+    QString imageFile;
     DeviceType type;
 
 };
 
+Q_DECLARE_METATYPE(DeviceInfoPtr)
+
 
 class DeviceWatcher : public QObject
 {
     Q_OBJECT
 public:
-    typedef std::tr1::shared_ptr<DeviceInfo> DeviceInfoPtr;
-    typedef QMap<QString, DeviceInfoPtr> DeviceMap;
+    typedef DeviceStore::DeviceInfoPtr DeviceInfoPtr;
 
-    explicit DeviceWatcher(QObject *parent = 0);
+    explicit DeviceWatcher(QObject *parent = 0, bool use_cache = true);
     bool good() const;
-    void mountDevice(const QString& dev_path);
+    bool cached() const;
+    void mountDevice(const QString& dev_path, const QStringList& options = QStringList());
     void unmountDevice(const QString& dev_path, bool force);
-    QList<DeviceInfoPtr> devices() const;
+    QVector<DeviceInfoPtr> devices() const;
+    // For readers on other threads, see DeviceStore::snapshot().
+    DeviceSnapshotPtr snapshot() const;
     DeviceInfoPtr getDevice(const QString& path);
+    // Looks a device up by udisks path, device file, UUID or label, in that order.
+    DeviceInfoPtr findDevice(const QString& key) const;
+    QList<DeviceInfoPtr> drivePartitions(const QString& drive_path) const;
+    void setupLoop(const QString& file, bool read_only);
+    void teardownLoop(const QString& drive_path);
 
 signals:
-    void deviceAdded(const DeviceInfo&);
-    void deviceRemoved(const DeviceInfo&);
-    void deviceChanged(const DeviceInfo&);
-    void deviceMounted(const DeviceInfo& dev, QString mount_path, ErrorCode e);
-    void deviceUnmounted(const DeviceInfo& dev, ErrorCode e);
+    void deviceAdded(const DeviceInfoPtr& dev);
+    void deviceRemoved(const DeviceInfoPtr& dev);
+    void deviceChanged(const DeviceInfoPtr& dev);
+    void deviceMounted(const DeviceInfoPtr& dev, QString mount_path, ErrorCode e);
+    void deviceUnmounted(const DeviceInfoPtr& dev, ErrorCode e);
+    // drive_path is the udisks path of the new loop device, empty on failure.
+    void loopSetUp(QString file, QString drive_path, ErrorCode e, QString message);
+    void loopTornDown(QString drive_path, ErrorCode e);
 public slots:
     void slotDeviceAdded(const QDBusObjectPath& p);
     void slotDeviceChanged(const QDBusObjectPath& p);
     void slotDeviceRemoved(const QDBusObjectPath& p);
     void slotDeviceMounted(QDBusPendingCallWatcher* w);
     void slotDeviceUnmounted(QDBusPendingCallWatcher* w);
+    void slotLoopSetUp(QDBusPendingCallWatcher* w);
+    void slotLoopTornDown(QDBusPendingCallWatcher* w);
+private slots:
+    void slotCacheChanged(uint generation, QString path, QVariantMap device);
+    void slotCacheGone();
 private:
-    DeviceMap m_devices;
+    DeviceStore m_devices;
     UdisksInterface * m_interface;
+    QDBusInterface * m_pcache;
+    uint m_cacheGeneration;
     bool m_good;
 
+    bool enumerate();
+    bool loadCache();
+    bool loadSnapshot();
+    bool syncCache();
+    void dropCache();
+    void applyCached(const QVariantMap& device);
+    void replaceAll(const QList<DeviceInfoPtr>& devices);
+
     DeviceInfoPtr getDeviceInfoByPath(const QDBusObjectPath&p);
     DeviceInfo::DeviceType detectDeviceType(const UdisksDeviceInterface &i);
     bool deviceIsUsb(const UdisksDeviceInterface &i);
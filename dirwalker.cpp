@@ -0,0 +1,177 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "dirwalker.h"
+
+// From linux/ioprio.h, which glibc doesn't wrap.
+const int IOPRIO_WHO_PROCESS = 1;
+const int IOPRIO_CLASS_IDLE = 3;
+const int IOPRIO_CLASS_SHIFT = 13;
+
+class DirWalker::WorkerThread : public QThread
+{
+public:
+    explicit WorkerThread(DirWalker * walker) : m_pwalker(walker) {}
+
+protected:
+    void run() { m_pwalker->work(); }
+
+private:
+    DirWalker * m_pwalker;
+};
+
+DirWalker::DirWalker(const QString &root, int threads) :
+    m_root(QFile::encodeName(root)),
+    m_threads(qMax(1, threads)),
+    m_pcancel(0),
+    m_idleIo(false),
+    m_pvisitor(0),
+    m_busy(0),
+    m_errors(0)
+{
+}
+
+void DirWalker::setCancelFlag(const QAtomicInt *cancel)
+{
+    m_pcancel = cancel;
+}
+
+void DirWalker::setIdleIoPriority(bool idle)
+{
+    m_idleIo = idle;
+}
+
+bool DirWalker::walk(Visitor *visitor)
+{
+    m_pvisitor = visitor;
+    m_errors = 0;
+    m_busy = 0;
+    m_queue.clear();
+    m_queue.append(QByteArray());
+
+    // The calling thread takes part in the walk, so one thread means no extra threads at all.
+    QList<WorkerThread*> workers;
+    for (int i = 1; i < m_threads; ++i)
+    {
+        workers.append(new WorkerThread(this));
+        workers.last()->start();
+    }
+
+    work();
+
+    foreach (WorkerThread * w, workers)
+    {
+        w->wait();
+        delete w;
+    }
+
+    return !cancelled();
+}
+
+int DirWalker::errors() const
+{
+    return m_errors;
+}
+
+QByteArray DirWalker::join(const QByteArray &dir, const QByteArray &name)
+{
+    if (dir.isEmpty())
+        return name;
+    return dir + '/' + name;
+}
+
+void DirWalker::work()
+{
+    QVector<Entry> entries;
+    QVector<QByteArray> subdirs;
+
+    // I/O priority is per thread, so every walker thread (and the caller's) drops its own.
+    if (m_idleIo)
+        ::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+    forever
+    {
+        QByteArray dir;
+        {
+            QMutexLocker lock(&m_mutex);
+
+            while (m_queue.isEmpty() && m_busy > 0 && !cancelled())
+                m_cond.wait(&m_mutex);
+
+            if (m_queue.isEmpty() || cancelled())
+            {
+                m_cond.wakeAll();
+                return;
+            }
+
+            dir = m_queue.last();
+            m_queue.removeLast();
+            ++m_busy;
+        }
+
+        entries.clear();
+        subdirs.clear();
+        readDir(dir, entries, subdirs);
+
+        if (!entries.isEmpty())
+            m_pvisitor->visit(dir, entries);
+
+        QMutexLocker lock(&m_mutex);
+        m_queue += subdirs;
+        --m_busy;
+        m_cond.wakeAll();
+    }
+}
+
+bool DirWalker::cancelled() const
+{
+    return 0 != m_pcancel && 0 != m_pcancel->load();
+}
+
+void DirWalker::readDir(const QByteArray &rel_dir, QVector<Entry> &entries, QVector<QByteArray> &subdirs)
+{
+    QByteArray path = rel_dir.isEmpty() ? m_root : m_root + '/' + rel_dir;
+    DIR * d = ::opendir(path.constData());
+
+    if (0 == d)
+    {
+        QMutexLocker lock(&m_mutex);
+        ++m_errors;
+        return;
+    }
+
+    int fd = ::dirfd(d);
+    struct dirent * de;
+    struct stat st;
+
+    while (0 != (de = ::readdir(d)))
+    {
+        if ('.' == de->d_name[0] && ('\0' == de->d_name[1] || ('.' == de->d_name[1] && '\0' == de->d_name[2])))
+            continue;
+
+        // Symlinks and special files are skipped, only regular files and directories are reported.
+        if (DT_UNKNOWN != de->d_type && DT_REG != de->d_type && DT_DIR != de->d_type)
+            continue;
+
+        if (::fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+
+        Entry e;
+        e.name = QByteArray(de->d_name);
+        e.isDir = S_ISDIR(st.st_mode);
+        e.size = st.st_size;
+        e.mtimeNs = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+
+        if (!e.isDir && !S_ISREG(st.st_mode))
+            continue;
+
+        if (e.isDir)
+            subdirs.append(join(rel_dir, e.name));
+        entries.append(e);
+    }
+
+    ::closedir(d);
+}
@@ -0,0 +1,55 @@
+#ifndef DIRWALKER_H
+#define DIRWALKER_H
+
+#include <QtCore>
+
+class DirWalker
+{
+public:
+    struct Entry
+    {
+        QByteArray name;
+        bool isDir;
+        qint64 size;
+        qint64 mtimeNs;
+    };
+
+    class Visitor
+    {
+    public:
+        virtual ~Visitor() {}
+        // Called from the walker threads, implementations have to be thread safe.
+        // rel_dir is relative to the walked root and empty for the root itself.
+        virtual void visit(const QByteArray& rel_dir, const QVector<Entry>& entries) = 0;
+    };
+
+    DirWalker(const QString& root, int threads);
+
+    void setCancelFlag(const QAtomicInt * cancel);
+    void setIdleIoPriority(bool idle);
+    bool walk(Visitor * visitor);
+    int errors() const;
+
+    static QByteArray join(const QByteArray& dir, const QByteArray& name);
+
+private:
+    class WorkerThread;
+
+    QByteArray m_root;
+    int m_threads;
+    const QAtomicInt * m_pcancel;
+    bool m_idleIo;
+    Visitor * m_pvisitor;
+
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    QVector<QByteArray> m_queue;
+    int m_busy;
+    int m_errors;
+
+    void work();
+    bool cancelled() const;
+    void readDir(const QByteArray& rel_dir, QVector<Entry>& entries, QVector<QByteArray>& subdirs);
+};
+
+#endif // DIRWALKER_H
@@ -0,0 +1,373 @@
+#include <string.h>
+
+#include "hasher.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HASHER_HAVE_SHANI
+#endif
+
+namespace
+{
+
+const uint32_t SHA256_K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline uint32_t ror32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+inline uint64_t rol64(uint64_t x, int n) { return (x << n) | (x >> (64 - n)); }
+
+inline uint32_t load32be(const unsigned char * p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+inline uint64_t load64le(const unsigned char * p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+inline uint32_t load32le(const unsigned char * p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+typedef void (*Sha256Blocks)(uint32_t state[8], const unsigned char * data, size_t blocks);
+
+void sha256BlocksGeneric(uint32_t state[8], const unsigned char * data, size_t blocks)
+{
+    uint32_t w[64];
+
+    for (; blocks > 0; --blocks, data += 64)
+    {
+        for (int i = 0; i < 16; ++i)
+            w[i] = load32be(data + i * 4);
+        for (int i = 16; i < 64; ++i)
+        {
+            uint32_t s0 = ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int i = 0; i < 64; ++i)
+        {
+            uint32_t t1 = h + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+            uint32_t t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#ifdef HASHER_HAVE_SHANI
+// SHA extensions (Goldmont, Zen and Ice Lake onwards) do two rounds per sha256rnds2 and the
+// message schedule in sha256msg1/msg2, roughly 3-4 times the throughput of the generic code.
+__attribute__((target("sha,sse4.1")))
+void sha256BlocksShaNi(uint32_t state[8], const unsigned char * data, size_t blocks)
+{
+    const __m128i BSWAP = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // State is kept as ABEF/CDGH as sha256rnds2 expects.
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0]));
+    __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4]));
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; blocks > 0; --blocks, data += 64)
+    {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+        __m128i msg[4];
+
+        for (int i = 0; i < 4; ++i)
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 16)), BSWAP);
+
+        for (int r = 0; r < 16; ++r)
+        {
+            __m128i m = msg[r & 3];
+            __m128i wk = _mm_add_epi32(m, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&SHA256_K[r * 4])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+
+            if (r >= 3 && r < 15)
+            {
+                // W[i+16..] for the group three ahead: msg2(msg1(w0, w1) + alignr(w3, w2), w3).
+                __m128i next = _mm_add_epi32(msg[(r + 1) & 3], _mm_alignr_epi8(msg[r & 3], msg[(r + 3) & 3], 4));
+                msg[(r + 1) & 3] = _mm_sha256msg2_epu32(next, msg[r & 3]);
+            }
+
+            wk = _mm_shuffle_epi32(wk, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, wk);
+
+            if (r >= 1 && r < 13)
+                msg[(r + 3) & 3] = _mm_sha256msg1_epu32(msg[(r + 3) & 3], msg[r & 3]);
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+#endif
+
+Sha256Blocks selectSha256()
+{
+#ifdef HASHER_HAVE_SHANI
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1"))
+        return sha256BlocksShaNi;
+#endif
+    return sha256BlocksGeneric;
+}
+
+const Sha256Blocks sha256Blocks = selectSha256();
+
+class Sha256Hasher : public Hasher
+{
+public:
+    Sha256Hasher() : m_length(0), m_buffered(0)
+    {
+        static const uint32_t init[8] =
+        {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        memcpy(m_state, init, sizeof(m_state));
+    }
+
+    void update(const void * data, size_t len)
+    {
+        const unsigned char * p = static_cast<const unsigned char*>(data);
+        m_length += len;
+
+        if (m_buffered > 0)
+        {
+            size_t n = len < 64 - m_buffered ? len : 64 - m_buffered;
+            memcpy(m_buffer + m_buffered, p, n);
+            m_buffered += n;
+            p += n;
+            len -= n;
+            if (64 > m_buffered)
+                return;
+            sha256Blocks(m_state, m_buffer, 1);
+            m_buffered = 0;
+        }
+
+        if (len >= 64)
+        {
+            sha256Blocks(m_state, p, len / 64);
+            p += len & ~size_t(63);
+            len &= 63;
+        }
+
+        memcpy(m_buffer, p, len);
+        m_buffered = len;
+    }
+
+    void final(unsigned char * out)
+    {
+        uint64_t bits = m_length * 8;
+        unsigned char pad[72] = { 0x80 };
+        size_t pad_len = (m_buffered < 56 ? 56 : 120) - m_buffered;
+
+        for (int i = 0; i < 8; ++i)
+            pad[pad_len + i] = static_cast<unsigned char>(bits >> (56 - i * 8));
+        update(pad, pad_len + 8);
+
+        for (int i = 0; i < 8; ++i)
+        {
+            out[i * 4] = m_state[i] >> 24;
+            out[i * 4 + 1] = m_state[i] >> 16;
+            out[i * 4 + 2] = m_state[i] >> 8;
+            out[i * 4 + 3] = m_state[i];
+        }
+    }
+
+private:
+    uint32_t m_state[8];
+    uint64_t m_length;
+    unsigned char m_buffer[64];
+    size_t m_buffered;
+};
+
+const uint64_t XXH_PRIME1 = 0x9E3779B185EBCA87ULL;
+const uint64_t XXH_PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t XXH_PRIME3 = 0x165667B19E3779F9ULL;
+const uint64_t XXH_PRIME4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t XXH_PRIME5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t xxhRound(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME2;
+    acc = rol64(acc, 31);
+    return acc * XXH_PRIME1;
+}
+
+inline uint64_t xxhMerge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxhRound(0, val);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+// XXH64 with seed 0. The four independent lanes keep the multipliers of a modern core busy,
+// which puts it well above the read speed of any removable media.
+class Xxh64Hasher : public Hasher
+{
+public:
+    Xxh64Hasher() : m_length(0), m_buffered(0)
+    {
+        m_v[0] = XXH_PRIME1 + XXH_PRIME2;
+        m_v[1] = XXH_PRIME2;
+        m_v[2] = 0;
+        m_v[3] = 0 - XXH_PRIME1;
+    }
+
+    void update(const void * data, size_t len)
+    {
+        const unsigned char * p = static_cast<const unsigned char*>(data);
+        m_length += len;
+
+        if (m_buffered > 0)
+        {
+            size_t n = len < 32 - m_buffered ? len : 32 - m_buffered;
+            memcpy(m_buffer + m_buffered, p, n);
+            m_buffered += n;
+            p += n;
+            len -= n;
+            if (32 > m_buffered)
+                return;
+            stripes(m_buffer, 1);
+            m_buffered = 0;
+        }
+
+        if (len >= 32)
+        {
+            stripes(p, len / 32);
+            p += len & ~size_t(31);
+            len &= 31;
+        }
+
+        memcpy(m_buffer, p, len);
+        m_buffered = len;
+    }
+
+    void final(unsigned char * out)
+    {
+        uint64_t h;
+
+        if (m_length >= 32)
+        {
+            h = rol64(m_v[0], 1) + rol64(m_v[1], 7) + rol64(m_v[2], 12) + rol64(m_v[3], 18);
+            for (int i = 0; i < 4; ++i)
+                h = xxhMerge(h, m_v[i]);
+        }
+        else h = XXH_PRIME5;
+
+        h += m_length;
+
+        const unsigned char * p = m_buffer;
+        size_t len = m_buffered;
+
+        for (; len >= 8; len -= 8, p += 8)
+            h = rol64(h ^ xxhRound(0, load64le(p)), 27) * XXH_PRIME1 + XXH_PRIME4;
+        if (len >= 4)
+        {
+            h = rol64(h ^ (uint64_t(load32le(p)) * XXH_PRIME1), 23) * XXH_PRIME2 + XXH_PRIME3;
+            p += 4;
+            len -= 4;
+        }
+        for (; len > 0; --len, ++p)
+            h = rol64(h ^ (*p * XXH_PRIME5), 11) * XXH_PRIME1;
+
+        h ^= h >> 33;
+        h *= XXH_PRIME2;
+        h ^= h >> 29;
+        h *= XXH_PRIME3;
+        h ^= h >> 32;
+
+        for (int i = 0; i < 8; ++i)
+            out[i] = static_cast<unsigned char>(h >> (56 - i * 8));
+    }
+
+private:
+    uint64_t m_v[4];
+    uint64_t m_length;
+    unsigned char m_buffer[32];
+    size_t m_buffered;
+
+    void stripes(const unsigned char * p, size_t count)
+    {
+        uint64_t v0 = m_v[0], v1 = m_v[1], v2 = m_v[2], v3 = m_v[3];
+
+        for (; count > 0; --count, p += 32)
+        {
+            v0 = xxhRound(v0, load64le(p));
+            v1 = xxhRound(v1, load64le(p + 8));
+            v2 = xxhRound(v2, load64le(p + 16));
+            v3 = xxhRound(v3, load64le(p + 24));
+        }
+
+        m_v[0] = v0; m_v[1] = v1; m_v[2] = v2; m_v[3] = v3;
+    }
+};
+
+}
+
+Hasher * Hasher::create(Algorithm a)
+{
+    if (XXH64 == a)
+        return new Xxh64Hasher();
+    return new Sha256Hasher();
+}
+
+const char * Hasher::name(Algorithm a)
+{
+    return XXH64 == a ? "xxh64" : "sha256";
+}
+
+const char * Hasher::implementation(Algorithm a)
+{
+    if (XXH64 == a)
+        return "generic";
+#ifdef HASHER_HAVE_SHANI
+    if (sha256BlocksShaNi == sha256Blocks)
+        return "SHA-NI";
+#endif
+    return "generic";
+}
+
+size_t Hasher::digestSize(Algorithm a)
+{
+    return XXH64 == a ? 8 : 32;
+}
@@ -0,0 +1,26 @@
+#ifndef HASHER_H
+#define HASHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Hasher
+{
+public:
+    enum Algorithm
+    {
+        SHA256, XXH64
+    };
+
+    static Hasher * create(Algorithm a);
+    static const char * name(Algorithm a);
+    static const char * implementation(Algorithm a);
+    static size_t digestSize(Algorithm a);
+
+    virtual ~Hasher() {}
+    virtual void update(const void * data, size_t len) = 0;
+    // Writes digestSize() bytes in the canonical (big endian) order printed by sha256sum/xxhsum.
+    virtual void final(unsigned char * out) = 0;
+};
+
+#endif // HASHER_H
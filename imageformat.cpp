@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "imageformat.h"
+
+const char IMAGE_MAGIC[] = "MNTIMG01";
+const int MAGIC_SIZE = 8;
+const int COMPRESSION_LEVEL = 1;
+
+bool ImageFormat::isImage(const QString &path)
+{
+    QFile f(path);
+    return f.open(QIODevice::ReadOnly) && f.read(MAGIC_SIZE) == QByteArray(IMAGE_MAGIC, MAGIC_SIZE);
+}
+
+QByteArray ImageFormat::header(quint64 size)
+{
+    QByteArray h(HeaderSize, '\0');
+    memcpy(h.data(), IMAGE_MAGIC, MAGIC_SIZE);
+    qToLittleEndian<quint32>(Version, reinterpret_cast<uchar*>(h.data() + 8));
+    qToLittleEndian<quint32>(ChunkSize, reinterpret_cast<uchar*>(h.data() + 12));
+    qToLittleEndian<quint64>(size, reinterpret_cast<uchar*>(h.data() + 16));
+    return h;
+}
+
+QByteArray ImageFormat::record(RecordType type, const char *payload, quint32 len)
+{
+    QByteArray r(RecordHeaderSize + len, Qt::Uninitialized);
+    r[0] = char(type);
+    qToLittleEndian<quint32>(len, reinterpret_cast<uchar*>(r.data() + 1));
+    if (len > 0)
+        memcpy(r.data() + RecordHeaderSize, payload, len);
+    return r;
+}
+
+ImageFormat::RecordType ImageFormat::encodeChunk(const char *data, quint32 len, QByteArray &out)
+{
+    if (isZero(data, len))
+    {
+        uchar run[4];
+        qToLittleEndian<quint32>(len, run);
+        out = record(Zero, reinterpret_cast<const char*>(run), sizeof(run));
+        return Zero;
+    }
+
+    // Level 1 keeps zlib near the read speed of a card, already compressed data is stored as is.
+    QByteArray packed = qCompress(reinterpret_cast<const uchar*>(data), len, COMPRESSION_LEVEL);
+    if (packed.size() < int(len))
+    {
+        out = record(Compressed, packed.constData(), packed.size());
+        return Compressed;
+    }
+
+    out = record(Stored, data, len);
+    return Stored;
+}
+
+bool ImageFormat::isZero(const char *data, size_t len)
+{
+    // Check a head, then compare the buffer against itself shifted by the head's size.
+    static const char zero[64] = { 0 };
+    if (len <= sizeof(zero))
+        return 0 == memcmp(data, zero, len);
+    return 0 == memcmp(data, zero, sizeof(zero)) && 0 == memcmp(data, data + sizeof(zero), len - sizeof(zero));
+}
+
+ImageReader::ImageReader(int fd) :
+    m_fd(fd),
+    m_size(0),
+    m_pos(0)
+{
+}
+
+bool ImageReader::open()
+{
+    char h[ImageFormat::HeaderSize];
+    if (!readFull(h, sizeof(h)) || 0 != memcmp(h, IMAGE_MAGIC, MAGIC_SIZE))
+    {
+        fail("Not a MOUNTain image");
+        return false;
+    }
+
+    quint32 version = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(h + 8));
+    quint32 chunk = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(h + 12));
+    if (ImageFormat::Version != version || ImageFormat::ChunkSize != chunk)
+    {
+        fail("Unsupported image version");
+        return false;
+    }
+
+    m_size = qFromLittleEndian<quint64>(reinterpret_cast<const uchar*>(h + 16));
+    return true;
+}
+
+quint64 ImageReader::size() const
+{
+    return m_size;
+}
+
+qint64 ImageReader::read(char *buf)
+{
+    char h[ImageFormat::RecordHeaderSize];
+    if (!readFull(h, sizeof(h)))
+        return fail("Image is truncated");
+
+    uchar type = h[0];
+    quint32 len = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(h + 1));
+
+    // A compressed chunk is never larger than its contents, qCompress adds a 4 byte prefix at most.
+    if (len > ImageFormat::ChunkSize + 4)
+        return fail("Image is corrupt");
+
+    m_payload.resize(len);
+    if (!readFull(m_payload.data(), len))
+        return fail("Image is truncated");
+
+    qint64 n = 0;
+
+    switch (type)
+    {
+    case ImageFormat::Zero:
+        if (len != 4)
+            return fail("Image is corrupt");
+        n = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(m_payload.constData()));
+        if (n > ImageFormat::ChunkSize)
+            return fail("Image is corrupt");
+        memset(buf, 0, n);
+        break;
+    case ImageFormat::Stored:
+        if (len > ImageFormat::ChunkSize)
+            return fail("Image is corrupt");
+        memcpy(buf, m_payload.constData(), len);
+        n = len;
+        break;
+    case ImageFormat::Compressed:
+    {
+        QByteArray chunk = qUncompress(m_payload);
+        if (chunk.isEmpty() || chunk.size() > ImageFormat::ChunkSize)
+            return fail("Image is corrupt");
+        memcpy(buf, chunk.constData(), chunk.size());
+        n = chunk.size();
+        break;
+    }
+    case ImageFormat::End:
+        if (m_pos != m_size)
+            return fail("Image is truncated");
+        m_digest = m_payload;
+        return 0;
+    default:
+        return fail("Image is corrupt");
+    }
+
+    m_pos += n;
+    if (m_pos > m_size)
+        return fail("Image is corrupt");
+    return n;
+}
+
+QByteArray ImageReader::digest() const
+{
+    return m_digest;
+}
+
+QString ImageReader::error() const
+{
+    return m_error;
+}
+
+bool ImageReader::readFull(char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::read(m_fd, buf, len);
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+qint64 ImageReader::fail(const QString &what)
+{
+    if (m_error.isEmpty())
+        m_error = what;
+    return -1;
+}
@@ -0,0 +1,56 @@
+#ifndef IMAGEFORMAT_H
+#define IMAGEFORMAT_H
+
+#include <QtCore>
+
+// Compressed device image (.mimg):
+//   header  "MNTIMG01", u32 version, u32 chunk size, u64 device size
+//   records u8 type, u32 payload length, payload - one per chunk, in order
+//   trailer End record whose payload is the XXH64 of the device contents
+// Integers are little endian. Zero records carry only the u32 length of the run.
+class ImageFormat
+{
+public:
+    enum
+    {
+        ChunkSize = 4 * 1024 * 1024, HeaderSize = 24, RecordHeaderSize = 5, Version = 1
+    };
+
+    enum RecordType
+    {
+        Compressed = 0, Stored = 1, Zero = 2, End = 0xff
+    };
+
+    static bool isImage(const QString& path);
+    static QByteArray header(quint64 size);
+    static QByteArray record(RecordType type, const char * payload, quint32 len);
+    // Picks the smallest of zero/compressed/stored for the chunk, returns the record type used.
+    static RecordType encodeChunk(const char * data, quint32 len, QByteArray& out);
+    static bool isZero(const char * data, size_t len);
+};
+
+class ImageReader
+{
+public:
+    explicit ImageReader(int fd);
+
+    bool open();
+    quint64 size() const;
+    // Decodes the next chunk into buf (ChunkSize bytes), returns 0 once the trailer is read and -1 on a corrupt image.
+    qint64 read(char * buf);
+    QByteArray digest() const;
+    QString error() const;
+
+private:
+    int m_fd;
+    quint64 m_size;
+    quint64 m_pos;
+    QByteArray m_payload;
+    QByteArray m_digest;
+    QString m_error;
+
+    bool readFull(char * buf, size_t len);
+    qint64 fail(const QString& what);
+};
+
+#endif // IMAGEFORMAT_H
@@ -0,0 +1,355 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "imagemounter.h"
+
+const size_t PROBE_SIZE = 64 * 1024;
+const size_t ISO_VRS_OFFSET = 16 * 2048;
+const size_t EXT_SUPERBLOCK_OFFSET = 1024;
+// udisks reports the filesystems of a new loop device within a second or two of setting it up.
+const int FILESYSTEM_WAIT_TIMEOUT = 10000;
+
+namespace
+{
+
+QString latin1Label(const uchar * p, int len)
+{
+    return QString::fromLatin1(reinterpret_cast<const char*>(p), qstrnlen(reinterpret_cast<const char*>(p), len)).trimmed();
+}
+
+bool probeIso(const uchar * h, size_t len, ImageProbe& probe)
+{
+    if (len < ISO_VRS_OFFSET + 2048)
+        return false;
+
+    // UDF discs keep an ISO9660 style volume recognition sequence, NSR02/NSR03 marks the UDF part.
+    bool iso = false;
+    bool udf = false;
+    for (size_t off = ISO_VRS_OFFSET; off + 2048 <= len; off += 2048)
+    {
+        const uchar * d = h + off;
+        if (0 == memcmp(d + 1, "CD001", 5))
+        {
+            if (1 == d[0])
+                probe.label = latin1Label(d + 40, 32);
+            iso = true;
+        }
+        else if (0 == memcmp(d + 1, "NSR02", 5) || 0 == memcmp(d + 1, "NSR03", 5))
+            udf = true;
+        else if (0 != memcmp(d + 1, "BEA01", 5) && 0 != memcmp(d + 1, "TEA01", 5))
+            break;
+    }
+
+    if (udf)
+    {
+        probe.kind = ImageProbe::UDF;
+        probe.description = iso ? "UDF/ISO9660 bridge disc image" : "UDF disc image";
+    }
+    else if (iso)
+    {
+        probe.kind = ImageProbe::ISO9660;
+        probe.description = "ISO9660 disc image";
+    }
+    return iso || udf;
+}
+
+bool probeGpt(const uchar * h, size_t len, ImageProbe& probe)
+{
+    // The header sits in LBA 1, for 512 byte or 4 KiB sector images.
+    static const size_t sectors[] = { 512, 4096 };
+
+    for (size_t i = 0; i < sizeof(sectors) / sizeof(sectors[0]); ++i)
+    {
+        size_t sector = sectors[i];
+        if (len < sector + 92 || 0 != memcmp(h + sector, "EFI PART", 8))
+            continue;
+
+        quint64 entries_lba = qFromLittleEndian<quint64>(h + sector + 72);
+        quint32 count = qFromLittleEndian<quint32>(h + sector + 80);
+        quint32 entry_size = qFromLittleEndian<quint32>(h + sector + 84);
+
+        int used = 0;
+        static const uchar unused[16] = { 0 };
+        for (quint32 e = 0; e < count && entry_size >= 16; ++e)
+        {
+            quint64 off = entries_lba * sector + quint64(e) * entry_size;
+            if (off + 16 > len)
+                break;
+            if (0 != memcmp(h + off, unused, 16))
+                ++used;
+        }
+
+        probe.kind = ImageProbe::GPT;
+        probe.description = "Disk image, GPT with " + QString::number(used) + " partition(s)";
+        return true;
+    }
+    return false;
+}
+
+bool probeBootSector(const uchar * h, size_t len, ImageProbe& probe)
+{
+    if (len < 512 || 0x55 != h[510] || 0xaa != h[511])
+        return false;
+
+    if (0 == memcmp(h + 3, "NTFS    ", 8))
+    {
+        probe.kind = ImageProbe::NTFS;
+        probe.description = "NTFS filesystem image";
+        return true;
+    }
+
+    if (0 == memcmp(h + 0x52, "FAT32", 5))
+    {
+        probe.kind = ImageProbe::FAT;
+        probe.label = latin1Label(h + 0x47, 11);
+        probe.description = "FAT32 filesystem image";
+        return true;
+    }
+
+    if (0 == memcmp(h + 0x36, "FAT1", 4))
+    {
+        probe.kind = ImageProbe::FAT;
+        probe.label = latin1Label(h + 0x2b, 11);
+        probe.description = latin1Label(h + 0x36, 5) + " filesystem image";
+        return true;
+    }
+
+    // Whatever is left with a boot signature has to carry a sane partition table to count as MBR.
+    int used = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        const uchar * e = h + 446 + i * 16;
+        if (0 != e[0] && 0x80 != e[0])
+            return false;
+        if (0 != e[4])
+            ++used;
+    }
+
+    if (0 == used)
+        return false;
+
+    probe.kind = ImageProbe::MBR;
+    probe.description = "Disk image, MBR with " + QString::number(used) + " partition(s)";
+    return true;
+}
+
+bool probeExt(const uchar * h, size_t len, ImageProbe& probe)
+{
+    const uchar * sb = h + EXT_SUPERBLOCK_OFFSET;
+    if (len < EXT_SUPERBLOCK_OFFSET + 1024 || 0xef53 != qFromLittleEndian<quint16>(sb + 56))
+        return false;
+
+    quint32 compat = qFromLittleEndian<quint32>(sb + 92);
+    quint32 incompat = qFromLittleEndian<quint32>(sb + 96);
+
+    // Extents, 64bit or flex_bg only exist on ext4, a journal makes it ext3.
+    QString type = "ext2";
+    if (incompat & (0x40 | 0x80 | 0x200))
+        type = "ext4";
+    else if (compat & 0x4)
+        type = "ext3";
+
+    probe.kind = ImageProbe::Ext;
+    probe.label = latin1Label(sb + 120, 16);
+    probe.description = type + " filesystem image";
+    return true;
+}
+
+}
+
+ImageMounter::ImageMounter(DeviceWatcher *watcher, QObject *parent) :
+    QObject(parent),
+    m_pdevWatcher(watcher)
+{
+    m_ptimer = new QTimer(this);
+    m_ptimer->setSingleShot(true);
+    QObject::connect(m_ptimer, SIGNAL(timeout()), this, SLOT(slotWaitTimeout()));
+
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceAdded(DeviceInfoPtr)), this, SLOT(slotDeviceAdded(DeviceInfoPtr)));
+    QObject::connect(m_pdevWatcher, SIGNAL(loopSetUp(QString, QString, ErrorCode, QString)),
+                     this, SLOT(slotLoopSetUp(QString, QString, ErrorCode, QString)));
+    QObject::connect(m_pdevWatcher, SIGNAL(loopTornDown(QString, ErrorCode)),
+                     this, SLOT(slotLoopTornDown(QString, ErrorCode)));
+}
+
+ImageProbe ImageMounter::probe(const QString &path)
+{
+    ImageProbe probe;
+
+    int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) < 0 || st.st_size <= 0)
+    {
+        if (fd >= 0)
+            ::close(fd);
+        return probe;
+    }
+
+    probe.sizeBytes = st.st_size;
+
+    // Every signature we look for lives in the first 64 KiB, mapping just that keeps probing
+    // a multi gigabyte image as cheap as probing a floppy.
+    size_t len = qMin<qint64>(PROBE_SIZE, st.st_size);
+    void * map = ::mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == map)
+        return probe;
+
+    const uchar * h = static_cast<const uchar*>(map);
+
+    if (len >= 8 && 0 == memcmp(h, "MNTIMG01", 8))
+    {
+        probe.kind = ImageProbe::Compressed;
+        probe.description = "Compressed MOUNTain image";
+    }
+    else if (!probeIso(h, len, probe) && !probeGpt(h, len, probe) && !probeExt(h, len, probe))
+        probeBootSector(h, len, probe);
+
+    ::munmap(map, len);
+    return probe;
+}
+
+bool ImageMounter::open(const QString &file, const ImageProbe &probe, QString &error)
+{
+    QString path = QFileInfo(file).canonicalFilePath();
+
+    if (path.isEmpty())
+    {
+        error = file + " doesn't exist.";
+        return false;
+    }
+
+    if (ImageProbe::Compressed == probe.kind)
+    {
+        error = "Compressed images can't be mounted, restore them to a device with Write image... instead.";
+        return false;
+    }
+
+    if (m_pending.contains(path) || m_attached.values().contains(path))
+    {
+        error = file + " is already open.";
+        return false;
+    }
+
+    m_pending.append(path);
+    m_pdevWatcher->setupLoop(path, probe.readOnly() || !QFileInfo(path).isWritable());
+    return true;
+}
+
+void ImageMounter::detach(const QString &drive_path)
+{
+    m_pdevWatcher->teardownLoop(drive_path);
+}
+
+bool ImageMounter::isAttached(const QString &drive_path) const
+{
+    return m_attached.contains(drive_path);
+}
+
+bool ImageMounter::owns(const DeviceInfo &dev) const
+{
+    return !dev.imageFile.isEmpty()
+            && (m_attached.contains(dev.drivePath) || m_pending.contains(QFileInfo(dev.imageFile).canonicalFilePath()));
+}
+
+bool ImageMounter::canDetach(const QString &drive_path) const
+{
+    foreach (const DeviceWatcher::DeviceInfoPtr& dev, m_pdevWatcher->drivePartitions(drive_path))
+    {
+        if (DeviceInfo::IMAGE != dev->type || dev->isMounted)
+            return false;
+    }
+    return true;
+}
+
+QMap<QString, QString> ImageMounter::unrecognised() const
+{
+    QMap<QString, QString> images;
+
+    for (QMap<QString, QString>::const_iterator itr = m_attached.begin(); itr != m_attached.end(); ++itr)
+    {
+        if (!m_waiting.contains(itr.key()) && m_pdevWatcher->drivePartitions(itr.key()).isEmpty())
+            images.insert(itr.key(), itr.value());
+    }
+    return images;
+}
+
+void ImageMounter::slotDeviceAdded(const DeviceInfoPtr &dev)
+{
+    if (dev->imageFile.isEmpty())
+        return;
+
+    // Either the first filesystem of an image we just opened, or another partition of it. The
+    // filesystem may be reported before the reply to LoopSetup arrives.
+    QString path = QFileInfo(dev->imageFile).canonicalFilePath();
+    if (m_pending.removeAll(path) > 0)
+        m_attached.insert(dev->drivePath, path);
+    else if (!m_attached.contains(dev->drivePath))
+        return;
+
+    m_waiting.remove(dev->drivePath);
+    if (!dev->isMounted)
+        m_pdevWatcher->mountDevice(dev->udisksPath);
+}
+
+void ImageMounter::slotLoopSetUp(QString file, QString drive_path, ErrorCode e, QString message)
+{
+    if (m_pending.removeAll(file) == 0)
+        return;
+
+    if (OK != e)
+    {
+        emit failed(file, message.isEmpty() ? "Loop device can't be set up." : message);
+        return;
+    }
+
+    // Known from here on whether or not a filesystem ever shows up, so it can always be detached.
+    m_attached.insert(drive_path, file);
+    if (m_pdevWatcher->drivePartitions(drive_path).isEmpty())
+    {
+        m_waiting.insert(drive_path, QDateTime::currentMSecsSinceEpoch() + FILESYSTEM_WAIT_TIMEOUT);
+        if (!m_ptimer->isActive())
+            m_ptimer->start(FILESYSTEM_WAIT_TIMEOUT);
+    }
+}
+
+void ImageMounter::slotWaitTimeout()
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 next = 0;
+
+    for (QMap<QString, qint64>::iterator itr = m_waiting.begin(); itr != m_waiting.end(); )
+    {
+        if (itr.value() > now)
+        {
+            next = 0 == next ? itr.value() : qMin(next, itr.value());
+            ++itr;
+            continue;
+        }
+
+        QString file = m_attached.value(itr.key());
+        itr = m_waiting.erase(itr);
+        emit failed(file, "No filesystem of the image was recognised. It stays attached until it's detached from the tray menu.");
+    }
+
+    if (0 != next)
+        m_ptimer->start(int(next - now));
+}
+
+void ImageMounter::slotLoopTornDown(QString drive_path, ErrorCode e)
+{
+    QString file = m_attached.value(drive_path);
+
+    if (OK != e)
+    {
+        emit failed(file, "Loop device can't be detached.");
+        return;
+    }
+
+    m_attached.remove(drive_path);
+    m_waiting.remove(drive_path);
+    emit detached(file);
+}
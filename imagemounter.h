@@ -0,0 +1,66 @@
+#ifndef IMAGEMOUNTER_H
+#define IMAGEMOUNTER_H
+
+#include <QObject>
+#include <QtCore>
+
+#include "devicewatcher.h"
+
+struct ImageProbe
+{
+    enum Kind
+    {
+        Unknown, ISO9660, UDF, MBR, GPT, Ext, FAT, NTFS, Compressed
+    };
+
+    ImageProbe() : kind(Unknown), sizeBytes(0) {}
+
+    Kind kind;
+    QString description;
+    QString label;
+    qint64 sizeBytes;
+
+    bool readOnly() const { return ISO9660 == kind || UDF == kind; }
+};
+
+class ImageMounter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ImageMounter(DeviceWatcher * watcher, QObject *parent = 0);
+
+    // Identifies an image from its first 64 KiB, the rest of the file is never touched.
+    static ImageProbe probe(const QString& path);
+
+    bool open(const QString& file, const ImageProbe& probe, QString& error);
+    void detach(const QString& drive_path);
+    bool isAttached(const QString& drive_path) const;
+    // True for devices of images opened here, those are mounted by ImageMounter itself.
+    bool owns(const DeviceInfo& dev) const;
+    bool canDetach(const QString& drive_path) const;
+    // Attached images that never showed a filesystem, drive path -> image file. They don't appear
+    // among the devices, so the tray lists them on their own to be detached.
+    QMap<QString, QString> unrecognised() const;
+
+signals:
+    void failed(QString file, QString message);
+    void detached(QString file);
+
+private slots:
+    void slotDeviceAdded(const DeviceInfoPtr& dev);
+    void slotLoopSetUp(QString file, QString drive_path, ErrorCode e, QString message);
+    void slotLoopTornDown(QString drive_path, ErrorCode e);
+    void slotWaitTimeout();
+
+private:
+    DeviceWatcher * m_pdevWatcher;
+    QTimer * m_ptimer;
+    // Canonical paths of images whose loop device hasn't shown up yet.
+    QStringList m_pending;
+    // Drive path of the loop device -> image file.
+    QMap<QString, QString> m_attached;
+    // Loop devices set up but without a filesystem yet, drive path -> deadline in ms since epoch.
+    QMap<QString, qint64> m_waiting;
+};
+
+#endif // IMAGEMOUNTER_H
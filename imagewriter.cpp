@@ -0,0 +1,653 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include "imagewriter.h"
+#include "imageformat.h"
+#include "hasher.h"
+
+const int RING_SIZE = 3;
+const size_t IMAGE_CHUNK = ImageFormat::ChunkSize;
+const size_t BUFFER_ALIGNMENT = 4096;
+
+namespace
+{
+
+// Whether a process keeps something below mount_path open, as its cwd, root, binary or through a
+// descriptor. Only processes we may inspect are seen, udisks still has the last word on busy mounts.
+bool mountInUse(const QString& mount_path, QString& user)
+{
+    QByteArray root = QFile::encodeName(QDir::cleanPath(mount_path));
+    QByteArray prefix = root + '/';
+    char target[PATH_MAX];
+
+    DIR * proc = ::opendir("/proc");
+    if (0 == proc)
+        return false;
+
+    bool busy = false;
+    struct dirent * pe;
+    while (!busy && 0 != (pe = ::readdir(proc)))
+    {
+        if (pe->d_name[0] < '0' || pe->d_name[0] > '9')
+            continue;
+
+        QByteArray pid_dir = QByteArray("/proc/") + pe->d_name;
+        QList<QByteArray> links;
+        links << pid_dir + "/cwd" << pid_dir + "/root" << pid_dir + "/exe";
+
+        DIR * fds = ::opendir((pid_dir + "/fd").constData());
+        if (0 != fds)
+        {
+            struct dirent * fe;
+            while (0 != (fe = ::readdir(fds)))
+            {
+                if ('.' != fe->d_name[0])
+                    links << pid_dir + "/fd/" + fe->d_name;
+            }
+            ::closedir(fds);
+        }
+
+        foreach (const QByteArray& link, links)
+        {
+            ssize_t n = ::readlink(link.constData(), target, sizeof(target) - 1);
+            if (n <= 0)
+                continue;
+            target[n] = '\0';
+            if (root == target || 0 == ::strncmp(target, prefix.constData(), prefix.size()))
+            {
+                QFile comm(QString::fromLatin1(pid_dir) + "/comm");
+                user = comm.open(QIODevice::ReadOnly) ? QString::fromLocal8Bit(comm.readAll()).trimmed() : QString();
+                user += " (" + QString::fromLatin1(pe->d_name) + ")";
+                busy = true;
+                break;
+            }
+        }
+    }
+
+    ::closedir(proc);
+    return busy;
+}
+
+ssize_t readFull(int fd, char * buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = ::read(fd, buf + done, len - done);
+        if (n < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        if (0 == n)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+bool writeFull(int fd, const char * buf, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::pwrite(fd, buf, len, offset);
+        if (n < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+size_t roundUp(size_t n, size_t to)
+{
+    return (n + to - 1) / to * to;
+}
+
+}
+
+class ImageWriteWorker::ReaderThread : public QThread
+{
+public:
+    ReaderThread(ImageWriteWorker * worker, int fd, ImageReader * decoder) :
+        m_pworker(worker), m_fd(fd), m_pdecoder(decoder) {}
+
+    QAtomicInt stop;
+    QByteArray digest;
+
+protected:
+    void run()
+    {
+        QScopedPointer<Hasher> hasher(Hasher::create(Hasher::XXH64));
+        ::posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        for (int slot = 0; ; slot = (slot + 1) % RING_SIZE)
+        {
+            m_pworker->m_free.acquire();
+
+            char * buf = m_pworker->m_buffers.at(slot);
+            ssize_t n = 0;
+            if (0 == stop.load() && !m_pworker->cancelled())
+            {
+                n = 0 != m_pdecoder ? m_pdecoder->read(buf) : readFull(m_fd, buf, IMAGE_CHUNK);
+
+                if (n < 0 && 0 != m_pdecoder)
+                    m_pworker->fail(m_pdecoder->error());
+                else if (0 == n && 0 != m_pdecoder && m_pdecoder->digest() != finalDigest(hasher.data()))
+                {
+                    m_pworker->fail("Checksum of " + m_pworker->m_image + " doesn't match, the image is corrupt");
+                    n = -1;
+                }
+            }
+
+            // The source is hashed on its way in, so verification only has to read the target.
+            if (n > 0)
+            {
+                hasher->update(buf, n);
+                ::posix_fadvise(m_fd, 0, ::lseek(m_fd, 0, SEEK_CUR), POSIX_FADV_DONTNEED);
+            }
+
+            m_pworker->m_lengths[slot] = n;
+            m_pworker->m_filled.release();
+
+            if (n <= 0)
+                break;
+        }
+
+        if (digest.isEmpty())
+            digest = finalDigest(hasher.data());
+    }
+
+private:
+    ImageWriteWorker * m_pworker;
+    int m_fd;
+    ImageReader * m_pdecoder;
+
+    QByteArray finalDigest(Hasher * hasher)
+    {
+        digest.resize(Hasher::digestSize(Hasher::XXH64));
+        hasher->final(reinterpret_cast<unsigned char*>(digest.data()));
+        return digest;
+    }
+};
+
+ImageWriteWorker::ImageWriteWorker(const QString &image, const QString &target, QObject *parent) :
+    JobWorker(parent),
+    m_image(image),
+    m_target(target),
+    m_phase(ImageWriteProgress::Preparing),
+    m_lengths(RING_SIZE),
+    m_free(RING_SIZE),
+    m_sector(512)
+{
+    m_clock.start();
+
+    for (int i = 0; i < RING_SIZE; ++i)
+    {
+        void * p = 0;
+        if (::posix_memalign(&p, BUFFER_ALIGNMENT, IMAGE_CHUNK) != 0)
+            p = 0;
+        m_buffers.append(static_cast<char*>(p));
+    }
+}
+
+ImageWriteWorker::~ImageWriteWorker()
+{
+    foreach (char * buf, m_buffers)
+        free(buf);
+}
+
+void ImageWriteWorker::cancel()
+{
+    m_cancel.store(1);
+}
+
+bool ImageWriteWorker::cancelled() const
+{
+    return 0 != m_cancel.load();
+}
+
+ImageWriteProgress ImageWriteWorker::progress() const
+{
+    ImageWriteProgress p;
+    p.phase = ImageWriteProgress::Phase(m_phase.load());
+    p.bytesDone = m_bytesDone.load();
+    p.bytesTotal = m_bytesTotal.load();
+    p.bytesSkipped = m_bytesSkipped.load();
+
+    qint64 ms = m_clock.elapsed() - m_phaseStart.load();
+    p.mbps = ms > 0 ? p.bytesDone * 1000.0 / ms / (1024 * 1024) : 0;
+    return p;
+}
+
+QString ImageWriteWorker::error() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_error;
+}
+
+QString ImageWriteWorker::image() const
+{
+    return m_image;
+}
+
+void ImageWriteWorker::run()
+{
+    if (m_buffers.contains(0))
+    {
+        fail("Out of memory");
+        return;
+    }
+
+    int in = ::open(QFile::encodeName(m_image).constData(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (in < 0 || ::fstat(in, &st) < 0)
+    {
+        fail("Can't open " + m_image, errno);
+        if (in >= 0)
+            ::close(in);
+        return;
+    }
+    qint64 size = st.st_size;
+
+    // Compressed images made by DeviceImager are decoded on the fly, everything else is written as is.
+    QScopedPointer<ImageReader> decoder;
+    if (ImageFormat::isImage(m_image))
+    {
+        decoder.reset(new ImageReader(in));
+        if (!decoder->open())
+        {
+            fail(decoder->error() + ": " + m_image);
+            ::close(in);
+            return;
+        }
+        size = decoder->size();
+    }
+
+    QByteArray target = QFile::encodeName(m_target);
+    bool regular_file = ::stat(target.constData(), &st) < 0 || S_ISREG(st.st_mode);
+
+    // O_EXCL on a block device fails with EBUSY while any of its partitions is mounted.
+    int flags = regular_file ? O_WRONLY | O_CREAT | O_TRUNC : O_WRONLY | O_EXCL;
+    int out = ::open(target.constData(), flags | O_DIRECT | O_CLOEXEC, 0644);
+    if (out < 0 && EINVAL == errno)
+        out = ::open(target.constData(), flags | O_CLOEXEC, 0644);
+    if (out < 0)
+    {
+        fail("Can't open " + m_target, errno);
+        ::close(in);
+        return;
+    }
+
+    // Direct I/O wants offsets and lengths aligned to the logical sector, or the page for files.
+    if (regular_file)
+        m_sector = BUFFER_ALIGNMENT;
+    else
+    {
+        ::ioctl(out, BLKSSZGET, &m_sector);
+        off_t capacity = ::lseek(out, 0, SEEK_END);
+        if (capacity >= 0 && capacity < size)
+        {
+            fail(m_target + " is smaller than the image");
+            ::close(in);
+            ::close(out);
+            return;
+        }
+    }
+
+    m_bytesTotal.store(size);
+    setPhase(ImageWriteProgress::Writing);
+
+    QByteArray digest;
+    bool ok = write(in, decoder.data(), out, regular_file, digest);
+    ::close(in);
+
+    if (ok && regular_file && ::ftruncate(out, size) < 0)
+        ok = fail("Can't set size of " + m_target, errno);
+    if (ok && ::fsync(out) < 0)
+        ok = fail("Flushing " + m_target + " failed", errno);
+    ::close(out);
+
+    if (ok && verify(size, digest))
+        setPhase(ImageWriteProgress::Done);
+}
+
+bool ImageWriteWorker::write(int in, ImageReader *decoder, int out, bool regular_file, QByteArray &digest)
+{
+    ReaderThread reader(this, in, decoder);
+    reader.start();
+
+    bool ok = true;
+    off_t offset = 0;
+
+    for (int slot = 0; ; slot = (slot + 1) % RING_SIZE)
+    {
+        m_filled.acquire();
+
+        char * buf = m_buffers.at(slot);
+        ssize_t n = m_lengths.at(slot);
+
+        if (n < 0)
+            ok = fail("Reading " + m_image + " failed");
+
+        if (n <= 0)
+        {
+            m_free.release();
+            break;
+        }
+
+        if (ok && cancelled())
+        {
+            ok = fail("Cancelled");
+            reader.stop.store(1);
+        }
+
+        if (ok)
+        {
+            size_t len = n;
+
+            if (regular_file && ImageFormat::isZero(buf, len))
+            {
+                // Holes in a freshly truncated file read back as zeroes, on a device they wouldn't.
+                m_bytesSkipped.fetchAndAddRelaxed(len);
+                len = 0;
+            }
+            else if (0 != len % m_sector)
+            {
+                if (regular_file)
+                    ::fcntl(out, F_SETFL, ::fcntl(out, F_GETFL) & ~O_DIRECT);
+                else
+                {
+                    memset(buf + len, 0, roundUp(len, m_sector) - len);
+                    len = roundUp(len, m_sector);
+                }
+            }
+
+            if (len > 0 && !writeFull(out, buf, len, offset))
+            {
+                ok = fail("Writing " + m_target + " failed", errno);
+                reader.stop.store(1);
+            }
+        }
+
+        offset += n;
+        m_bytesDone.store(offset);
+        m_free.release();
+    }
+
+    reader.wait();
+    digest = reader.digest;
+    return ok;
+}
+
+bool ImageWriteWorker::verify(qint64 size, QByteArray &digest)
+{
+    setPhase(ImageWriteProgress::Verifying);
+
+    QByteArray target = QFile::encodeName(m_target);
+    int fd = ::open(target.constData(), O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (fd < 0 && EINVAL == errno)
+        fd = ::open(target.constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return fail("Can't open " + m_target + " for verification", errno);
+
+    QScopedPointer<Hasher> hasher(Hasher::create(Hasher::XXH64));
+    char * buf = m_buffers.first();
+    bool ok = true;
+
+    for (qint64 offset = 0; offset < size; )
+    {
+        if (cancelled())
+        {
+            ok = fail("Cancelled");
+            break;
+        }
+
+        size_t want = qMin<qint64>(IMAGE_CHUNK, size - offset);
+        ssize_t n = ::pread(fd, buf, roundUp(want, m_sector), offset);
+        if (n < ssize_t(want))
+        {
+            ok = fail("Reading back " + m_target + " failed");
+            break;
+        }
+
+        hasher->update(buf, want);
+        offset += want;
+        m_bytesDone.store(offset);
+    }
+
+    ::close(fd);
+
+    if (!ok)
+        return false;
+
+    QByteArray written(Hasher::digestSize(Hasher::XXH64), '\0');
+    hasher->final(reinterpret_cast<unsigned char*>(written.data()));
+
+    if (written != digest)
+        return fail("Verification failed, " + m_target + " doesn't match the image (xxh64 "
+                    + QString::fromLatin1(written.toHex()) + " != " + QString::fromLatin1(digest.toHex()) + ")");
+    return true;
+}
+
+bool ImageWriteWorker::fail(const QString &what, int err)
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_error.isEmpty())
+    {
+        m_error = what;
+        if (0 != err)
+            m_error += ": " + QString::fromLocal8Bit(strerror(err));
+    }
+    return false;
+}
+
+void ImageWriteWorker::setPhase(ImageWriteProgress::Phase phase)
+{
+    m_bytesDone.store(0);
+    m_phaseStart.store(m_clock.elapsed());
+    m_phase.store(phase);
+}
+
+ImageWriter::ImageWriter(DeviceWatcher *watcher, QObject *parent) :
+    JobManager(watcher, parent)
+{
+}
+
+int ImageWriter::writeFromCommandLine(const QString &image, const QString &target)
+{
+    static const char * phases[] = { "preparing", "writing", "verifying", "done" };
+
+    QTextStream err(stderr);
+    ImageWriteWorker worker(image, target);
+    worker.start();
+
+    while (!worker.wait(500))
+    {
+        ImageWriteProgress p = worker.progress();
+        err << "\r" << phases[p.phase] << ": " << p.bytesDone / (1024 * 1024) << " of " << p.bytesTotal / (1024 * 1024)
+            << " MB, " << QString::number(p.mbps, 'f', 1) << " MB/s   ";
+        err.flush();
+    }
+
+    ImageWriteProgress p = worker.progress();
+    err << "\n";
+
+    if (ImageWriteProgress::Done != p.phase)
+    {
+        err << worker.error() << "\n";
+        return 1;
+    }
+
+    err << target << " written and verified, " << p.bytesSkipped / (1024 * 1024) << " MB of zeroes skipped.\n";
+    return 0;
+}
+
+bool ImageWriter::start(const DeviceInfo &dev, const QString &image, QString &error)
+{
+    if (dev.drivePath.isEmpty() || isRunning(dev.drivePath))
+    {
+        error = "An image is already being written to this drive.";
+        return false;
+    }
+
+    if (!QFileInfo(image).isFile())
+    {
+        error = image + " is not a file.";
+        return false;
+    }
+
+    if (dev.isSystem)
+    {
+        error = dev.driveFile + " is a system drive, images are only written to removable ones.";
+        return false;
+    }
+
+    Pending pending;
+    pending.image = image;
+
+    // Everything is checked before the first unmount, giving up halfway would leave the drive
+    // partly unmounted for nothing.
+    foreach (const DeviceWatcher::DeviceInfoPtr& part, m_pdevWatcher->drivePartitions(dev.drivePath))
+    {
+        if (part->isSystem)
+        {
+            error = part->fileName + " is a system partition, images are only written to removable drives.";
+            return false;
+        }
+
+        if (!part->isMounted)
+            continue;
+
+        QString user;
+        if (mountInUse(part->mountPoint, user))
+        {
+            error = part->mountPoint + " is in use by " + user + ", nothing was unmounted.";
+            return false;
+        }
+        pending.pendingUnmounts << part->udisksPath;
+    }
+
+    addJob(dev.drivePath, dev);
+
+    if (pending.pendingUnmounts.isEmpty())
+        startWriting(dev.drivePath, image);
+    else
+    {
+        m_pending.insert(dev.drivePath, pending);
+        foreach (const QString& path, pending.pendingUnmounts)
+            m_pdevWatcher->unmountDevice(path, false);
+    }
+
+    emit progressChanged(dev);
+    return true;
+}
+
+ImageWriteProgress ImageWriter::progress(const QString &drive_path) const
+{
+    ImageWriteWorker * w = static_cast<ImageWriteWorker*>(worker(drive_path));
+    return 0 == w ? ImageWriteProgress() : w->progress();
+}
+
+QString ImageWriter::jobKey(const DeviceInfo &dev) const
+{
+    return dev.drivePath;
+}
+
+void ImageWriter::jobFinished(const DeviceInfo &dev, JobWorker *job_worker)
+{
+    ImageWriteWorker * worker = static_cast<ImageWriteWorker*>(job_worker);
+    bool ok = ImageWriteProgress::Done == worker->progress().phase;
+    QString message = ok ? QFileInfo(worker->image()).fileName() + " written to " + dev.driveFile + " and verified."
+                         : worker->error();
+
+    emit finished(dev, ok, message);
+}
+
+void ImageWriter::deviceRemoved(const DeviceInfoPtr &dev)
+{
+    m_remount.remove(dev->udisksPath);
+
+    // Only filesystems are in the device table, a whole drive shows up through its partitions.
+    if (!isRunning(dev->drivePath))
+        return;
+
+    if (!m_pending.contains(dev->drivePath))
+    {
+        // Partitions come and go while the table is rewritten, only losing the drive itself matters.
+        if (!QFile::exists(jobDevice(dev->drivePath).driveFile))
+            cancel(dev->drivePath);
+        return;
+    }
+
+    DeviceInfo drive = jobDevice(dev->drivePath);
+    m_pending.remove(dev->drivePath);
+    dropJob(dev->drivePath);
+    emit finished(drive, false, dev->fileName + " was removed, nothing was written.");
+}
+
+void ImageWriter::deviceUnmounted(const DeviceInfoPtr &dev, ErrorCode e)
+{
+    if (m_remount.remove(dev->udisksPath))
+    {
+        if (OK == e)
+            m_pdevWatcher->mountDevice(dev->udisksPath);
+        return;
+    }
+
+    for (QMap<QString, Pending>::iterator itr = m_pending.begin(); itr != m_pending.end(); ++itr)
+    {
+        if (!itr->pendingUnmounts.contains(dev->udisksPath))
+            continue;
+
+        QString drive_path = itr.key();
+        itr->pendingUnmounts.removeAll(dev->udisksPath);
+
+        if (OK != e)
+        {
+            // Put back what this job already unmounted, the rest is remounted as its unmount completes.
+            foreach (const QString& path, itr->unmounted)
+                m_pdevWatcher->mountDevice(path);
+            foreach (const QString& path, itr->pendingUnmounts)
+                m_remount.insert(path);
+
+            DeviceInfo drive = jobDevice(drive_path);
+            m_pending.erase(itr);
+            dropJob(drive_path);
+            emit finished(drive, false, dev->fileName + " can't be unmounted, nothing was written.");
+            return;
+        }
+
+        itr->unmounted << dev->udisksPath;
+        if (itr->pendingUnmounts.isEmpty())
+        {
+            QString image = itr->image;
+            m_pending.erase(itr);
+            startWriting(drive_path, image);
+        }
+        return;
+    }
+}
+
+void ImageWriter::startWriting(const QString &drive_path, const QString &image)
+{
+    QString target = jobDevice(drive_path).driveFile;
+    qDebug() << "Writing " << image << " to " << target;
+
+    startWorker(drive_path, new ImageWriteWorker(image, target, this));
+}
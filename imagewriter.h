@@ -0,0 +1,108 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <QObject>
+#include <QtCore>
+
+#include "jobmanager.h"
+
+class ImageReader;
+
+struct ImageWriteProgress
+{
+    enum Phase
+    {
+        Preparing, Writing, Verifying, Done
+    };
+
+    ImageWriteProgress() : phase(Preparing), bytesDone(0), bytesTotal(0), bytesSkipped(0), mbps(0) {}
+
+    Phase phase;
+    qint64 bytesDone;
+    qint64 bytesTotal;
+    qint64 bytesSkipped;
+    double mbps;
+};
+
+class ImageWriteWorker : public JobWorker
+{
+public:
+    ImageWriteWorker(const QString& image, const QString& target, QObject * parent = 0);
+    ~ImageWriteWorker();
+
+    void cancel();
+    bool cancelled() const;
+    ImageWriteProgress progress() const;
+    QString error() const;
+    QString image() const;
+
+protected:
+    void run();
+
+private:
+    class ReaderThread;
+
+    QString m_image;
+    QString m_target;
+    QAtomicInt m_cancel;
+    QAtomicInt m_phase;
+    QAtomicInteger<qint64> m_bytesDone;
+    QAtomicInteger<qint64> m_bytesTotal;
+    QAtomicInteger<qint64> m_bytesSkipped;
+    QElapsedTimer m_clock;
+    QAtomicInteger<qint64> m_phaseStart;
+    mutable QMutex m_mutex;
+    QString m_error;
+    int m_sector;
+
+    // Read-ahead ring shared with the reader thread.
+    QVector<char*> m_buffers;
+    QVector<qint64> m_lengths;
+    QSemaphore m_free;
+    QSemaphore m_filled;
+
+    bool write(int in, ImageReader * decoder, int out, bool regular_file, QByteArray& digest);
+    bool verify(qint64 size, QByteArray& digest);
+    bool fail(const QString& what, int err = 0);
+    void setPhase(ImageWriteProgress::Phase phase);
+};
+
+class ImageWriter : public JobManager
+{
+    Q_OBJECT
+public:
+    explicit ImageWriter(DeviceWatcher * watcher, QObject *parent = 0);
+
+    static int writeFromCommandLine(const QString& image, const QString& target);
+
+    bool start(const DeviceInfo& dev, const QString& image, QString& error);
+    ImageWriteProgress progress(const QString& drive_path) const;
+
+    // Writes own the whole drive, the job of a partition is the one of its drive.
+    QString jobKey(const DeviceInfo& dev) const;
+
+signals:
+    void finished(const DeviceInfo& dev, bool ok, QString message);
+
+protected:
+    void jobFinished(const DeviceInfo& dev, JobWorker * worker);
+    void deviceRemoved(const DeviceInfoPtr& dev);
+    void deviceUnmounted(const DeviceInfoPtr& dev, ErrorCode e);
+
+private:
+    // Jobs still waiting for their partitions to be unmounted.
+    struct Pending
+    {
+        QString image;
+        QStringList pendingUnmounts;
+        QStringList unmounted;
+    };
+
+    QMap<QString, Pending> m_pending;
+    // Partitions whose unmount was still in flight when their job gave up.
+    QSet<QString> m_remount;
+
+    void startWriting(const QString& drive_path, const QString& image);
+};
+
+#endif // IMAGEWRITER_H
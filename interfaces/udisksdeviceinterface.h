@@ -39,6 +39,10 @@ public:
     inline QString deviceFile() const
     { return qvariant_cast< QString >(property("DeviceFile")); }
 
+    Q_PROPERTY(bool DeviceIsLinuxLoop READ deviceIsLinuxLoop)
+    inline bool deviceIsLinuxLoop() const
+    { return qvariant_cast< bool >(property("DeviceIsLinuxLoop")); }
+
     Q_PROPERTY(bool DeviceIsMounted READ deviceIsMounted)
     inline bool deviceIsMounted() const
     { return qvariant_cast< bool >(property("DeviceIsMounted")); }
@@ -47,6 +51,10 @@ public:
     inline bool deviceIsOpticalDisk() const
     { return qvariant_cast< bool >(property("DeviceIsOpticalDisk")); }
 
+    Q_PROPERTY(bool DeviceIsPartition READ deviceIsPartition)
+    inline bool deviceIsPartition() const
+    { return qvariant_cast< bool >(property("DeviceIsPartition")); }
+
     Q_PROPERTY(bool DeviceIsSystemInternal READ deviceIsSystemInternal)
     inline bool deviceIsSystemInternal() const
     { return qvariant_cast< bool >(property("DeviceIsSystemInternal")); }
@@ -79,6 +87,14 @@ public:
     inline QString idUuid() const
     { return qvariant_cast< QString >(property("IdUuid")); }
 
+    Q_PROPERTY(QString LinuxLoopFilename READ linuxLoopFilename)
+    inline QString linuxLoopFilename() const
+    { return qvariant_cast< QString >(property("LinuxLoopFilename")); }
+
+    Q_PROPERTY(QDBusObjectPath PartitionSlave READ partitionSlave)
+    inline QDBusObjectPath partitionSlave() const
+    { return qvariant_cast< QDBusObjectPath >(property("PartitionSlave")); }
+
 public Q_SLOTS: // METHODS
     inline QDBusPendingReply<QString> FilesystemMount(const QString &filesystem_type, const QStringList &options)
     {
@@ -94,6 +110,13 @@ public Q_SLOTS: // METHODS
         return asyncCallWithArgumentList(QLatin1String("FilesystemUnmount"), argumentList);
     }
 
+    inline QDBusPendingReply<> LinuxLoopDeviceTeardown(const QStringList &options)
+    {
+        QList<QVariant> argumentList;
+        argumentList << QVariant::fromValue(options);
+        return asyncCallWithArgumentList(QLatin1String("LinuxLoopDeviceTeardown"), argumentList);
+    }
+
 Q_SIGNALS: // SIGNALS
 };
 
@@ -0,0 +1,187 @@
+#include "iomonitor.h"
+
+const int DEFAULT_SAMPLE_INTERVAL = 1000;
+const double SECTOR_SIZE = 512.0;
+
+IoMonitor::IoMonitor(DeviceWatcher *watcher, QObject *parent) :
+    QObject(parent),
+    m_pdevWatcher(watcher),
+    m_active(false)
+{
+    m_ptimer = new QTimer(this);
+    m_ptimer->setInterval(DEFAULT_SAMPLE_INTERVAL);
+    QObject::connect(m_ptimer, SIGNAL(timeout()), this, SLOT(slotSample()));
+    m_clock.start();
+}
+
+void IoMonitor::setInterval(int msec)
+{
+    m_ptimer->setInterval(msec > 0 ? msec : DEFAULT_SAMPLE_INTERVAL);
+}
+
+void IoMonitor::setWatched(const QSet<QString> &udisks_paths)
+{
+    m_watched = udisks_paths;
+}
+
+IoStats IoMonitor::stats(const QString &udisks_path) const
+{
+    QHash<QString, Sample>::const_iterator itr = m_samples.find(udisks_path);
+    if (m_samples.end() == itr)
+        return IoStats();
+    return itr->stats;
+}
+
+bool IoMonitor::anyBusy() const
+{
+    foreach (const Sample& s, m_samples)
+    {
+        if (s.stats.busy())
+            return true;
+    }
+    return false;
+}
+
+QString IoMonitor::statFilePath(const QString &dev_file)
+{
+    // /sys/class/block holds both whole disks and partitions, so "sdb" and "sdb1" resolve alike.
+    // Device files may be symlinks (/dev/mapper/*, /dev/disk/by-*), hence the canonical name.
+    QString real = QFileInfo(dev_file).canonicalFilePath();
+    if (real.isEmpty())
+        real = dev_file;
+    return "/sys/class/block/" + real.mid(real.lastIndexOf("/") + 1) + "/stat";
+}
+
+bool IoMonitor::readInFlight(const QString &dev_file, unsigned long &in_flight)
+{
+    Counters c;
+    if (!readCounters(statFilePath(dev_file), c))
+        return false;
+    in_flight = c.inFlight;
+    return true;
+}
+
+bool IoMonitor::readWriteSectors(const QString &dev_file, unsigned long long &sectors)
+{
+    Counters c;
+    if (!readCounters(statFilePath(dev_file), c))
+        return false;
+    sectors = c.writeSectors;
+    return true;
+}
+
+void IoMonitor::setActive(bool active)
+{
+    m_active = active;
+    if (m_active && !m_ptimer->isActive())
+    {
+        takeSample();
+        m_ptimer->start();
+    }
+    else updateTimer();
+}
+
+void IoMonitor::poke(const QString &udisks_path)
+{
+    m_poked.insert(udisks_path);
+    if (m_ptimer->isActive())
+        return;
+
+    // Take a baseline now, rates become available on the next tick.
+    takeSample();
+    m_ptimer->start();
+}
+
+void IoMonitor::slotSample()
+{
+    takeSample();
+    updateTimer();
+}
+
+void IoMonitor::takeSample()
+{
+    qint64 now = m_clock.elapsed();
+    QHash<QString, Sample> samples;
+
+    QSet<QString> paths = m_watched + m_poked;
+    for (QHash<QString, Sample>::const_iterator itr = m_samples.constBegin(); itr != m_samples.constEnd(); ++itr)
+    {
+        if (itr->stats.busy())
+            paths.insert(itr.key());
+    }
+
+    foreach (const QString& path, paths)
+    {
+        DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->getDevice(path);
+        Sample s;
+        if (0 == dev || !readCounters(statFilePath(dev->fileName), s.counters))
+        {
+            m_poked.remove(path);
+            continue;
+        }
+
+        s.timestamp = now;
+        s.stats.valid = true;
+        s.stats.inFlight = s.counters.inFlight;
+
+        QHash<QString, Sample>::const_iterator prev = m_samples.find(path);
+        if (m_samples.end() != prev && now > prev->timestamp)
+        {
+            double secs = (now - prev->timestamp) / 1000.0;
+            const Counters& p = prev->counters;
+
+            // A counter going backwards means the device was recreated under the same path, this
+            // sample only serves as the new baseline.
+            if (s.counters.readIos >= p.readIos && s.counters.readSectors >= p.readSectors
+                    && s.counters.writeIos >= p.writeIos && s.counters.writeSectors >= p.writeSectors)
+            {
+                s.stats.readMBps = (s.counters.readSectors - p.readSectors) * SECTOR_SIZE / (1024 * 1024) / secs;
+                s.stats.writeMBps = (s.counters.writeSectors - p.writeSectors) * SECTOR_SIZE / (1024 * 1024) / secs;
+                s.stats.iops = ((s.counters.readIos - p.readIos) + (s.counters.writeIos - p.writeIos)) / secs;
+            }
+
+            if (!s.stats.busy())
+                m_poked.remove(path);
+        }
+
+        samples.insert(path, s);
+    }
+
+    m_samples.swap(samples);
+    emit statsUpdated();
+}
+
+bool IoMonitor::readCounters(const QString &stat_path, Counters &c)
+{
+    QFile f(stat_path);
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+
+    // Field layout is described in Documentation/block/stat.txt of the kernel sources.
+    QList<QByteArray> fields = f.readAll().simplified().split(' ');
+    if (fields.size() < 9)
+        return false;
+
+    c.readIos = fields.at(0).toULongLong();
+    c.readSectors = fields.at(2).toULongLong();
+    c.writeIos = fields.at(4).toULongLong();
+    c.writeSectors = fields.at(6).toULongLong();
+    c.inFlight = fields.at(8).toULong();
+    return true;
+}
+
+void IoMonitor::updateTimer()
+{
+    if (m_active || anyBusy())
+    {
+        if (!m_ptimer->isActive())
+            m_ptimer->start();
+    }
+    else if (m_ptimer->isActive())
+    {
+        m_ptimer->stop();
+        m_samples.clear();
+        m_poked.clear();
+        emit statsUpdated();
+    }
+}
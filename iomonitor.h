@@ -0,0 +1,80 @@
+#ifndef IOMONITOR_H
+#define IOMONITOR_H
+
+#include <QObject>
+#include <QtCore>
+
+#include "devicewatcher.h"
+
+struct IoStats
+{
+    IoStats() : readMBps(0), writeMBps(0), iops(0), inFlight(0), valid(false) {}
+
+    double readMBps;
+    double writeMBps;
+    double iops;
+    unsigned long inFlight;
+    bool valid;
+
+    bool busy() const { return valid && (inFlight > 0 || iops > 0); }
+};
+
+class IoMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IoMonitor(DeviceWatcher * watcher, QObject *parent = 0);
+
+    void setInterval(int msec);
+    // Devices whose menus exist. Only these, busy devices and poked ones are sampled, so a large
+    // device table doesn't mean a stat file read per device on every tick.
+    void setWatched(const QSet<QString>& udisks_paths);
+    IoStats stats(const QString& udisks_path) const;
+    bool anyBusy() const;
+
+    static QString statFilePath(const QString& dev_file);
+    static bool readInFlight(const QString& dev_file, unsigned long& in_flight);
+    static bool readWriteSectors(const QString& dev_file, unsigned long long& sectors);
+
+signals:
+    void statsUpdated();
+
+public slots:
+    void setActive(bool active);
+    // Samples the device until it is seen idle, even without a menu.
+    void poke(const QString& udisks_path);
+
+private slots:
+    void slotSample();
+
+private:
+    struct Counters
+    {
+        unsigned long long readIos;
+        unsigned long long readSectors;
+        unsigned long long writeIos;
+        unsigned long long writeSectors;
+        unsigned long inFlight;
+    };
+
+    struct Sample
+    {
+        Counters counters;
+        qint64 timestamp;
+        IoStats stats;
+    };
+
+    DeviceWatcher * m_pdevWatcher;
+    QTimer * m_ptimer;
+    QElapsedTimer m_clock;
+    QHash<QString, Sample> m_samples;
+    QSet<QString> m_watched;
+    QSet<QString> m_poked;
+    bool m_active;
+
+    static bool readCounters(const QString& stat_path, Counters& c);
+    void takeSample();
+    void updateTimer();
+};
+
+#endif // IOMONITOR_H
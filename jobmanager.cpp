@@ -0,0 +1,172 @@
+#include "jobmanager.h"
+
+const int JOB_POLL_INTERVAL = 500;
+
+JobManager::JobManager(DeviceWatcher *watcher, QObject *parent) :
+    QObject(parent),
+    m_pdevWatcher(watcher)
+{
+    m_ptimer = new QTimer(this);
+    m_ptimer->setInterval(JOB_POLL_INTERVAL);
+    QObject::connect(m_ptimer, SIGNAL(timeout()), this, SLOT(slotPoll()));
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceRemoved(DeviceInfoPtr)), this, SLOT(slotDeviceRemoved(DeviceInfoPtr)));
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceMounted(DeviceInfoPtr, QString, ErrorCode)),
+                     this, SLOT(slotDeviceMounted(DeviceInfoPtr, QString, ErrorCode)));
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceUnmounted(DeviceInfoPtr, ErrorCode)),
+                     this, SLOT(slotDeviceUnmounted(DeviceInfoPtr, ErrorCode)));
+}
+
+JobManager::~JobManager()
+{
+    foreach (const Job& job, m_jobs)
+    {
+        if (0 != job.worker)
+        {
+            job.worker->cancel();
+            job.worker->wait();
+        }
+    }
+}
+
+QString JobManager::jobKey(const DeviceInfo &dev) const
+{
+    return dev.udisksPath;
+}
+
+void JobManager::cancel(const QString &key)
+{
+    QMap<QString, Job>::iterator itr = m_jobs.find(key);
+    if (m_jobs.end() != itr && 0 != itr->worker)
+        itr->worker->cancel();
+}
+
+bool JobManager::isRunning(const QString &key) const
+{
+    return m_jobs.contains(key);
+}
+
+bool JobManager::hasJob(const DeviceInfo &dev) const
+{
+    return m_jobs.contains(jobKey(dev));
+}
+
+bool JobManager::idle() const
+{
+    return m_jobs.isEmpty();
+}
+
+bool JobManager::addJob(const QString &key, const DeviceInfo &dev)
+{
+    if (m_jobs.contains(key))
+        return false;
+
+    Job job;
+    job.device = dev;
+    m_jobs.insert(key, job);
+    return true;
+}
+
+void JobManager::startWorker(const QString &key, JobWorker *worker, QThread::Priority priority)
+{
+    QMap<QString, Job>::iterator itr = m_jobs.find(key);
+    Q_ASSERT(m_jobs.end() != itr && 0 == itr->worker);
+
+    itr->worker = worker;
+    worker->setParent(this);
+    QObject::connect(worker, SIGNAL(finished()), this, SLOT(slotWorkerFinished()));
+    worker->start(priority);
+    m_ptimer->start();
+}
+
+bool JobManager::startJob(const QString &key, const DeviceInfo &dev, JobWorker *worker, QThread::Priority priority)
+{
+    if (!addJob(key, dev))
+    {
+        delete worker;
+        return false;
+    }
+
+    startWorker(key, worker, priority);
+    emit progressChanged(dev);
+    return true;
+}
+
+void JobManager::dropJob(const QString &key)
+{
+    QMap<QString, Job>::iterator itr = m_jobs.find(key);
+    if (m_jobs.end() == itr || 0 != itr->worker)
+        return;
+
+    m_jobs.erase(itr);
+    if (m_jobs.isEmpty())
+        m_ptimer->stop();
+}
+
+JobWorker *JobManager::worker(const QString &key) const
+{
+    return m_jobs.value(key).worker;
+}
+
+DeviceInfo JobManager::jobDevice(const QString &key) const
+{
+    return m_jobs.value(key).device;
+}
+
+void JobManager::deviceRemoved(const DeviceInfoPtr &dev)
+{
+    cancel(jobKey(*dev));
+}
+
+void JobManager::deviceMounted(const DeviceInfoPtr &dev, ErrorCode e)
+{
+    Q_UNUSED(dev);
+    Q_UNUSED(e);
+}
+
+void JobManager::deviceUnmounted(const DeviceInfoPtr &dev, ErrorCode e)
+{
+    if (OK == e)
+        cancel(jobKey(*dev));
+}
+
+void JobManager::slotPoll()
+{
+    foreach (const Job& job, m_jobs)
+        emit progressChanged(job.device);
+}
+
+void JobManager::slotWorkerFinished()
+{
+    JobWorker * worker = static_cast<JobWorker*>(sender());
+
+    for (QMap<QString, Job>::iterator itr = m_jobs.begin(); itr != m_jobs.end(); ++itr)
+    {
+        if (worker != itr->worker)
+            continue;
+
+        DeviceInfo dev = itr->device;
+        m_jobs.erase(itr);
+        if (m_jobs.isEmpty())
+            m_ptimer->stop();
+
+        jobFinished(dev, worker);
+        worker->deleteLater();
+        return;
+    }
+}
+
+void JobManager::slotDeviceRemoved(const DeviceInfoPtr &dev)
+{
+    deviceRemoved(dev);
+}
+
+void JobManager::slotDeviceMounted(const DeviceInfoPtr &dev, QString mount_path, ErrorCode e)
+{
+    Q_UNUSED(mount_path);
+    deviceMounted(dev, e);
+}
+
+void JobManager::slotDeviceUnmounted(const DeviceInfoPtr &dev, ErrorCode e)
+{
+    deviceUnmounted(dev, e);
+}
@@ -0,0 +1,80 @@
+#ifndef JOBMANAGER_H
+#define JOBMANAGER_H
+
+#include <QObject>
+#include <QtCore>
+
+#include "devicewatcher.h"
+
+// Thread doing the work of one job, cancel() makes run() return early.
+class JobWorker : public QThread
+{
+public:
+    explicit JobWorker(QObject * parent = 0) : QThread(parent) {}
+
+    virtual void cancel() = 0;
+};
+
+// Bookkeeping shared by the per-device background jobs: at most one job per key, progressChanged()
+// polled while any worker runs, the job cancelled when its device goes away or is unmounted, and
+// workers cancelled and waited for on destruction. Subclasses start workers and report results.
+class JobManager : public QObject
+{
+    Q_OBJECT
+public:
+    explicit JobManager(DeviceWatcher * watcher, QObject *parent = 0);
+    ~JobManager();
+
+    // Key the job of dev is kept under, its udisks path unless the job owns something larger.
+    virtual QString jobKey(const DeviceInfo& dev) const;
+
+    void cancel(const QString& key);
+    bool isRunning(const QString& key) const;
+    bool hasJob(const DeviceInfo& dev) const;
+    bool idle() const;
+
+signals:
+    void progressChanged(const DeviceInfo& dev);
+
+protected:
+    DeviceWatcher * m_pdevWatcher;
+
+    // A job without a worker yet, for preparation that happens before it starts.
+    bool addJob(const QString& key, const DeviceInfo& dev);
+    // Takes ownership of worker.
+    void startWorker(const QString& key, JobWorker * worker, QThread::Priority priority = QThread::InheritPriority);
+    bool startJob(const QString& key, const DeviceInfo& dev, JobWorker * worker,
+                  QThread::Priority priority = QThread::InheritPriority);
+    // Drops a job whose worker never started.
+    void dropJob(const QString& key);
+    JobWorker * worker(const QString& key) const;
+    DeviceInfo jobDevice(const QString& key) const;
+
+    // The job is already gone when this is called, worker is deleted afterwards.
+    virtual void jobFinished(const DeviceInfo& dev, JobWorker * worker) = 0;
+
+    virtual void deviceRemoved(const DeviceInfoPtr& dev);
+    virtual void deviceMounted(const DeviceInfoPtr& dev, ErrorCode e);
+    virtual void deviceUnmounted(const DeviceInfoPtr& dev, ErrorCode e);
+
+private slots:
+    void slotPoll();
+    void slotWorkerFinished();
+    void slotDeviceRemoved(const DeviceInfoPtr& dev);
+    void slotDeviceMounted(const DeviceInfoPtr& dev, QString mount_path, ErrorCode e);
+    void slotDeviceUnmounted(const DeviceInfoPtr& dev, ErrorCode e);
+
+private:
+    struct Job
+    {
+        Job() : worker(0) {}
+
+        DeviceInfo device;
+        JobWorker * worker;
+    };
+
+    QTimer * m_ptimer;
+    QMap<QString, Job> m_jobs;
+};
+
+#endif // JOBMANAGER_H
@@ -1,11 +1,104 @@
+#include "automountrules.h"
+#include "devicecache.h"
+#include "deviceimager.h"
+#include "imagewriter.h"
 #include "mainwindow.h"
+#include "singleinstance.h"
+#include "startupprofile.h"
 #include <QApplication>
 
+#ifdef MOUNTAIN_BENCH
+#include "devicebench.h"
+#endif
+
 int main(int argc, char *argv[])
 {
+    // Accepted anywhere on the command line and removed before the rest is parsed.
+    for (int i = 1; i < argc; ++i)
+    {
+        if (QByteArray("--profile-startup") == argv[i])
+        {
+            StartupProfile::enable();
+            for (int j = i; j < argc; ++j)
+                argv[j] = argv[j + 1];
+            --argc;
+            break;
+        }
+    }
+
+    // Headless write of an image to a device or plain file, e.g. for checking against a loop device.
+    if (4 == argc && QString("--write-image") == argv[1])
+    {
+        QCoreApplication a(argc, argv);
+        return ImageWriter::writeFromCommandLine(QString::fromLocal8Bit(argv[2]), QString::fromLocal8Bit(argv[3]));
+    }
+
+    // Headless imaging, the optional thread count makes it easy to see how compression scales.
+    if ((4 == argc || 5 == argc) && QString("--create-image") == argv[1])
+    {
+        QCoreApplication a(argc, argv);
+        return DeviceImager::createFromCommandLine(QString::fromLocal8Bit(argv[2]), QString::fromLocal8Bit(argv[3]),
+                                                   5 == argc ? atoi(argv[4]) : 0);
+    }
+
+    // System-wide device table for multi-seat machines, tray instances pick it up when it is running.
+    if (2 == argc && QString("--cache-service") == argv[1])
+    {
+        QCoreApplication a(argc, argv);
+        return DeviceCache::serveFromCommandLine();
+    }
+
+#ifdef MOUNTAIN_BENCH
+    // Store and tray menu timings against synthetic devices, menus need a widget application.
+    if ((2 == argc || 3 == argc) && QString("--bench-devices") == argv[1])
+    {
+        QApplication a(argc, argv);
+        return DeviceBench::benchmarkFromCommandLine(3 == argc ? atoi(argv[2]) : 5000);
+    }
+#endif
+
+    // Shows which automount rule fires for each device ("all") or only the one given, without mounting anything.
+    // Padding appends rules that never match to see how evaluation holds up with large rule sets.
+    if (argc >= 2 && argc <= 4 && QString("--automount-dry-run") == argv[1])
+    {
+        QCoreApplication a(argc, argv);
+        return AutomountRules::dryRunFromCommandLine(argc >= 3 ? QString::fromLocal8Bit(argv[2]) : QString(),
+                                                     4 == argc ? atoi(argv[3]) : 0);
+    }
+
+    QList<QByteArray> command;
+    if (!SingleInstance::parseCommand(argc, argv, command))
+    {
+        SingleInstance::usage();
+        return 2;
+    }
+
+    // Checked before any Qt setup, a second instance only hands its command over and leaves.
+    if (!SingleInstance::acquire())
+        return SingleInstance::forward(command);
+
     QApplication a(argc, argv);
     a.setQuitOnLastWindowClosed(false);
+    StartupProfile::mark("QApplication");
+
+    // Listening before the window is built, which enumerates every device, keeps later instances
+    // from giving up on a slow start. Their commands are held until the window can take them.
+    SingleInstance instance;
+    instance.listen();
+    StartupProfile::mark("single instance");
+
     MainWindow w;
+    QObject::connect(&instance, SIGNAL(commandReceived(QStringList)), &w, SLOT(slotCommand(QStringList)));
+    QTimer::singleShot(0, StartupProfile::finish);
+
+    if (!command.isEmpty())
+    {
+        QStringList fields;
+        foreach (const QByteArray& field, command)
+            fields << QString::fromLocal8Bit(field);
+        QMetaObject::invokeMethod(&w, "slotCommand", Qt::QueuedConnection, Q_ARG(QStringList, fields));
+    }
+    QMetaObject::invokeMethod(&instance, "deliverCommands", Qt::QueuedConnection);
 
     return a.exec();
 }
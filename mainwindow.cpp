@@ -1,6 +1,10 @@
 #include <QProcess>
+#include <QCursor>
+#include <QDesktopServices>
+#include <QFileDialog>
+#include <QUrl>
 #include "mainwindow.h"
-#include "ui_mainwindow.h"
+#include "startupprofile.h"
 
 namespace Utils
 {
@@ -21,12 +25,17 @@ QString formatDiskSize(unsigned long long s)
 
 QString getDeviceTypeStr(const DeviceInfo &d)
 {
-    //HDD, USB, FLOPPY, OPTICAL, OTHER
-    static QString dev_names[] = { "Internal disk", "USB disk", "Floppy disk", "Optical disk", "Unknown device" };
+    //HDD, USB, FLOPPY, OPTICAL, OTHER, IMAGE
+    static QString dev_names[] = { "Internal disk", "USB disk", "Floppy disk", "Optical disk", "Unknown device", "Disk image" };
     return dev_names[d.type];
 }
 
-QString formatDeviceStr(QString str, DeviceInfo dev)
+QString formatRate(double r)
+{
+    return QString::number(r, 'f', r < 10 ? 1 : 0);
+}
+
+QString formatDeviceStr(QString str, const DeviceInfo& dev, const IoStats& io = IoStats())
 {
     int from = 0;
     int f;
@@ -60,6 +69,14 @@ QString formatDeviceStr(QString str, DeviceInfo dev)
             val = dev.fileName;
         else if ("e" == spec)
             val = dev.fileSystem;
+        else if ("r" == spec)
+            val = formatRate(io.readMBps);
+        else if ("w" == spec)
+            val = formatRate(io.writeMBps);
+        else if ("o" == spec)
+            val = formatRate(io.iops);
+        else if ("q" == spec)
+            val = QString::number(io.inFlight);
         else val = getDeviceTypeStr(dev);
 
         str.remove(f, 2);
@@ -81,24 +98,31 @@ QString mapErrorText(ErrorCode err)
 }
 
 
+const int SEARCH_MIN_LENGTH = 2;
+const int SEARCH_RESULTS_LIMIT = 20;
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::MainWindow)
+    m_pSettingsDialog(0)
 {
-    ui->setupUi(this);
     setWindowFlags(Qt::Dialog | Qt::MSWindowsFixedSizeDialogHint);
     setVisible(false);
 
+    // The settings dialog is built on first use, everything else only needs the store.
+    m_psettings = new AppSettings(this);
+    m_automount = AutomountRules(AutomountRules::load(m_psettings));
+    StartupProfile::mark("settings");
+
     m_ptrayIcon = new QSystemTrayIcon(this);
-    m_pSettingsDialog = new SettingsDialog(this);
-    QObject::connect(m_pSettingsDialog, SIGNAL(settingsAccepted()), this, SLOT(slotSettingsDialogAccepted()));
 
     m_ptrayMenu = new QMenu(this);
 
     m_pactExit = new QAction("Exit", this);
+    m_pactOpenImage = new QAction("Open image...", this);
     m_pactSettings = new QAction("Settings", this);
     m_pAbout = new QAction("About", this);
     QObject::connect(m_pactExit, SIGNAL(triggered()), qApp, SLOT(quit()));
+    QObject::connect(m_pactOpenImage, SIGNAL(triggered()), this, SLOT(slotOpenImage()));
     QObject::connect(m_pactSettings, SIGNAL(triggered()), this, SLOT(slotSettingsDialog()));
     QObject::connect(m_pAbout, SIGNAL(triggered()), this, SLOT(slotAbout()));
 
@@ -106,34 +130,138 @@ MainWindow::MainWindow(QWidget *parent) :
     m_ptrayIcon->setContextMenu(m_ptrayMenu);
     m_ptrayIcon->setIcon(QIcon(":/icons/icon.png"));
     m_ptrayIcon->show();
+    m_pnotifier = new NotificationAggregator(m_ptrayIcon, this);
+    StartupProfile::mark("tray icon");
 
     m_pdevWatcher = new DeviceWatcher(this);
-    QObject::connect(m_pdevWatcher, SIGNAL(deviceAdded(DeviceInfo)), this, SLOT(slotDeviceAdded(DeviceInfo)));
-    QObject::connect(m_pdevWatcher, SIGNAL(deviceRemoved(DeviceInfo)), this, SLOT(slotDeviceRemoved(DeviceInfo)));
-    QObject::connect(m_pdevWatcher, SIGNAL(deviceChanged(DeviceInfo)), this, SLOT(slotDeviceChanged(DeviceInfo)));
-    QObject::connect(m_pdevWatcher, SIGNAL(deviceMounted(DeviceInfo, QString, ErrorCode)),
-                     this, SLOT(slotDeviceMounted(DeviceInfo, QString, ErrorCode)));
-    QObject::connect(m_pdevWatcher, SIGNAL(deviceUnmounted(DeviceInfo, ErrorCode)),
-                     this, SLOT(slotDeviceUnmounted(DeviceInfo, ErrorCode)));
+    StartupProfile::mark("device watcher");
+    m_pioMonitor = new IoMonitor(m_pdevWatcher, this);
+    m_pioMonitor->setInterval(m_psettings->get("/Settings/Monitor/SampleInterval").toInt());
+    QObject::connect(m_pioMonitor, SIGNAL(statsUpdated()), this, SLOT(slotIoStatsUpdated()));
+    QObject::connect(m_ptrayMenu, SIGNAL(aboutToShow()), this, SLOT(slotTrayMenuShown()));
+    QObject::connect(m_ptrayMenu, SIGNAL(aboutToHide()), this, SLOT(slotTrayMenuHidden()));
+
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceAdded(DeviceInfoPtr)), this, SLOT(slotDeviceAdded(DeviceInfoPtr)));
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceRemoved(DeviceInfoPtr)), this, SLOT(slotDeviceRemoved(DeviceInfoPtr)));
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceChanged(DeviceInfoPtr)), this, SLOT(slotDeviceChanged(DeviceInfoPtr)));
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceMounted(DeviceInfoPtr, QString, ErrorCode)),
+                     this, SLOT(slotDeviceMounted(DeviceInfoPtr, QString, ErrorCode)));
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceUnmounted(DeviceInfoPtr, ErrorCode)),
+                     this, SLOT(slotDeviceUnmounted(DeviceInfoPtr, ErrorCode)));
+
+    m_psafeRemover = new SafeRemover(m_pdevWatcher, this);
+    QObject::connect(m_psafeRemover, SIGNAL(progressChanged(DeviceInfo)), this, SLOT(slotFlushProgress(DeviceInfo)));
+    QObject::connect(m_psafeRemover, SIGNAL(safeToRemove(DeviceInfo)), this, SLOT(slotSafeToRemove(DeviceInfo)));
+    QObject::connect(m_psafeRemover, SIGNAL(failed(DeviceInfo, QString)), this, SLOT(slotSafeRemoveFailed(DeviceInfo, QString)));
+
+    m_psyncEngine = new SyncEngine(m_pdevWatcher, this);
+    QObject::connect(m_psyncEngine, SIGNAL(progressChanged(DeviceInfo)), this, SLOT(slotSyncProgress(DeviceInfo)));
+    QObject::connect(m_psyncEngine, SIGNAL(finished(DeviceInfo, bool, QString)), this, SLOT(slotSyncFinished(DeviceInfo, bool, QString)));
+
+    m_pverifier = new ManifestVerifier(m_pdevWatcher, this);
+    QObject::connect(m_pverifier, SIGNAL(progressChanged(DeviceInfo)), this, SLOT(slotVerifyProgress(DeviceInfo)));
+    QObject::connect(m_pverifier, SIGNAL(finished(DeviceInfo, bool, QString, QString)),
+                     this, SLOT(slotVerifyFinished(DeviceInfo, bool, QString, QString)));
+
+    m_pbenchmark = new DeviceBenchmark(m_pdevWatcher, this);
+    QObject::connect(m_pbenchmark, SIGNAL(progressChanged(DeviceInfo)), this, SLOT(slotBenchmarkProgress(DeviceInfo)));
+    QObject::connect(m_pbenchmark, SIGNAL(finished(DeviceInfo, bool, BenchmarkResult, QString)),
+                     this, SLOT(slotBenchmarkFinished(DeviceInfo, bool, BenchmarkResult, QString)));
+
+    m_pimageWriter = new ImageWriter(m_pdevWatcher, this);
+    QObject::connect(m_pimageWriter, SIGNAL(progressChanged(DeviceInfo)), this, SLOT(slotImageWriteProgress(DeviceInfo)));
+    QObject::connect(m_pimageWriter, SIGNAL(finished(DeviceInfo, bool, QString)),
+                     this, SLOT(slotImageWriteFinished(DeviceInfo, bool, QString)));
+
+    m_pimager = new DeviceImager(m_pdevWatcher, this);
+    QObject::connect(m_pimager, SIGNAL(progressChanged(DeviceInfo)), this, SLOT(slotImageCreateProgress(DeviceInfo)));
+    QObject::connect(m_pimager, SIGNAL(finished(DeviceInfo, bool, QString)),
+                     this, SLOT(slotImageCreateFinished(DeviceInfo, bool, QString)));
+
+    m_jobManagers << m_psyncEngine << m_pverifier << m_pbenchmark << m_pimageWriter << m_pimager;
+
+    m_pimageMounter = new ImageMounter(m_pdevWatcher, this);
+    QObject::connect(m_pimageMounter, SIGNAL(failed(QString, QString)), this, SLOT(slotImageMountFailed(QString, QString)));
+    QObject::connect(m_pimageMounter, SIGNAL(detached(QString)), this, SLOT(slotImageDetached(QString)));
+
+    m_pdeviceMenu = new DeviceMenu(this);
+    QObject::connect(m_pdeviceMenu, SIGNAL(populate(QMenu*, QStringList)), this, SLOT(slotPopulateDevices(QMenu*, QStringList)));
+
+    m_pindexer = new ContentIndexer(m_pdevWatcher, this);
+    QObject::connect(m_pindexer, SIGNAL(indexReady(DeviceInfo)), this, SLOT(slotIndexReady(DeviceInfo)));
+
+    m_psearchEdit = new QLineEdit();
+    m_psearchEdit->setPlaceholderText("Search mounted devices");
+    m_psearchEdit->setClearButtonEnabled(true);
+    QObject::connect(m_psearchEdit, SIGNAL(textChanged(QString)), this, SLOT(slotSearch(QString)));
+    m_pactSearch = new QWidgetAction(this);
+    m_pactSearch->setDefaultWidget(m_psearchEdit);
+    m_pactSearchSeparator = new QAction(this);
+    m_pactSearchSeparator->setSeparator(true);
+    updateIndexer();
+    StartupProfile::mark("job managers");
 
     reloadDevices();
+    StartupProfile::mark("first menu");
 }
 
 MainWindow::~MainWindow()
 {
-    delete ui;
 }
 
 void MainWindow::slotSettingsDialog()
 {
+    if (0 == m_pSettingsDialog)
+    {
+        m_pSettingsDialog = new SettingsDialog(m_psettings, this);
+        QObject::connect(m_pSettingsDialog, SIGNAL(settingsAccepted()), this, SLOT(slotSettingsDialogAccepted()));
+    }
     m_pSettingsDialog->show();
 }
 
 void MainWindow::slotSettingsDialogAccepted()
 {
+    m_automount = AutomountRules(AutomountRules::load(m_psettings));
+    updateIndexer();
+    m_pioMonitor->setInterval(m_psettings->get("/Settings/Monitor/SampleInterval").toInt());
     reloadDevices();
 }
 
+void MainWindow::slotTrayMenuShown()
+{
+    m_pioMonitor->setActive(true);
+}
+
+void MainWindow::slotTrayMenuHidden()
+{
+    m_pioMonitor->setActive(false);
+}
+
+void MainWindow::slotIoStatsUpdated()
+{
+    const AppSettings * settings = m_psettings;
+    QString menu_format = settings->get("/Settings/Actions/DeviceFormatString").toString();
+    QString tooltip_format = settings->get("/Settings/Monitor/TooltipFormatString").toString();
+    QStringList tooltip;
+
+    // Only devices whose menus were built, grouped menus fill in as they are opened.
+    for (QMap<QString, QPointer<QMenu> >::const_iterator itr = m_deviceMenus.constBegin(); itr != m_deviceMenus.constEnd(); ++itr)
+    {
+        DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->getDevice(itr.key());
+        if (0 == dev || 0 == itr.value() || deviceHasJob(dev->udisksPath))
+            continue;
+
+        IoStats io = m_pioMonitor->stats(dev->udisksPath);
+        itr.value()->setTitle(Utils::formatDeviceStr(menu_format, *dev, io));
+
+        if (io.busy())
+            tooltip << Utils::formatDeviceStr(tooltip_format, *dev, io);
+    }
+
+    if (jobsIdle())
+        m_ptrayIcon->setToolTip(tooltip.isEmpty() ? "MOUNTain" : tooltip.join("\n"));
+}
+
 void MainWindow::slotMountUnmount()
 {
     QAction * act = qobject_cast<QAction*> (sender());
@@ -144,7 +272,11 @@ void MainWindow::slotMountUnmount()
     if (0 != dev)
     {
         if (dev->isMounted)
-            m_pdevWatcher->unmountDevice(dev_path, m_pSettingsDialog->settings()->value("/Settings/Actions/ForceUnmount").toBool());
+        {
+            // The indexer's walk would keep the filesystem busy.
+            m_pindexer->dropDevice(dev_path);
+            m_pdevWatcher->unmountDevice(dev_path, m_psettings->get("/Settings/Actions/ForceUnmount").toBool());
+        }
         else m_pdevWatcher->mountDevice(dev_path);
     }
     else
@@ -152,6 +284,485 @@ void MainWindow::slotMountUnmount()
 
 }
 
+void MainWindow::slotCommand(const QStringList &command)
+{
+    QString cmd = command.value(0);
+    bool force = m_psettings->get("/Settings/Actions/ForceUnmount").toBool();
+
+    if ("show-menu" == cmd)
+    {
+        m_ptrayMenu->popup(QCursor::pos());
+    }
+    else if ("unmount-all" == cmd)
+    {
+        foreach (const DeviceWatcher::DeviceInfoPtr& dev, m_pdevWatcher->devices())
+        {
+            if (!dev->isMounted || dev->isSystem || deviceHasJob(dev->udisksPath))
+                continue;
+
+            m_pindexer->dropDevice(dev->udisksPath);
+            m_pdevWatcher->unmountDevice(dev->udisksPath, force);
+        }
+    }
+    else
+    {
+        DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->findDevice(command.value(1));
+
+        if (0 == dev)
+            m_ptrayIcon->showMessage("Unknown device", command.value(1));
+        else if ("mount" == cmd && !dev->isMounted)
+            m_pdevWatcher->mountDevice(dev->udisksPath);
+        else if ("unmount" == cmd && dev->isMounted)
+        {
+            m_pindexer->dropDevice(dev->udisksPath);
+            m_pdevWatcher->unmountDevice(dev->udisksPath, force);
+        }
+    }
+}
+
+bool MainWindow::deviceHasJob(const QString &dev_path) const
+{
+    if (m_psafeRemover->isRunning(dev_path))
+        return true;
+
+    DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->getDevice(dev_path);
+    if (0 == dev)
+        return false;
+
+    foreach (JobManager * manager, m_jobManagers)
+    {
+        if (manager->hasJob(*dev))
+            return true;
+    }
+    return false;
+}
+
+bool MainWindow::jobsIdle() const
+{
+    if (!m_psafeRemover->idle())
+        return false;
+
+    foreach (JobManager * manager, m_jobManagers)
+    {
+        if (!manager->idle())
+            return false;
+    }
+    return true;
+}
+
+void MainWindow::showJobProgress(const DeviceInfo &d, const QString &tooltip, const QString &status)
+{
+    m_ptrayIcon->setToolTip(tooltip);
+
+    QPointer<QMenu> dev_menu = m_deviceMenus.value(d.udisksPath);
+    if (0 != dev_menu)
+        dev_menu->setTitle(Utils::formatDeviceStr("%n (%f): ", d) + status);
+}
+
+void MainWindow::addCancelAction(QMenu *menu, const QString &text, JobManager *manager, const DeviceInfo &dev)
+{
+    QAction * cancel_act = new QAction(text, menu);
+    cancel_act->setData(manager->jobKey(dev));
+    cancel_act->setProperty("JobManager", QVariant::fromValue<QObject*>(manager));
+    QObject::connect(cancel_act, SIGNAL(triggered()), this, SLOT(slotCancelJob()));
+    menu->addAction(cancel_act);
+}
+
+void MainWindow::slotSafeRemove()
+{
+    QAction * act = qobject_cast<QAction*>(sender());
+    QString dev_path = act->data().toString();
+
+    DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->getDevice(dev_path);
+
+    if (0 != dev)
+    {
+        m_pindexer->dropDevice(dev_path);
+        if (m_psafeRemover->start(dev_path))
+            m_ptrayIcon->showMessage(Utils::getDeviceTypeStr(*dev) + " is being flushed",
+                                     Utils::formatDeviceStr("Writing cached data to %n (%f), do not remove it yet.", *dev));
+    }
+    else
+        qCritical() << "Unknown device passed.";
+}
+
+void MainWindow::slotFlushProgress(const DeviceInfo &d)
+{
+    FlushProgress p = m_psafeRemover->progress(d.udisksPath);
+    QString str = Utils::formatDeviceStr("Flushing %n: ", d) + QString::number(p.percent) + "%, "
+            + Utils::formatDiskSize((p.dirtyKb + p.writebackKb) * 1024) + " cached, "
+            + QString::number(p.inFlight) + " requests in flight";
+
+    showJobProgress(d, str, "flushing " + QString::number(p.percent) + "%");
+}
+
+void MainWindow::slotSafeToRemove(const DeviceInfo &d)
+{
+    m_ptrayIcon->setToolTip("MOUNTain");
+    m_ptrayIcon->showMessage(Utils::getDeviceTypeStr(d) + " can be removed",
+                             Utils::formatDeviceStr("%n (%f) is unmounted and safe to remove.", d));
+}
+
+void MainWindow::slotSafeRemoveFailed(const DeviceInfo &d, QString reason)
+{
+    m_ptrayIcon->setToolTip("MOUNTain");
+    qDebug() << "Safe remove failed! (" << d.udisksPath << ") " << reason;
+    QMessageBox::critical(this, Utils::getDeviceTypeStr(d) + " safe remove error.",
+                          Utils::formatDeviceStr("%n (%f) is not safe to remove. ", d) + reason,
+                          QMessageBox::Ok);
+    reloadDevices();
+}
+
+void MainWindow::slotCancelJob()
+{
+    QAction * act = qobject_cast<QAction*>(sender());
+    JobManager * manager = qobject_cast<JobManager*>(act->property("JobManager").value<QObject*>());
+    if (0 != manager)
+        manager->cancel(act->data().toString());
+}
+
+void MainWindow::slotSyncProgress(const DeviceInfo &d)
+{
+    SyncProgress p = m_psyncEngine->progress(d.udisksPath);
+    int percent = p.bytesTotal > 0 ? int(p.bytesDone * 100 / p.bytesTotal) : 0;
+    QString str = Utils::formatDeviceStr("Syncing %n: ", d) + QString::number(percent) + "%, "
+            + QString::number(p.filesDone) + "/" + QString::number(p.filesTotal) + " files, "
+            + Utils::formatDiskSize(p.bytesDone) + " of " + Utils::formatDiskSize(p.bytesTotal);
+
+    showJobProgress(d, str, "syncing " + QString::number(percent) + "%");
+}
+
+void MainWindow::slotSyncFinished(const DeviceInfo &d, bool ok, QString message)
+{
+    m_ptrayIcon->setToolTip("MOUNTain");
+    m_ptrayIcon->showMessage(Utils::formatDeviceStr(ok ? "%n synced" : "%n sync incomplete", d), message,
+                             ok ? QSystemTrayIcon::Information : QSystemTrayIcon::Warning);
+    reloadDevices();
+}
+
+void MainWindow::slotVerify()
+{
+    QAction * act = qobject_cast<QAction*>(sender());
+    QString dev_path = act->data().toString();
+
+    DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->getDevice(dev_path);
+
+    if (0 == dev)
+    {
+        qCritical() << "Unknown device passed.";
+        return;
+    }
+
+    QString manifest = QFileDialog::getOpenFileName(0, Utils::formatDeviceStr("Select checksum manifest for %n", *dev), dev->mountPoint,
+                                                    "Checksum manifests (*.sha256 *.sha256sum *SHA256SUMS *.xxh64 *.xxh);;All files (*)");
+    if (manifest.isEmpty())
+        return;
+
+    QString error;
+    if (!m_pverifier->start(*dev, manifest, error))
+        QMessageBox::critical(this, Utils::getDeviceTypeStr(*dev) + " verify error.", error, QMessageBox::Ok);
+    else reloadDevices();
+}
+
+void MainWindow::slotVerifyProgress(const DeviceInfo &d)
+{
+    VerifyProgress p = m_pverifier->progress(d.udisksPath);
+    int percent = p.bytesTotal > 0 ? int(p.bytesDone * 100 / p.bytesTotal) : 0;
+    QString str = Utils::formatDeviceStr("Verifying %n: ", d) + QString::number(percent) + "%, "
+            + QString::number(p.filesDone) + "/" + QString::number(p.filesTotal) + " files, "
+            + Utils::formatDiskSize(p.bytesDone) + " of " + Utils::formatDiskSize(p.bytesTotal);
+
+    showJobProgress(d, str, "verifying " + QString::number(percent) + "%");
+}
+
+void MainWindow::slotVerifyFinished(const DeviceInfo &d, bool ok, QString summary, QString report_path)
+{
+    m_ptrayIcon->setToolTip("MOUNTain");
+
+    if (ok)
+        m_ptrayIcon->showMessage(Utils::formatDeviceStr("%n verified", d), summary);
+    else
+        QMessageBox::warning(this, Utils::formatDeviceStr("%n verification failed", d),
+                             summary + (report_path.isEmpty() ? QString() : "\nReport: " + report_path),
+                             QMessageBox::Ok);
+    reloadDevices();
+}
+
+void MainWindow::slotBenchmark()
+{
+    QAction * act = qobject_cast<QAction*>(sender());
+    QString dev_path = act->data().toString();
+    bool raw = act->property("Raw").toBool();
+
+    DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->getDevice(dev_path);
+
+    if (0 == dev)
+    {
+        qCritical() << "Unknown device passed.";
+        return;
+    }
+
+    QString error;
+    const AppSettings * settings = m_psettings;
+    if (!m_pbenchmark->start(*dev, raw, settings->get("/Settings/Benchmark/SizeMB").toInt(),
+                             settings->get("/Settings/Benchmark/QueueDepth").toInt(), error))
+        QMessageBox::critical(this, Utils::getDeviceTypeStr(*dev) + " benchmark error.", error, QMessageBox::Ok);
+    else reloadDevices();
+}
+
+void MainWindow::slotBenchmarkProgress(const DeviceInfo &d)
+{
+    QString stage = m_pbenchmark->stage(d.udisksPath);
+    showJobProgress(d, Utils::formatDeviceStr("Benchmarking %n: ", d) + stage, "benchmarking");
+}
+
+void MainWindow::slotBenchmarkFinished(const DeviceInfo &d, bool ok, BenchmarkResult result, QString error)
+{
+    m_ptrayIcon->setToolTip("MOUNTain");
+    reloadDevices();
+
+    if (!ok)
+    {
+        QMessageBox::critical(this, Utils::getDeviceTypeStr(d) + " benchmark error.", error, QMessageBox::Ok);
+        return;
+    }
+
+    QList<BenchmarkResult> runs = d.uuid.isEmpty() ? QList<BenchmarkResult>() << result : DeviceBenchmark::history(d.uuid);
+    QString text = "<table cellspacing=\"6\"><tr><th>Date</th><th>Mode</th><th>Seq read</th><th>Seq write</th>"
+                   "<th>4K read</th><th>4K write</th><th>4K read p50/p99</th><th>4K write p50/p99</th></tr>";
+
+    // Newest first, that's the run that was just made.
+    for (int i = runs.size() - 1; i >= 0; --i)
+    {
+        const BenchmarkResult& r = runs.at(i);
+        text += "<tr><td>" + r.when.toString("yyyy-MM-dd hh:mm") + "</td>"
+                + "<td>" + (r.raw ? "raw" : "file") + (r.direct ? "" : ", cached") + ", QD" + QString::number(r.queueDepth) + "</td>"
+                + "<td>" + QString::number(r.seqReadMBps, 'f', 1) + " MB/s</td>"
+                + "<td>" + (r.raw ? QString("-") : QString::number(r.seqWriteMBps, 'f', 1) + " MB/s") + "</td>"
+                + "<td>" + QString::number(r.randReadIops, 'f', 0) + " IOPS</td>"
+                + "<td>" + (r.raw ? QString("-") : QString::number(r.randWriteIops, 'f', 0) + " IOPS") + "</td>"
+                + "<td>" + QString::number(r.randReadLatency.p50) + "/" + QString::number(r.randReadLatency.p99) + " us</td>"
+                + "<td>" + (r.raw ? QString("-") : QString::number(r.randWriteLatency.p50) + "/"
+                                    + QString::number(r.randWriteLatency.p99) + " us") + "</td></tr>";
+    }
+    text += "</table>";
+
+    QMessageBox::information(this, Utils::formatDeviceStr("%n (%u) benchmark", d), text, QMessageBox::Ok);
+}
+
+void MainWindow::slotWriteImage()
+{
+    QAction * act = qobject_cast<QAction*>(sender());
+    DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->getDevice(act->data().toString());
+
+    if (0 == dev)
+    {
+        qCritical() << "Unknown device passed.";
+        return;
+    }
+
+    QString image = QFileDialog::getOpenFileName(this, "Choose image", QDir::homePath(),
+                                                 "Disk images (*.iso *.img *.bin *.raw *.mimg);;All files (*)");
+    if (image.isEmpty())
+        return;
+
+    DeviceWatcher::DeviceInfoPtr drive = m_pdevWatcher->getDevice(dev->drivePath);
+    QString size = 0 != drive ? Utils::formatDeviceStr(" (%s)", *drive) : QString();
+
+    if (QMessageBox::Yes != QMessageBox::warning(this, "Write image",
+                                                 "Everything on " + dev->driveFile + size + " will be overwritten with "
+                                                 + QFileInfo(image).fileName() + ". Continue?",
+                                                 QMessageBox::Yes | QMessageBox::No, QMessageBox::No))
+        return;
+
+    QString error;
+    if (!m_pimageWriter->start(*dev, image, error))
+    {
+        QMessageBox::critical(this, Utils::getDeviceTypeStr(*dev) + " image write error.", error, QMessageBox::Ok);
+        return;
+    }
+
+    // The whole drive is rewritten, none of its partitions can stay indexed.
+    foreach (const DeviceWatcher::DeviceInfoPtr& part, m_pdevWatcher->drivePartitions(dev->drivePath))
+        m_pindexer->dropDevice(part->udisksPath);
+    reloadDevices();
+}
+
+void MainWindow::slotImageWriteProgress(const DeviceInfo &d)
+{
+    ImageWriteProgress p = m_pimageWriter->progress(d.drivePath);
+    int percent = p.bytesTotal > 0 ? p.bytesDone * 100 / p.bytesTotal : 0;
+
+    QString status;
+    switch (p.phase)
+    {
+    case ImageWriteProgress::Preparing:
+        status = "unmounting";
+        break;
+    case ImageWriteProgress::Writing:
+        status = "writing " + QString::number(percent) + "%";
+        break;
+    default:
+        status = "verifying " + QString::number(percent) + "%";
+    }
+
+    QString str = "Image to " + d.driveFile + ": " + status;
+    if (ImageWriteProgress::Preparing != p.phase)
+        str += ", " + Utils::formatRate(p.mbps) + " MB/s";
+    showJobProgress(d, str, status);
+}
+
+void MainWindow::slotImageWriteFinished(const DeviceInfo &d, bool ok, QString message)
+{
+    m_ptrayIcon->setToolTip("MOUNTain");
+
+    if (ok)
+        m_ptrayIcon->showMessage("Image written", message);
+    else
+        QMessageBox::critical(this, Utils::getDeviceTypeStr(d) + " image write error.", message, QMessageBox::Ok);
+    reloadDevices();
+}
+
+void MainWindow::slotCreateImage()
+{
+    QAction * act = qobject_cast<QAction*>(sender());
+    DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->getDevice(act->data().toString());
+
+    if (0 == dev)
+    {
+        qCritical() << "Unknown device passed.";
+        return;
+    }
+
+    // The whole drive is imaged, whichever of its partitions the menu was opened on.
+    QString name = QFileInfo(dev->driveFile.isEmpty() ? dev->fileName : dev->driveFile).fileName()
+            + QDate::currentDate().toString("-yyyyMMdd") + ".mimg";
+    QString filter;
+    QString output = QFileDialog::getSaveFileName(this, "Save image of " + (dev->driveFile.isEmpty() ? dev->fileName : dev->driveFile),
+                                                  QDir::homePath() + "/" + name,
+                                                  "Compressed image (*.mimg);;Sparse raw image (*.img)", &filter);
+    if (output.isEmpty())
+        return;
+
+    // The suffix picks the format, so make sure there is one.
+    QString suffix = QFileInfo(output).suffix();
+    if ("mimg" != suffix && "img" != suffix && "raw" != suffix)
+        output += filter.startsWith("Sparse") ? ".img" : ".mimg";
+
+    QString error;
+    if (!m_pimager->start(*dev, output, error))
+        QMessageBox::critical(this, Utils::getDeviceTypeStr(*dev) + " imaging error.", error, QMessageBox::Ok);
+    else reloadDevices();
+}
+
+void MainWindow::slotImageCreateProgress(const DeviceInfo &d)
+{
+    ImageCreateProgress p = m_pimager->progress(m_pimager->jobKey(d));
+    int percent = p.bytesTotal > 0 ? p.bytesDone * 100 / p.bytesTotal : 0;
+
+    QString status = "imaging " + QString::number(percent) + "%";
+    showJobProgress(d, "Imaging " + (d.driveFile.isEmpty() ? d.fileName : d.driveFile) + ": " + QString::number(percent) + "%, "
+                    + Utils::formatRate(p.mbps) + " MB/s", status);
+}
+
+void MainWindow::slotImageCreateFinished(const DeviceInfo &d, bool ok, QString message)
+{
+    m_ptrayIcon->setToolTip("MOUNTain");
+
+    if (ok)
+        m_ptrayIcon->showMessage(Utils::formatDeviceStr("Image of %n created", d), message);
+    else
+        QMessageBox::critical(this, Utils::getDeviceTypeStr(d) + " imaging error.", message, QMessageBox::Ok);
+    reloadDevices();
+}
+
+void MainWindow::slotOpenImage()
+{
+    QString file = QFileDialog::getOpenFileName(this, "Open image", QDir::homePath(),
+                                                "Disk images (*.iso *.img *.bin *.raw);;All files (*)");
+    if (file.isEmpty())
+        return;
+
+    ImageProbe probe = m_pimageMounter->probe(file);
+
+    if (ImageProbe::Unknown == probe.kind
+            && QMessageBox::Yes != QMessageBox::question(this, "Open image",
+                                                         QFileInfo(file).fileName() + " doesn't look like a disk or filesystem "
+                                                         "image. Attach it anyway?",
+                                                         QMessageBox::Yes | QMessageBox::No, QMessageBox::No))
+        return;
+
+    qDebug() << "Opening " << file << " (" << probe.description << ")";
+
+    QString error;
+    if (!m_pimageMounter->open(file, probe, error))
+        QMessageBox::critical(this, "Image open error.", error, QMessageBox::Ok);
+}
+
+void MainWindow::slotDetachImage()
+{
+    QAction * act = qobject_cast<QAction*>(sender());
+    m_pimageMounter->detach(act->data().toString());
+}
+
+void MainWindow::slotImageMountFailed(QString file, QString message)
+{
+    // An image left attached without filesystems gets its detach entry in the tray menu.
+    reloadDevices();
+    QMessageBox::critical(this, "Image error.", QFileInfo(file).fileName() + ": " + message, QMessageBox::Ok);
+}
+
+void MainWindow::slotImageDetached(QString file)
+{
+    if (!file.isEmpty())
+        m_ptrayIcon->showMessage("Image detached", QFileInfo(file).fileName());
+    reloadDevices();
+}
+
+void MainWindow::updateIndexer()
+{
+    m_pindexer->setEnabled(m_psettings->get("/Settings/Index/Enabled").toBool());
+
+    if (m_pindexer->enabled())
+    {
+        foreach (const DeviceWatcher::DeviceInfoPtr& dev, m_pdevWatcher->devices())
+        {
+            if (dev->isMounted)
+                m_pindexer->addDevice(*dev, dev->mountPoint);
+        }
+    }
+}
+
+void MainWindow::slotIndexReady(const DeviceInfo &d)
+{
+    m_psearchEdit->setToolTip(m_pindexer->memoryReport());
+}
+
+void MainWindow::slotSearch(QString text)
+{
+    qDeleteAll(m_searchResults);
+    m_searchResults.clear();
+
+    if (text.trimmed().size() < SEARCH_MIN_LENGTH)
+        return;
+
+    foreach (const QString& path, m_pindexer->search(text.trimmed(), SEARCH_RESULTS_LIMIT))
+    {
+        QAction * act = new QAction(path.mid(path.lastIndexOf("/") + 1), this);
+        act->setData(path);
+        act->setToolTip(path);
+        QObject::connect(act, SIGNAL(triggered()), this, SLOT(slotOpenSearchResult()));
+        m_ptrayMenu->insertAction(m_pactSearchSeparator, act);
+        m_searchResults.append(act);
+    }
+}
+
+void MainWindow::slotOpenSearchResult()
+{
+    QAction * act = qobject_cast<QAction*>(sender());
+    QDesktopServices::openUrl(QUrl::fromLocalFile(act->data().toString()));
+}
+
 void MainWindow::slotView()
 {
     QAction * act = qobject_cast<QAction*>(sender());
@@ -161,7 +772,7 @@ void MainWindow::slotView()
 
     if (0 != dev)
     {
-        QString str = Utils::formatDeviceStr(m_pSettingsDialog->settings()->value("/Settings/Actions/ViewCommand").toString(),
+        QString str = Utils::formatDeviceStr(m_psettings->get("/Settings/Actions/ViewCommand").toString(),
                                                         *dev);
         QProcess::execute(str);
     }
@@ -169,73 +780,126 @@ void MainWindow::slotView()
        qCritical() << "Unknown device passed.";
 }
 
-void MainWindow::slotDeviceAdded(const DeviceInfo &d)
+void MainWindow::slotDeviceAdded(const DeviceInfoPtr &dev)
 {
-    if (m_pSettingsDialog->settings()->value("/Settings/Notifications/ShowAdded").toBool())
-        m_ptrayIcon->showMessage(Utils::getDeviceTypeStr(d) + " connected.", Utils::formatDeviceStr("%n (%f)", d));
+    if (m_psettings->get("/Settings/Notifications/ShowAdded").toBool())
+        m_pnotifier->post(NotificationAggregator::Added, *dev, Utils::getDeviceTypeStr(*dev),
+                          Utils::getDeviceTypeStr(*dev) + " connected.", Utils::formatDeviceStr("%n (%f)", *dev));
 
-    if (m_pSettingsDialog->settings()->value("/Settings/Actions/MountAdded").toBool())
-        m_pdevWatcher->mountDevice(d.udisksPath);
+    if (!m_pimageMounter->owns(*dev))
+    {
+        // Without a matching rule the global checkbox decides, as before rules existed.
+        int fired = m_automount.match(*dev);
+        if (fired < 0)
+        {
+            if (m_psettings->get("/Settings/Actions/MountAdded").toBool())
+                m_pdevWatcher->mountDevice(dev->udisksPath);
+        }
+        else if (AutomountRule::Ignore != m_automount.rule(fired).action)
+        {
+            m_automountActions.insert(dev->udisksPath, m_automount.rule(fired).action);
+            m_pdevWatcher->mountDevice(dev->udisksPath, m_automount.rule(fired).options);
+        }
+    }
 
     reloadDevices();
 }
 
-void MainWindow::slotDeviceRemoved(const DeviceInfo &d)
+void MainWindow::slotDeviceRemoved(const DeviceInfoPtr &dev)
 {
-    if (m_pSettingsDialog->settings()->value("/Settings/Notifications/ShowRemoved").toBool())
-        m_ptrayIcon->showMessage(Utils::getDeviceTypeStr(d) + " disconnected",  Utils::formatDeviceStr("%n (%f)", d));
+    m_automountActions.remove(dev->udisksPath);
+    if (m_psettings->get("/Settings/Notifications/ShowRemoved").toBool())
+        m_pnotifier->post(NotificationAggregator::Removed, *dev, Utils::getDeviceTypeStr(*dev),
+                          Utils::getDeviceTypeStr(*dev) + " disconnected", Utils::formatDeviceStr("%n (%f)", *dev));
     reloadDevices();
 }
 
-void MainWindow::slotDeviceChanged(const DeviceInfo &d)
+void MainWindow::slotDeviceChanged(const DeviceInfoPtr &dev)
 {
+    m_pioMonitor->poke(dev->udisksPath);
     reloadDevices();
 }
 
-void MainWindow::slotDeviceMounted(const DeviceInfo &d, QString mount_path, ErrorCode err_code)
+void MainWindow::slotDeviceMounted(const DeviceInfoPtr &dev, QString mount_path, ErrorCode err_code)
 {
+    // Mounts from the menu and automounts without a matching rule have no entry and keep the
+    // global behaviour: view command as configured, sync jobs run.
+    bool ruled = m_automountActions.contains(dev->udisksPath);
+    AutomountRule::Action action = m_automountActions.take(dev->udisksPath);
+
     if (OK != err_code)
     {
-        qDebug() << "Mounting error! (" << d.udisksPath << ") " << Utils::mapErrorText(err_code);
-        QMessageBox::critical(this, Utils::getDeviceTypeStr(d) + " mount error.",
+        qDebug() << "Mounting error! (" << dev->udisksPath << ") " << Utils::mapErrorText(err_code);
+        QMessageBox::critical(this, Utils::getDeviceTypeStr(*dev) + " mount error.",
                               "Device can't be mounted. " + Utils::mapErrorText(err_code),
                               QMessageBox::Ok);
         return;
     }
 
-    qDebug() << d.udisksPath << " mounted to " << mount_path;
+    qDebug() << dev->udisksPath << " mounted to " << mount_path;
+    m_pioMonitor->poke(dev->udisksPath);
 
-    if (m_pSettingsDialog->settings()->value("/Settings/Notifications/ShowMounted").toBool())
-        m_ptrayIcon->showMessage(Utils::getDeviceTypeStr(d) + " mounted",
-                                 Utils::formatDeviceStr("%n (%f) mounted to %m", d));
+    if (m_psettings->get("/Settings/Notifications/ShowMounted").toBool())
+    {
+        DeviceInfo mounted = *dev;
+        mounted.mountPoint = mount_path;
+        m_pnotifier->post(NotificationAggregator::Mounted, mounted, Utils::getDeviceTypeStr(*dev),
+                          Utils::getDeviceTypeStr(*dev) + " mounted", Utils::formatDeviceStr("%n (%f) mounted to %m", mounted));
+    }
 
-    if (m_pSettingsDialog->settings()->value("/Settings/Actions/ExecuteViewMounted").toBool())
+    if (AutomountRule::OpenView == action
+            || ((!ruled || AutomountRule::Mount == action) && m_psettings->get("/Settings/Actions/ExecuteViewMounted").toBool()))
     {
-        QString command = Utils::formatDeviceStr(m_pSettingsDialog->settings()->value("/Settings/Actions/ViewCommand").toString(),
-                                                 d);
+        QString command = Utils::formatDeviceStr(m_psettings->get("/Settings/Actions/ViewCommand").toString(),
+                                                 *dev);
         QProcess::execute(command);
     }
 
+    // A rule picks its one follow-up; only Sync rules start the device's sync jobs.
+    if (!ruled || AutomountRule::Sync == action)
+    {
+        QList<SyncJobConfig> jobs = SyncEngine::jobsForDevice(m_psettings, dev->uuid);
+        if (ruled && jobs.isEmpty())
+            qWarning() << "Automount rule asks for a sync, but no sync job is set up for " << dev->uuid;
+        m_psyncEngine->start(*dev, mount_path, jobs);
+    }
+    m_pindexer->addDevice(*dev, mount_path);
+
     reloadDevices();
 }
 
-void MainWindow::slotDeviceUnmounted(const DeviceInfo &d, ErrorCode err_code)
+void MainWindow::slotDeviceUnmounted(const DeviceInfoPtr &dev, ErrorCode err_code)
 {
+    if (m_psafeRemover->isRunning(dev->udisksPath))
+    {
+        // SafeRemover reports the outcome itself.
+        reloadDevices();
+        return;
+    }
+
     if (OK == err_code)
     {
-       if (m_pSettingsDialog->settings()->value("/Settings/Notifications/ShowUnmounted").toBool())
-        m_ptrayIcon->showMessage(Utils::getDeviceTypeStr(d) + " unmounted",
-                                     Utils::formatDeviceStr("%n (%f) unmounted", d));
+       if (m_psettings->get("/Settings/Notifications/ShowUnmounted").toBool())
+        m_pnotifier->post(NotificationAggregator::Unmounted, *dev, Utils::getDeviceTypeStr(*dev),
+                          Utils::getDeviceTypeStr(*dev) + " unmounted", Utils::formatDeviceStr("%n (%f) unmounted", *dev));
        reloadDevices();
+
+       // Once the last filesystem of an image is unmounted its loop device is no longer needed.
+       if (DeviceInfo::IMAGE == dev->type && !deviceHasJob(dev->udisksPath) && m_pimageMounter->canDetach(dev->drivePath)
+               && QMessageBox::Yes == QMessageBox::question(this, "Detach image",
+                                                            "Detach " + QFileInfo(dev->imageFile).fileName()
+                                                            + " from " + dev->driveFile + "?",
+                                                            QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes))
+           m_pimageMounter->detach(dev->drivePath);
     }
     else if (Busy == err_code)
     {
-        qDebug() << "Device " + d.udisksPath + " busy.";
+        qDebug() << "Device " + dev->udisksPath + " busy.";
     }
     else
     {
-        qDebug() << "Unmounting error! (" << d.udisksPath << ") " << Utils::mapErrorText(err_code);
-        QMessageBox::critical(this, Utils::getDeviceTypeStr(d) + " unmount error.",
+        qDebug() << "Unmounting error! (" << dev->udisksPath << ") " << Utils::mapErrorText(err_code);
+        QMessageBox::critical(this, Utils::getDeviceTypeStr(*dev) + " unmount error.",
                               "Device can't be unmounted. " + Utils::mapErrorText(err_code),
                               QMessageBox::Ok);
         return;
@@ -261,38 +925,38 @@ void MainWindow::reloadDevices()
     else
     {
         m_ptrayMenu->clear();
+        m_deviceMenus.clear();
+
+        if (m_pindexer->enabled())
+        {
+            m_ptrayMenu->addAction(m_pactSearch);
+            m_ptrayMenu->addActions(m_searchResults);
+            m_ptrayMenu->addAction(m_pactSearchSeparator);
+        }
 
-        bool show_system = m_pSettingsDialog->settings()->value("/Settings/Actions/ShowSystemInternal").toBool();
+        bool show_system = m_psettings->get("/Settings/Actions/ShowSystemInternal").toBool();
 
+        QVector<DeviceWatcher::DeviceInfoPtr> visible;
         foreach (const DeviceWatcher::DeviceInfoPtr& dev, m_pdevWatcher->devices())
         {
-           if (!show_system && dev->isSystem)
+            if (!show_system && dev->isSystem && !m_pimageMounter->isAttached(dev->drivePath))
                 continue;
-
-           QString str = Utils::formatDeviceStr(m_pSettingsDialog->settings()->value("/Settings/Actions/DeviceFormatString").toString(),
-                                                *dev);
-
-           QMenu * dev_menu = new QMenu(str, m_ptrayMenu);
-
-           QAction * mnt_act = new QAction(this);
-           mnt_act->setText( dev->isMounted ? "Unmount" : "Mount" );
-           mnt_act->setData(dev->udisksPath);
-           QObject::connect(mnt_act, SIGNAL(triggered()), this, SLOT(slotMountUnmount()));
-           dev_menu->addAction(mnt_act);
-
-           if (dev->isMounted)
-           {
-               QAction * view_act = new QAction("View", this);
-               view_act->setData(dev->udisksPath);
-               QObject::connect(view_act, SIGNAL(triggered()), this, SLOT(slotView()));
-               dev_menu->addAction(view_act);
-           }
-
-           m_ptrayMenu->addMenu(dev_menu);
-
+            visible << dev;
         }
 
+        m_pdeviceMenu->build(m_ptrayMenu, visible);
+        m_pioMonitor->setWatched(m_deviceMenus.keys().toSet());
+
         m_ptrayMenu->addSeparator();
+        QMap<QString, QString> unrecognised = m_pimageMounter->unrecognised();
+        for (QMap<QString, QString>::const_iterator itr = unrecognised.begin(); itr != unrecognised.end(); ++itr)
+        {
+            QAction * detach_act = new QAction("Detach " + QFileInfo(itr.value()).fileName(), m_ptrayMenu);
+            detach_act->setData(itr.key());
+            QObject::connect(detach_act, SIGNAL(triggered()), this, SLOT(slotDetachImage()));
+            m_ptrayMenu->addAction(detach_act);
+        }
+        m_ptrayMenu->addAction(m_pactOpenImage);
         m_ptrayMenu->addAction(m_pactSettings);
         m_ptrayMenu->addSeparator();
         m_ptrayMenu->addAction(m_pAbout);
@@ -301,3 +965,105 @@ void MainWindow::reloadDevices()
 
     }
 }
+
+QMenu *MainWindow::buildDeviceMenu(const DeviceInfo &dev, QMenu *parent)
+{
+    QString str = Utils::formatDeviceStr(m_psettings->get("/Settings/Actions/DeviceFormatString").toString(),
+                                         dev, m_pioMonitor->stats(dev.udisksPath));
+
+    QMenu * dev_menu = new QMenu(str, parent);
+
+    QAction * mnt_act = new QAction(dev_menu);
+    mnt_act->setText( dev.isMounted ? "Unmount" : "Mount" );
+    mnt_act->setData(dev.udisksPath);
+    QObject::connect(mnt_act, SIGNAL(triggered()), this, SLOT(slotMountUnmount()));
+    dev_menu->addAction(mnt_act);
+
+    if (dev.isMounted)
+    {
+        QAction * view_act = new QAction("View", dev_menu);
+        view_act->setData(dev.udisksPath);
+        QObject::connect(view_act, SIGNAL(triggered()), this, SLOT(slotView()));
+        dev_menu->addAction(view_act);
+
+        if (m_pverifier->hasJob(dev))
+            addCancelAction(dev_menu, "Cancel verify", m_pverifier, dev);
+        else
+        {
+            QAction * verify_act = new QAction("Verify...", dev_menu);
+            verify_act->setData(dev.udisksPath);
+            QObject::connect(verify_act, SIGNAL(triggered()), this, SLOT(slotVerify()));
+            dev_menu->addAction(verify_act);
+        }
+
+        if (m_psyncEngine->hasJob(dev))
+            addCancelAction(dev_menu, "Cancel sync", m_psyncEngine, dev);
+
+        QAction * remove_act = new QAction("Safe remove", dev_menu);
+        remove_act->setData(dev.udisksPath);
+        remove_act->setEnabled(!deviceHasJob(dev.udisksPath));
+        QObject::connect(remove_act, SIGNAL(triggered()), this, SLOT(slotSafeRemove()));
+        dev_menu->addAction(remove_act);
+    }
+
+    if (m_pimageWriter->hasJob(dev))
+        addCancelAction(dev_menu, "Cancel image write", m_pimageWriter, dev);
+    else if (!dev.isSystem && !deviceHasJob(dev.udisksPath))
+    {
+        QAction * write_act = new QAction("Write image...", dev_menu);
+        write_act->setData(dev.udisksPath);
+        QObject::connect(write_act, SIGNAL(triggered()), this, SLOT(slotWriteImage()));
+        dev_menu->addAction(write_act);
+    }
+
+    if (m_pimager->hasJob(dev))
+        addCancelAction(dev_menu, "Cancel imaging", m_pimager, dev);
+    else if (!deviceHasJob(dev.udisksPath))
+    {
+        QAction * create_act = new QAction("Create image...", dev_menu);
+        create_act->setData(dev.udisksPath);
+        create_act->setEnabled(!dev.isMounted);
+        QObject::connect(create_act, SIGNAL(triggered()), this, SLOT(slotCreateImage()));
+        dev_menu->addAction(create_act);
+    }
+
+    if (DeviceInfo::IMAGE == dev.type && !dev.isMounted && m_pimageMounter->canDetach(dev.drivePath))
+    {
+        QAction * detach_act = new QAction("Detach image", dev_menu);
+        detach_act->setData(dev.drivePath);
+        QObject::connect(detach_act, SIGNAL(triggered()), this, SLOT(slotDetachImage()));
+        dev_menu->addAction(detach_act);
+    }
+
+    if (m_pbenchmark->hasJob(dev))
+        addCancelAction(dev_menu, "Cancel benchmark", m_pbenchmark, dev);
+    else if (!deviceHasJob(dev.udisksPath))
+    {
+        QMenu * bench_menu = dev_menu->addMenu("Benchmark");
+
+        if (dev.isMounted)
+        {
+            QAction * fs_act = bench_menu->addAction("Filesystem (read/write)", this, SLOT(slotBenchmark()));
+            fs_act->setData(dev.udisksPath);
+            fs_act->setProperty("Raw", false);
+        }
+
+        QAction * raw_act = bench_menu->addAction("Raw device (read-only)", this, SLOT(slotBenchmark()));
+        raw_act->setData(dev.udisksPath);
+        raw_act->setProperty("Raw", true);
+    }
+
+    m_deviceMenus.insert(dev.udisksPath, dev_menu);
+    return dev_menu;
+}
+
+void MainWindow::slotPopulateDevices(QMenu *menu, const QStringList &dev_paths)
+{
+    foreach (const QString& path, dev_paths)
+    {
+        DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->getDevice(path);
+        if (0 != dev)
+            menu->addMenu(buildDeviceMenu(*dev, menu));
+    }
+    m_pioMonitor->setWatched(m_deviceMenus.keys().toSet());
+}
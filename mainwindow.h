@@ -6,13 +6,24 @@
 #include <QMenu>
 #include <QApplication>
 #include <QMessageBox>
+#include <QLineEdit>
+#include <QWidgetAction>
 
+#include "appsettings.h"
+#include "automountrules.h"
+#include "contentindexer.h"
+#include "devicebenchmark.h"
+#include "devicemenu.h"
+#include "deviceimager.h"
 #include "devicewatcher.h"
+#include "imagemounter.h"
+#include "imagewriter.h"
+#include "iomonitor.h"
+#include "manifestverifier.h"
+#include "notificationaggregator.h"
+#include "saferemover.h"
 #include "settingsdialog.h"
-
-namespace Ui {
-class MainWindow;
-}
+#include "syncengine.h"
 
 class MainWindow : public QMainWindow
 {
@@ -21,29 +32,90 @@ class MainWindow : public QMainWindow
 public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
+
+public slots:
+    void slotCommand(const QStringList& command);
+
 private:
-    Ui::MainWindow *ui;
     QSystemTrayIcon * m_ptrayIcon;
+    NotificationAggregator * m_pnotifier;
+    AppSettings * m_psettings;
     SettingsDialog * m_pSettingsDialog;
+    AutomountRules m_automount;
+    // Rule action of automounts still in flight, keyed by device path.
+    QHash<QString, AutomountRule::Action> m_automountActions;
 
     QMenu * m_ptrayMenu;
     DeviceWatcher * m_pdevWatcher;
+    IoMonitor * m_pioMonitor;
+    SafeRemover * m_psafeRemover;
+    SyncEngine * m_psyncEngine;
+    ManifestVerifier * m_pverifier;
+    DeviceBenchmark * m_pbenchmark;
+    ImageWriter * m_pimageWriter;
+    DeviceImager * m_pimager;
+    QList<JobManager*> m_jobManagers;
+    ImageMounter * m_pimageMounter;
+    ContentIndexer * m_pindexer;
+    QLineEdit * m_psearchEdit;
+    QWidgetAction * m_pactSearch;
+    QAction * m_pactSearchSeparator;
+    QList<QAction*> m_searchResults;
+    DeviceMenu * m_pdeviceMenu;
+    QMap<QString, QPointer<QMenu> > m_deviceMenus;
     QAction * m_pactExit;
+    QAction * m_pactOpenImage;
     QAction * m_pactSettings;
     QAction * m_pAbout;
 
     void reloadDevices();
+    QMenu * buildDeviceMenu(const DeviceInfo& dev, QMenu * parent);
+    void updateIndexer();
+    bool deviceHasJob(const QString& dev_path) const;
+    bool jobsIdle() const;
+    void showJobProgress(const DeviceInfo& d, const QString& tooltip, const QString& status);
+    void addCancelAction(QMenu * menu, const QString& text, JobManager * manager, const DeviceInfo& dev);
 
 private slots:
     void slotSettingsDialog();
     void slotSettingsDialogAccepted();
+    void slotTrayMenuShown();
+    void slotTrayMenuHidden();
+    void slotIoStatsUpdated();
+    void slotPopulateDevices(QMenu * menu, const QStringList& dev_paths);
     void slotMountUnmount();
     void slotView();
-    void slotDeviceAdded(const DeviceInfo& d);
-    void slotDeviceRemoved(const DeviceInfo& d);
-    void slotDeviceChanged(const DeviceInfo& d);
-    void slotDeviceMounted(const DeviceInfo& d, QString mount_path, ErrorCode err_code);
-    void slotDeviceUnmounted(const DeviceInfo& d, ErrorCode err_code);
+    void slotSafeRemove();
+    void slotFlushProgress(const DeviceInfo& d);
+    void slotSafeToRemove(const DeviceInfo& d);
+    void slotSafeRemoveFailed(const DeviceInfo& d, QString reason);
+    void slotCancelJob();
+    void slotSyncProgress(const DeviceInfo& d);
+    void slotSyncFinished(const DeviceInfo& d, bool ok, QString message);
+    void slotVerify();
+    void slotVerifyProgress(const DeviceInfo& d);
+    void slotVerifyFinished(const DeviceInfo& d, bool ok, QString summary, QString report_path);
+    void slotBenchmark();
+    void slotBenchmarkProgress(const DeviceInfo& d);
+    void slotBenchmarkFinished(const DeviceInfo& d, bool ok, BenchmarkResult result, QString error);
+    void slotWriteImage();
+    void slotImageWriteProgress(const DeviceInfo& d);
+    void slotImageWriteFinished(const DeviceInfo& d, bool ok, QString message);
+    void slotCreateImage();
+    void slotImageCreateProgress(const DeviceInfo& d);
+    void slotImageCreateFinished(const DeviceInfo& d, bool ok, QString message);
+    void slotOpenImage();
+    void slotDetachImage();
+    void slotImageMountFailed(QString file, QString message);
+    void slotImageDetached(QString file);
+    void slotIndexReady(const DeviceInfo& d);
+    void slotSearch(QString text);
+    void slotOpenSearchResult();
+    void slotDeviceAdded(const DeviceInfoPtr& dev);
+    void slotDeviceRemoved(const DeviceInfoPtr& dev);
+    void slotDeviceChanged(const DeviceInfoPtr& dev);
+    void slotDeviceMounted(const DeviceInfoPtr& dev, QString mount_path, ErrorCode err_code);
+    void slotDeviceUnmounted(const DeviceInfoPtr& dev, ErrorCode err_code);
     void slotAbout();
 
 };
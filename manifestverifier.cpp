@@ -0,0 +1,413 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "manifestverifier.h"
+
+const int MAX_HASH_THREADS = 8;
+const size_t HASH_CHUNK = 4 * 1024 * 1024;
+const size_t BUFFER_ALIGNMENT = 4096;
+
+namespace
+{
+// Both paths absolute and clean.
+bool isUnder(const QString& root, const QString& path)
+{
+    return path == root || path.startsWith(root.endsWith('/') ? root : root + '/');
+}
+}
+
+class VerifyWorker : public JobWorker
+{
+public:
+    enum Status
+    {
+        Pending, Matched, Mismatched, Missing, ReadError
+    };
+
+    struct Result
+    {
+        Result() : status(Pending) {}
+
+        Status status;
+        QByteArray actual;
+    };
+
+    VerifyWorker(const QString& manifest, const QString& root, Hasher::Algorithm algorithm,
+                 const QList<ManifestEntry>& entries, QObject * parent) :
+        JobWorker(parent), m_manifest(manifest), m_root(root), m_algorithm(algorithm), m_entries(entries.toVector()),
+        m_results(entries.size()), m_threads(0), m_elapsed(0) {}
+
+    void cancel() { m_cancel.store(1); }
+    bool cancelled() const { return 0 != m_cancel.load(); }
+
+    VerifyProgress progress() const
+    {
+        VerifyProgress p;
+        p.filesDone = m_filesDone.load();
+        p.filesTotal = m_entries.size();
+        p.bytesDone = m_bytesDone.load();
+        p.bytesTotal = m_bytesTotal.load();
+        return p;
+    }
+
+    const QString& manifest() const { return m_manifest; }
+    Hasher::Algorithm algorithm() const { return m_algorithm; }
+    const QVector<ManifestEntry>& entries() const { return m_entries; }
+    const QVector<Result>& results() const { return m_results; }
+    int threads() const { return m_threads; }
+    qint64 elapsed() const { return m_elapsed; }
+
+protected:
+    void run();
+
+private:
+    class HashThread : public QThread
+    {
+    public:
+        explicit HashThread(VerifyWorker * worker) : m_pworker(worker) {}
+    protected:
+        void run() { m_pworker->hashLoop(); }
+    private:
+        VerifyWorker * m_pworker;
+    };
+
+    QString m_manifest;
+    QString m_root;
+    Hasher::Algorithm m_algorithm;
+    QVector<ManifestEntry> m_entries;
+    QVector<Result> m_results;
+    QAtomicInt m_cancel;
+    QAtomicInt m_next;
+    QAtomicInteger<qint64> m_filesDone;
+    QAtomicInteger<qint64> m_bytesDone;
+    QAtomicInteger<qint64> m_bytesTotal;
+    int m_threads;
+    qint64 m_elapsed;
+
+    void hashLoop();
+    bool hashFile(const QString& path, char * buf, QByteArray& digest);
+};
+
+void VerifyWorker::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < m_entries.size(); ++i)
+    {
+        QFileInfo fi(m_entries.at(i).path);
+        if (fi.isFile())
+            m_bytesTotal.fetchAndAddRelaxed(fi.size());
+    }
+
+    // Each thread works on its own file, so a tree of small files keeps several requests in
+    // flight and a single large image is bounded by read-ahead rather than by the hash.
+    m_threads = qBound(1, qMin(QThread::idealThreadCount(), MAX_HASH_THREADS), qMax(1, m_entries.size()));
+
+    QList<HashThread*> threads;
+    for (int i = 1; i < m_threads; ++i)
+    {
+        threads.append(new HashThread(this));
+        threads.last()->start();
+    }
+    hashLoop();
+    foreach (HashThread * t, threads)
+    {
+        t->wait();
+        delete t;
+    }
+
+    m_elapsed = timer.elapsed();
+}
+
+void VerifyWorker::hashLoop()
+{
+    char * buf = 0;
+    if (::posix_memalign(reinterpret_cast<void**>(&buf), BUFFER_ALIGNMENT, HASH_CHUNK) != 0)
+        return;
+
+    int i;
+    while (!cancelled() && (i = m_next.fetchAndAddRelaxed(1)) < m_entries.size())
+    {
+        Result& r = m_results[i];
+        // Resolved again here, the device may have changed since the manifest was read.
+        QString path = QFileInfo(m_entries.at(i).path).canonicalFilePath();
+
+        if (path.isEmpty() || !QFileInfo(path).isFile())
+            r.status = Missing;
+        else if (!isUnder(m_root, path))
+            r.status = ReadError;
+        else if (!hashFile(path, buf, r.actual))
+            r.status = cancelled() ? Pending : ReadError;
+        else
+            r.status = r.actual == m_entries.at(i).expected ? Matched : Mismatched;
+
+        m_filesDone.ref();
+    }
+
+    free(buf);
+}
+
+bool VerifyWorker::hashFile(const QString &path, char *buf, QByteArray &digest)
+{
+    int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0)
+        return false;
+
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    ::posix_fadvise(fd, 0, 2 * HASH_CHUNK, POSIX_FADV_WILLNEED);
+
+    QScopedPointer<Hasher> hasher(Hasher::create(m_algorithm));
+    off_t offset = 0;
+    ssize_t n;
+    bool ok = true;
+
+    while ((n = ::pread(fd, buf, HASH_CHUNK, offset)) != 0)
+    {
+        if (n < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            ok = false;
+            break;
+        }
+
+        // Keep the next chunk in flight while this one is hashed.
+        ::posix_fadvise(fd, offset + n + HASH_CHUNK, HASH_CHUNK, POSIX_FADV_WILLNEED);
+        hasher->update(buf, n);
+        offset += n;
+        m_bytesDone.fetchAndAddRelaxed(n);
+
+        if (cancelled())
+        {
+            ok = false;
+            break;
+        }
+    }
+
+    ::close(fd);
+
+    if (!ok)
+        return false;
+
+    QByteArray raw(Hasher::digestSize(m_algorithm), '\0');
+    hasher->final(reinterpret_cast<unsigned char*>(raw.data()));
+    digest = raw.toHex();
+    return true;
+}
+
+ManifestVerifier::ManifestVerifier(DeviceWatcher *watcher, QObject *parent) :
+    JobManager(watcher, parent)
+{
+}
+
+bool ManifestVerifier::parseManifest(const QString &manifest, const QString &root, Hasher::Algorithm &algorithm,
+                                     QList<ManifestEntry> &entries, QString &error)
+{
+    QFile f(manifest);
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        error = "Can't open " + manifest + ".";
+        return false;
+    }
+
+    QString name = QFileInfo(manifest).fileName().toLower();
+    // Relative entries are taken from the manifest's own directory when it sits on the device, as
+    // sha256sum -c run there would, and from the device root when it is kept on the host.
+    QString manifest_dir = QFileInfo(QFileInfo(manifest).canonicalFilePath()).absolutePath();
+    QDir base(isUnder(root, manifest_dir) ? manifest_dir : root);
+    bool known = true;
+
+    // b3sum output, matched by name only; "b3" also shows up inside ordinary names like lib32.sha256.
+    if (name.endsWith(".b3") || name.startsWith("b3sums") || name.contains("blake3"))
+    {
+        error = "BLAKE3 manifests are not supported, use SHA-256 or xxHash64.";
+        return false;
+    }
+    else if (name.contains("sha256"))
+        algorithm = Hasher::SHA256;
+    else if (name.contains("xxh"))
+        algorithm = Hasher::XXH64;
+    else known = false;
+
+    // sha256sum/xxhsum output ("<hex>  <path>", '*' marks binary mode) and the BSD tag style.
+    QRegularExpression gnu_line("^([0-9a-fA-F]+) [ *](.+)$");
+    QRegularExpression bsd_line("^(SHA256|XXH64) \\((.+)\\) = ([0-9a-fA-F]+)$");
+
+    while (!f.atEnd())
+    {
+        QString line = QString::fromUtf8(f.readLine()).trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+
+        ManifestEntry e;
+        QRegularExpressionMatch m;
+
+        if ((m = gnu_line.match(line)).hasMatch())
+        {
+            e.expected = m.captured(1).toLower().toLatin1();
+            e.path = m.captured(2);
+        }
+        else if ((m = bsd_line.match(line)).hasMatch())
+        {
+            e.expected = m.captured(3).toLower().toLatin1();
+            e.path = m.captured(2);
+            if (!known)
+                algorithm = "XXH64" == m.captured(1) ? Hasher::XXH64 : Hasher::SHA256;
+            known = true;
+        }
+        else
+        {
+            error = "Malformed manifest line: " + line;
+            return false;
+        }
+
+        if (!known)
+        {
+            if (64 == e.expected.size())
+                algorithm = Hasher::SHA256;
+            else if (16 == e.expected.size())
+                algorithm = Hasher::XXH64;
+            else
+            {
+                error = "Unknown checksum type in " + manifest + ".";
+                return false;
+            }
+            known = true;
+        }
+
+        if (e.expected.size() != int(Hasher::digestSize(algorithm) * 2))
+        {
+            error = "Checksum of " + e.path + " doesn't look like " + Hasher::name(algorithm) + ".";
+            return false;
+        }
+
+        // Absolute paths, ../ and symlinks on the device would check files of the host instead.
+        QString listed = e.path;
+        e.path = QDir::cleanPath(base.absoluteFilePath(e.path));
+        QString real = QFileInfo(e.path).canonicalFilePath();
+        if (!isUnder(root, e.path) || (!real.isEmpty() && !isUnder(root, real)))
+        {
+            error = listed + " is outside of " + root + ".";
+            return false;
+        }
+        entries.append(e);
+    }
+
+    if (entries.isEmpty())
+    {
+        error = manifest + " lists no files.";
+        return false;
+    }
+    return true;
+}
+
+bool ManifestVerifier::start(const DeviceInfo &dev, const QString &manifest, QString &error)
+{
+    if (isRunning(dev.udisksPath))
+    {
+        error = "Verification of this device is already running.";
+        return false;
+    }
+
+    // Symlinks resolved, entries are compared against the real location of the mount.
+    QString root = QFileInfo(dev.mountPoint).canonicalFilePath();
+    if (dev.mountPoint.isEmpty() || root.isEmpty())
+    {
+        error = "The device is not mounted.";
+        return false;
+    }
+
+    Hasher::Algorithm algorithm;
+    QList<ManifestEntry> entries;
+
+    if (!parseManifest(manifest, root, algorithm, entries, error))
+        return false;
+
+    qDebug() << "Verifying " << entries.size() << " files against " << manifest
+             << " (" << Hasher::name(algorithm) << ", " << Hasher::implementation(algorithm) << ")";
+    return startJob(dev.udisksPath, dev, new VerifyWorker(manifest, root, algorithm, entries, this));
+}
+
+VerifyProgress ManifestVerifier::progress(const QString &dev_path) const
+{
+    VerifyWorker * w = static_cast<VerifyWorker*>(worker(dev_path));
+    return 0 == w ? VerifyProgress() : w->progress();
+}
+
+void ManifestVerifier::jobFinished(const DeviceInfo &dev, JobWorker *job_worker)
+{
+    VerifyWorker * worker = static_cast<VerifyWorker*>(job_worker);
+    int matched = 0;
+    foreach (const VerifyWorker::Result& r, worker->results())
+    {
+        if (VerifyWorker::Matched == r.status)
+            ++matched;
+    }
+
+    int total = worker->entries().size();
+    bool ok = !worker->cancelled() && matched == total;
+    QString summary = worker->cancelled() ? "Verification cancelled. " : "";
+    summary += QString::number(matched) + " of " + QString::number(total) + " files match.";
+
+    emit finished(dev, ok, summary, writeReport(dev, worker));
+}
+
+QString ManifestVerifier::writeReport(const DeviceInfo &dev, const VerifyWorker *worker) const
+{
+    static const char * status_names[] = { "pending", "ok", "mismatch", "missing", "error" };
+
+    VerifyProgress p = worker->progress();
+    QJsonArray failures;
+    int matched = 0;
+
+    for (int i = 0; i < worker->entries().size(); ++i)
+    {
+        const VerifyWorker::Result& r = worker->results().at(i);
+        if (VerifyWorker::Matched == r.status)
+        {
+            ++matched;
+            continue;
+        }
+
+        QJsonObject f;
+        f["path"] = worker->entries().at(i).path;
+        f["status"] = status_names[r.status];
+        f["expected"] = QString::fromLatin1(worker->entries().at(i).expected);
+        if (VerifyWorker::Mismatched == r.status)
+            f["actual"] = QString::fromLatin1(r.actual);
+        failures.append(f);
+    }
+
+    double secs = worker->elapsed() / 1000.0;
+
+    QJsonObject report;
+    report["device"] = dev.fileName;
+    report["uuid"] = dev.uuid;
+    report["manifest"] = worker->manifest();
+    report["algorithm"] = Hasher::name(worker->algorithm());
+    report["implementation"] = Hasher::implementation(worker->algorithm());
+    report["threads"] = worker->threads();
+    report["cancelled"] = worker->cancelled();
+    report["files"] = worker->entries().size();
+    report["matched"] = matched;
+    report["bytes"] = double(p.bytesDone);
+    report["seconds"] = secs;
+    report["throughputMBps"] = secs > 0 ? p.bytesDone / secs / (1024 * 1024) : 0;
+    report["failures"] = failures;
+
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::DataLocation);
+    QString path = dir + "/verify-" + (dev.uuid.isEmpty() ? dev.name : dev.uuid)
+            + "-" + QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss") + ".json";
+
+    QFile f(path);
+    if (!QDir().mkpath(dir) || !f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << "Can't write verification report " << path;
+        return QString();
+    }
+    f.write(QJsonDocument(report).toJson());
+    return path;
+}
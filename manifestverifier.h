@@ -0,0 +1,52 @@
+#ifndef MANIFESTVERIFIER_H
+#define MANIFESTVERIFIER_H
+
+#include <QObject>
+#include <QtCore>
+
+#include "jobmanager.h"
+#include "hasher.h"
+
+struct ManifestEntry
+{
+    QString path;
+    QByteArray expected;
+};
+
+struct VerifyProgress
+{
+    VerifyProgress() : filesDone(0), filesTotal(0), bytesDone(0), bytesTotal(0) {}
+
+    qint64 filesDone;
+    qint64 filesTotal;
+    qint64 bytesDone;
+    qint64 bytesTotal;
+};
+
+class VerifyWorker;
+
+class ManifestVerifier : public JobManager
+{
+    Q_OBJECT
+public:
+    explicit ManifestVerifier(DeviceWatcher * watcher, QObject *parent = 0);
+
+    // The manifest may live on the host, its relative entries then start at root. Entries resolving
+    // to anything outside root, through symlinks too, are rejected.
+    static bool parseManifest(const QString& manifest, const QString& root, Hasher::Algorithm& algorithm,
+                              QList<ManifestEntry>& entries, QString& error);
+
+    bool start(const DeviceInfo& dev, const QString& manifest, QString& error);
+    VerifyProgress progress(const QString& dev_path) const;
+
+signals:
+    void finished(const DeviceInfo& dev, bool ok, QString summary, QString report_path);
+
+protected:
+    void jobFinished(const DeviceInfo& dev, JobWorker * worker);
+
+private:
+    QString writeReport(const DeviceInfo& dev, const VerifyWorker * worker) const;
+};
+
+#endif // MANIFESTVERIFIER_H
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui dbus
+QT       += core gui dbus network
 CONFIG += c++11
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -15,20 +15,78 @@ TEMPLATE = app
 SOURCES += \
     interfaces/udisksdeviceinterface.cpp \
     interfaces/udisksinterface.cpp \
+    appsettings.cpp \
+    automountrules.cpp \
+    contentindex.cpp \
+    contentindexer.cpp \
+    devicebenchmark.cpp \
+    devicecache.cpp \
+    deviceimager.cpp \
+    devicemenu.cpp \
+    devicestore.cpp \
     devicewatcher.cpp \
+    dirwalker.cpp \
+    hasher.cpp \
+    imageformat.cpp \
+    imagemounter.cpp \
+    imagewriter.cpp \
+    iomonitor.cpp \
+    jobmanager.cpp \
     main.cpp \
     mainwindow.cpp \
-    settingsdialog.cpp
+    manifestverifier.cpp \
+    notificationaggregator.cpp \
+    saferemover.cpp \
+    settingsdialog.cpp \
+    singleinstance.cpp \
+    startupprofile.cpp \
+    syncengine.cpp
 
 HEADERS  += \
     interfaces/udisksdeviceinterface.h \
     interfaces/udisksinterface.h \
+    appsettings.h \
+    automountrules.h \
+    contentindex.h \
+    contentindexer.h \
+    devicebenchmark.h \
+    devicecache.h \
+    deviceimager.h \
+    devicemenu.h \
+    devicestore.h \
     devicewatcher.h \
+    dirwalker.h \
+    hasher.h \
+    imageformat.h \
+    imagemounter.h \
+    imagewriter.h \
+    iomonitor.h \
+    jobmanager.h \
     mainwindow.h \
-    settingsdialog.h
+    manifestverifier.h \
+    notificationaggregator.h \
+    saferemover.h \
+    settingsdialog.h \
+    singleinstance.h \
+    startupprofile.h \
+    syncengine.h
 
-FORMS    += mainwindow.ui \
+FORMS    += \
     settingsdialog.ui
 
 RESOURCES += \
     resources.qrc
+
+OTHER_FILES += \
+    dbus/org.mountain.DeviceCache.conf
+
+# qmake CONFIG+=bench adds --bench-devices, store and menu timings with allocation counts. The
+# counter replaces the malloc family for the whole process, such a build is for measuring only
+# and never to be installed.
+bench {
+    DEFINES += MOUNTAIN_BENCH
+    SOURCES += allocationcounter.cpp \
+        devicebench.cpp
+    HEADERS += allocationcounter.h \
+        devicebench.h
+}
@@ -0,0 +1,113 @@
+#include "notificationaggregator.h"
+
+const int BATCH_WINDOW = 700;
+const int BATCH_MAX_DELAY = 2000;
+const int DEVICE_RATE_LIMIT = 3000;
+const int SUMMARY_NAMES_LIMIT = 4;
+const char * EVENT_VERBS[] = { "connected", "disconnected", "mounted", "unmounted" };
+
+NotificationAggregator::NotificationAggregator(QSystemTrayIcon *icon, QObject *parent) :
+    QObject(parent),
+    m_ptrayIcon(icon),
+    m_batchStart(0)
+{
+    m_ptimer = new QTimer(this);
+    m_ptimer->setSingleShot(true);
+    QObject::connect(m_ptimer, SIGNAL(timeout()), this, SLOT(slotFlush()));
+    m_clock.start();
+}
+
+void NotificationAggregator::post(Event e, const DeviceInfo &dev, const QString &type_name,
+                                  const QString &title, const QString &message)
+{
+    qint64 now = m_clock.elapsed();
+
+    // A device bouncing between states still gets at most one balloon per event every few seconds.
+    QString key = dev.udisksPath + "/" + QString::number(e);
+    QHash<QString, qint64>::const_iterator last = m_lastShown.find(key);
+    if (m_lastShown.end() != last && now - *last < DEVICE_RATE_LIMIT)
+        return;
+    m_lastShown.insert(key, now);
+
+    Pending p;
+    p.event = e;
+    p.device = dev;
+    p.typeName = type_name;
+    p.title = title;
+    p.message = message;
+    m_pending.append(p);
+
+    // Every event extends the window, but the first one never waits longer than BATCH_MAX_DELAY.
+    if (!m_ptimer->isActive())
+    {
+        m_batchStart = now;
+        m_ptimer->start(BATCH_WINDOW);
+    }
+    else if (now - m_batchStart + BATCH_WINDOW <= BATCH_MAX_DELAY)
+        m_ptimer->start(BATCH_WINDOW);
+}
+
+void NotificationAggregator::slotFlush()
+{
+    if (m_pending.isEmpty())
+        return;
+
+    QSet<QString> devices;
+    foreach (const Pending& p, m_pending)
+        devices.insert(p.device.udisksPath);
+
+    // One stick plugged in is Added followed by Mounted, its latest state says all of it.
+    if (1 == devices.size())
+        m_ptrayIcon->showMessage(m_pending.last().title, m_pending.last().message);
+    else
+    {
+        QMap<Event, QList<const Pending*> > by_event;
+        foreach (const Pending& p, m_pending)
+            by_event[p.event].append(&p);
+
+        QStringList lines;
+        for (QMap<Event, QList<const Pending*> >::const_iterator itr = by_event.constBegin(); itr != by_event.constEnd(); ++itr)
+            lines << summary(itr.key(), itr.value());
+
+        QString title = QString::number(devices.size()) + " devices "
+                + (1 == by_event.size() ? EVENT_VERBS[by_event.firstKey()] : "changed");
+        m_ptrayIcon->showMessage(title, lines.join("\n"));
+    }
+    m_pending.clear();
+
+    // Entries older than the rate limit can't suppress anything anymore.
+    qint64 now = m_clock.elapsed();
+    for (QHash<QString, qint64>::iterator itr = m_lastShown.begin(); itr != m_lastShown.end(); )
+    {
+        if (now - itr.value() >= DEVICE_RATE_LIMIT)
+            itr = m_lastShown.erase(itr);
+        else ++itr;
+    }
+}
+
+QString NotificationAggregator::summary(Event e, const QList<const Pending*> &events)
+{
+    // "2 USB disks, 1 Optical disk connected: sdb1, sdc1, sr0"
+    QMap<QString, int> types;
+    QStringList names;
+    QStringList mount_points;
+
+    foreach (const Pending * p, events)
+    {
+        ++types[p->typeName];
+        names << p->device.name;
+        if (Mounted == e && !p->device.mountPoint.isEmpty())
+            mount_points << p->device.mountPoint;
+    }
+
+    QStringList counts;
+    for (QMap<QString, int>::const_iterator itr = types.constBegin(); itr != types.constEnd(); ++itr)
+        counts << QString::number(itr.value()) + " " + itr.key() + (itr.value() > 1 ? "s" : "");
+
+    QStringList& shown = mount_points.isEmpty() ? names : mount_points;
+    QString list = QStringList(shown.mid(0, SUMMARY_NAMES_LIMIT)).join(", ");
+    if (shown.size() > SUMMARY_NAMES_LIMIT)
+        list += ", ...";
+
+    return counts.join(", ") + " " + EVENT_VERBS[e] + (mount_points.isEmpty() ? ": " : " to ") + list;
+}
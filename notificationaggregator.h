@@ -0,0 +1,49 @@
+#ifndef NOTIFICATIONAGGREGATOR_H
+#define NOTIFICATIONAGGREGATOR_H
+
+#include <QObject>
+#include <QtCore>
+#include <QSystemTrayIcon>
+
+#include "devicewatcher.h"
+
+// Collects hotplug notifications for a short window and shows them as one balloon,
+// so a card reader with four slots doesn't queue up eight of them.
+class NotificationAggregator : public QObject
+{
+    Q_OBJECT
+public:
+    enum Event
+    {
+        Added, Removed, Mounted, Unmounted
+    };
+
+    explicit NotificationAggregator(QSystemTrayIcon * icon, QObject *parent = 0);
+
+    // title and message are shown as they are when the event ends up alone in its batch.
+    void post(Event e, const DeviceInfo& dev, const QString& type_name, const QString& title, const QString& message);
+
+private slots:
+    void slotFlush();
+
+private:
+    struct Pending
+    {
+        Event event;
+        DeviceInfo device;
+        QString typeName;
+        QString title;
+        QString message;
+    };
+
+    QSystemTrayIcon * m_ptrayIcon;
+    QTimer * m_ptimer;
+    QElapsedTimer m_clock;
+    qint64 m_batchStart;
+    QList<Pending> m_pending;
+    QHash<QString, qint64> m_lastShown;
+
+    static QString summary(Event e, const QList<const Pending*>& events);
+};
+
+#endif // NOTIFICATIONAGGREGATOR_H
@@ -0,0 +1,206 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "saferemover.h"
+#include "iomonitor.h"
+
+const int FLUSH_POLL_INTERVAL = 250;
+
+namespace
+{
+
+class SyncFsThread : public QThread
+{
+public:
+    SyncFsThread(const QString& mount_point, QObject * parent) :
+        QThread(parent), m_mountPoint(mount_point), m_error(0) {}
+
+    int error() const { return m_error; }
+
+protected:
+    void run()
+    {
+        int fd = ::open(QFile::encodeName(m_mountPoint).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            m_error = errno;
+            return;
+        }
+        if (::syncfs(fd) < 0)
+            m_error = errno;
+        ::close(fd);
+    }
+
+private:
+    QString m_mountPoint;
+    int m_error;
+};
+
+}
+
+SafeRemover::SafeRemover(DeviceWatcher *watcher, QObject *parent) :
+    QObject(parent),
+    m_pdevWatcher(watcher)
+{
+    m_ptimer = new QTimer(this);
+    m_ptimer->setInterval(FLUSH_POLL_INTERVAL);
+    QObject::connect(m_ptimer, SIGNAL(timeout()), this, SLOT(slotPoll()));
+    QObject::connect(m_pdevWatcher, SIGNAL(deviceUnmounted(DeviceInfoPtr, ErrorCode)),
+                     this, SLOT(slotDeviceUnmounted(DeviceInfoPtr, ErrorCode)));
+}
+
+SafeRemover::~SafeRemover()
+{
+    // syncfs() can't be interrupted, wait for it rather than destroying a running thread.
+    foreach (const Job& job, m_jobs)
+    {
+        if (0 != job.thread)
+            job.thread->wait();
+    }
+}
+
+bool SafeRemover::start(const QString &dev_path)
+{
+    DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->getDevice(dev_path);
+
+    if (0 == dev || !dev->isMounted || m_jobs.contains(dev_path))
+        return false;
+
+    Job job;
+    job.fileName = dev->fileName;
+    readMemInfo(job.progress.dirtyKb, job.progress.writebackKb);
+    job.initialKb = job.progress.dirtyKb + job.progress.writebackKb;
+
+    SyncFsThread * thread = new SyncFsThread(dev->mountPoint, this);
+    thread->setProperty("DevicePath", dev_path);
+    QObject::connect(thread, SIGNAL(finished()), this, SLOT(slotSyncFinished()));
+    job.thread = thread;
+
+    m_jobs.insert(dev_path, job);
+    thread->start();
+    m_ptimer->start();
+
+    qDebug() << "Flushing " << dev->mountPoint << ", " << job.initialKb << "kB dirty";
+    emit progressChanged(*dev);
+    return true;
+}
+
+bool SafeRemover::isRunning(const QString &dev_path) const
+{
+    return m_jobs.contains(dev_path);
+}
+
+bool SafeRemover::idle() const
+{
+    return m_jobs.isEmpty();
+}
+
+FlushProgress SafeRemover::progress(const QString &dev_path) const
+{
+    return m_jobs.value(dev_path).progress;
+}
+
+bool SafeRemover::readMemInfo(unsigned long long &dirty_kb, unsigned long long &writeback_kb)
+{
+    QFile f("/proc/meminfo");
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+
+    int found = 0;
+    while (found < 2 && !f.atEnd())
+    {
+        QByteArray line = f.readLine();
+        if (line.startsWith("Dirty:"))
+        {
+            dirty_kb = line.mid(6).simplified().split(' ').first().toULongLong();
+            ++found;
+        }
+        else if (line.startsWith("Writeback:"))
+        {
+            writeback_kb = line.mid(10).simplified().split(' ').first().toULongLong();
+            ++found;
+        }
+    }
+    return 2 == found;
+}
+
+void SafeRemover::slotPoll()
+{
+    for (QMap<QString, Job>::iterator itr = m_jobs.begin(); itr != m_jobs.end(); ++itr)
+    {
+        if (itr->unmounting)
+            continue;
+
+        updateProgress(*itr);
+
+        DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->getDevice(itr.key());
+        if (0 != dev)
+            emit progressChanged(*dev);
+    }
+}
+
+void SafeRemover::slotSyncFinished()
+{
+    SyncFsThread * thread = static_cast<SyncFsThread*>(sender());
+    QString dev_path = thread->property("DevicePath").toString();
+    int error = thread->error();
+    thread->deleteLater();
+
+    QMap<QString, Job>::iterator itr = m_jobs.find(dev_path);
+    if (m_jobs.end() == itr)
+        return;
+
+    itr->thread = 0;
+    DeviceWatcher::DeviceInfoPtr dev = m_pdevWatcher->getDevice(dev_path);
+
+    if (0 == dev)
+    {
+        m_jobs.erase(itr);
+    }
+    else if (0 != error)
+    {
+        m_jobs.erase(itr);
+        emit failed(*dev, QString("Flushing failed: ") + strerror(error));
+    }
+    else
+    {
+        itr->unmounting = true;
+        itr->progress.percent = 100;
+        emit progressChanged(*dev);
+        m_pdevWatcher->unmountDevice(dev_path, false);
+    }
+
+    if (m_jobs.isEmpty())
+        m_ptimer->stop();
+}
+
+void SafeRemover::slotDeviceUnmounted(const DeviceInfoPtr &dev, ErrorCode e)
+{
+    QMap<QString, Job>::iterator itr = m_jobs.find(dev->udisksPath);
+    if (m_jobs.end() == itr || !itr->unmounting)
+        return;
+
+    m_jobs.erase(itr);
+    if (m_jobs.isEmpty())
+        m_ptimer->stop();
+
+    if (OK == e)
+        emit safeToRemove(*dev);
+    else if (Busy == e)
+        emit failed(*dev, "Device is still in use.");
+    else emit failed(*dev, "Device can't be unmounted.");
+}
+
+void SafeRemover::updateProgress(Job &job)
+{
+    readMemInfo(job.progress.dirtyKb, job.progress.writebackKb);
+    IoMonitor::readInFlight(job.fileName, job.progress.inFlight);
+
+    // Dirty and Writeback are system wide, so this is an upper bound of what is left for the device.
+    unsigned long long left = job.progress.dirtyKb + job.progress.writebackKb;
+    if (job.initialKb > 0 && left < job.initialKb)
+        job.progress.percent = qMax(job.progress.percent, int(100 - left * 100 / job.initialKb));
+    job.progress.percent = qMin(job.progress.percent, 99);
+}
@@ -0,0 +1,62 @@
+#ifndef SAFEREMOVER_H
+#define SAFEREMOVER_H
+
+#include <QObject>
+#include <QtCore>
+
+#include "devicewatcher.h"
+
+struct FlushProgress
+{
+    FlushProgress() : dirtyKb(0), writebackKb(0), inFlight(0), percent(0) {}
+
+    unsigned long long dirtyKb;
+    unsigned long long writebackKb;
+    unsigned long inFlight;
+    int percent;
+};
+
+class SafeRemover : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SafeRemover(DeviceWatcher * watcher, QObject *parent = 0);
+    ~SafeRemover();
+
+    bool start(const QString& dev_path);
+    bool isRunning(const QString& dev_path) const;
+    bool idle() const;
+    FlushProgress progress(const QString& dev_path) const;
+
+    static bool readMemInfo(unsigned long long& dirty_kb, unsigned long long& writeback_kb);
+
+signals:
+    void progressChanged(const DeviceInfo& dev);
+    void safeToRemove(const DeviceInfo& dev);
+    void failed(const DeviceInfo& dev, QString reason);
+
+private slots:
+    void slotPoll();
+    void slotSyncFinished();
+    void slotDeviceUnmounted(const DeviceInfoPtr& dev, ErrorCode e);
+
+private:
+    struct Job
+    {
+        Job() : thread(0), initialKb(0), unmounting(false) {}
+
+        QThread * thread;
+        QString fileName;
+        unsigned long long initialKb;
+        FlushProgress progress;
+        bool unmounting;
+    };
+
+    DeviceWatcher * m_pdevWatcher;
+    QTimer * m_ptimer;
+    QMap<QString, Job> m_jobs;
+
+    void updateProgress(Job& job);
+};
+
+#endif // SAFEREMOVER_H
@@ -1,17 +1,19 @@
 #include "settingsdialog.h"
 #include "ui_settingsdialog.h"
+#include "syncengine.h"
 
-const QString DEFAULT_VIEW_COMMAND = "xdg-open %m";
-const QString DEFAULT_DEVICE_FORMAT_STRING = "%n (%f) on %m";
+#include <QComboBox>
 
-SettingsDialog::SettingsDialog(QWidget *parent) :
+SettingsDialog::SettingsDialog(AppSettings *settings, QWidget *parent) :
     QDialog(parent),
-    ui(new Ui::SettingsDialog)
+    ui(new Ui::SettingsDialog),
+    m_pSettings(settings)
 {
     ui->setupUi(this);
-    m_pSettings = new QSettings("Vladislav Nickolaev", "MOUNTain", this);
     QObject::connect(ui->buttonBox, SIGNAL(accepted()), this, SLOT(slotSettingsAccepted()));
     QObject::connect(ui->buttonBox, SIGNAL(rejected()), this, SLOT(slotSettingsRejected()));
+    QObject::connect(ui->addSyncJobButton, SIGNAL(clicked()), this, SLOT(slotAddSyncJob()));
+    QObject::connect(ui->removeSyncJobButton, SIGNAL(clicked()), this, SLOT(slotRemoveSyncJob()));
     setWindowTitle("Settings");
     setWindowFlags(Qt::Dialog | Qt::MSWindowsFixedSizeDialogHint);
 
@@ -23,11 +25,6 @@ SettingsDialog::~SettingsDialog()
     delete ui;
 }
 
-const QSettings * SettingsDialog::settings()
-{
-    return m_pSettings;
-}
-
 void SettingsDialog::showEvent(QShowEvent *pe)
 {
     readSettings();
@@ -45,6 +42,32 @@ void SettingsDialog::slotSettingsRejected()
     hide();
 }
 
+void SettingsDialog::slotAddSyncJob()
+{
+    addSyncJobRow("", QDir::homePath(), "", false);
+    ui->syncJobsTable->editItem(ui->syncJobsTable->item(ui->syncJobsTable->rowCount() - 1, 0));
+}
+
+void SettingsDialog::slotRemoveSyncJob()
+{
+    ui->syncJobsTable->removeRow(ui->syncJobsTable->currentRow());
+}
+
+void SettingsDialog::addSyncJobRow(const QString &uuid, const QString &local_dir, const QString &device_dir, bool from_device)
+{
+    int row = ui->syncJobsTable->rowCount();
+    ui->syncJobsTable->insertRow(row);
+    ui->syncJobsTable->setItem(row, 0, new QTableWidgetItem(uuid));
+    ui->syncJobsTable->setItem(row, 1, new QTableWidgetItem(local_dir));
+    ui->syncJobsTable->setItem(row, 2, new QTableWidgetItem(device_dir));
+
+    QComboBox * direction = new QComboBox(ui->syncJobsTable);
+    direction->addItem("To device");
+    direction->addItem("From device");
+    direction->setCurrentIndex(from_device ? 1 : 0);
+    ui->syncJobsTable->setCellWidget(row, 3, direction);
+}
+
 void SettingsDialog::writeSettings()
 {
     m_pSettings->beginGroup("/Settings/Notifications");
@@ -62,8 +85,42 @@ void SettingsDialog::writeSettings()
     m_pSettings->setValue("ShowSystemInternal", ui->showInternalCBox->isChecked());
     m_pSettings->setValue("ExecuteViewMounted", ui->viewMountedCBox->isChecked());
     m_pSettings->setValue("ForceUnmount", ui->forceUnmountCBox->isChecked());
-    m_pSettings->setValue("ViewCommand", ui->viewCommandEdit->text().isEmpty() ? DEFAULT_VIEW_COMMAND : ui->viewCommandEdit->text());
-    m_pSettings->setValue("DeviceFormatString", ui->formatStringEdit->text().isEmpty() ? DEFAULT_DEVICE_FORMAT_STRING : ui->formatStringEdit->text());
+    m_pSettings->setValue("ViewCommand", ui->viewCommandEdit->text().isEmpty() ?
+                              AppSettings::defaultValue("/Settings/Actions/ViewCommand") : ui->viewCommandEdit->text());
+    m_pSettings->setValue("DeviceFormatString", ui->formatStringEdit->text().isEmpty() ?
+                              AppSettings::defaultValue("/Settings/Actions/DeviceFormatString") : ui->formatStringEdit->text());
+
+    m_pSettings->endGroup();
+
+    m_pSettings->beginGroup("/Settings/Monitor");
+
+    m_pSettings->setValue("SampleInterval", ui->sampleIntervalSpin->value());
+    m_pSettings->setValue("TooltipFormatString", ui->tooltipFormatEdit->text().isEmpty() ?
+                              AppSettings::defaultValue("/Settings/Monitor/TooltipFormatString") : ui->tooltipFormatEdit->text());
+
+    m_pSettings->endGroup();
+
+    QList<SyncJobConfig> jobs;
+    for (int row = 0; row < ui->syncJobsTable->rowCount(); ++row)
+    {
+        SyncJobConfig job;
+        job.uuid = ui->syncJobsTable->item(row, 0)->text().trimmed();
+        job.localDir = ui->syncJobsTable->item(row, 1)->text().trimmed();
+        job.deviceDir = ui->syncJobsTable->item(row, 2)->text().trimmed();
+        job.direction = qobject_cast<QComboBox*>(ui->syncJobsTable->cellWidget(row, 3))->currentIndex() == 1 ?
+                    SyncJobConfig::FromDevice : SyncJobConfig::ToDevice;
+
+        if (!job.uuid.isEmpty() && !job.localDir.isEmpty())
+            jobs.append(job);
+    }
+    SyncEngine::saveJobs(m_pSettings, jobs);
+
+    m_pSettings->setValue("/Settings/Index/Enabled", ui->indexMountedCBox->isChecked());
+
+    m_pSettings->beginGroup("/Settings/Benchmark");
+
+    m_pSettings->setValue("SizeMB", ui->benchmarkSizeSpin->value());
+    m_pSettings->setValue("QueueDepth", ui->benchmarkQueueDepthSpin->value());
 
     m_pSettings->endGroup();
 
@@ -71,23 +128,27 @@ void SettingsDialog::writeSettings()
 
 void SettingsDialog::readSettings()
 {
-    m_pSettings->beginGroup("/Settings/Notifications");
+    ui->showAddedCBox->setChecked(m_pSettings->get("/Settings/Notifications/ShowAdded").toBool());
+    ui->showRemovedCBox->setChecked(m_pSettings->get("/Settings/Notifications/ShowRemoved").toBool());
+    ui->showMountedCBox->setChecked(m_pSettings->get("/Settings/Notifications/ShowMounted").toBool());
+    ui->showUnmountedCBox->setChecked(m_pSettings->get("/Settings/Notifications/ShowUnmounted").toBool());
 
-    ui->showAddedCBox->setChecked(m_pSettings->value("ShowAdded", true).toBool());
-    ui->showRemovedCBox->setChecked(m_pSettings->value("ShowRemoved", true).toBool());
-    ui->showMountedCBox->setChecked(m_pSettings->value("ShowMounted", true).toBool());
-    ui->showUnmountedCBox->setChecked(m_pSettings->value("ShowUnmounted", true).toBool());
+    ui->mountAddedCBox->setChecked(m_pSettings->get("/Settings/Actions/MountAdded").toBool());
+    ui->showInternalCBox->setChecked(m_pSettings->get("/Settings/Actions/ShowSystemInternal").toBool());
+    ui->viewMountedCBox->setChecked(m_pSettings->get("/Settings/Actions/ExecuteViewMounted").toBool());
+    ui->forceUnmountCBox->setChecked(m_pSettings->get("/Settings/Actions/ForceUnmount").toBool());
+    ui->viewCommandEdit->setText(m_pSettings->get("/Settings/Actions/ViewCommand").toString());
+    ui->formatStringEdit->setText(m_pSettings->get("/Settings/Actions/DeviceFormatString").toString());
 
-    m_pSettings->endGroup();
+    ui->sampleIntervalSpin->setValue(m_pSettings->get("/Settings/Monitor/SampleInterval").toInt());
+    ui->tooltipFormatEdit->setText(m_pSettings->get("/Settings/Monitor/TooltipFormatString").toString());
 
-    m_pSettings->beginGroup("/Settings/Actions");
+    ui->syncJobsTable->setRowCount(0);
+    foreach (const SyncJobConfig& job, SyncEngine::loadJobs(m_pSettings))
+        addSyncJobRow(job.uuid, job.localDir, job.deviceDir, SyncJobConfig::FromDevice == job.direction);
 
-    ui->mountAddedCBox->setChecked(m_pSettings->value("MountAdded", true).toBool());
-    ui->showInternalCBox->setChecked(m_pSettings->value("ShowSystemInternal", true).toBool());
-    ui->viewMountedCBox->setChecked(m_pSettings->value("ExecuteViewMounted", true).toBool());
-    ui->forceUnmountCBox->setChecked(m_pSettings->value("ForceUnmount", true).toBool());
-    ui->viewCommandEdit->setText(m_pSettings->value("ViewCommand").toString());
-    ui->formatStringEdit->setText(m_pSettings->value("DeviceFormatString", DEFAULT_DEVICE_FORMAT_STRING).toString());
+    ui->indexMountedCBox->setChecked(m_pSettings->get("/Settings/Index/Enabled").toBool());
 
-    m_pSettings->endGroup();
+    ui->benchmarkSizeSpin->setValue(m_pSettings->get("/Settings/Benchmark/SizeMB").toInt());
+    ui->benchmarkQueueDepthSpin->setValue(m_pSettings->get("/Settings/Benchmark/QueueDepth").toInt());
 }
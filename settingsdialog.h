@@ -3,7 +3,8 @@
 
 #include <QDialog>
 #include <tr1/memory>
-#include <QSettings>
+
+#include "appsettings.h"
 
 namespace Ui {
 class SettingsDialog;
@@ -14,28 +15,29 @@ class SettingsDialog : public QDialog
     Q_OBJECT
 
 public:
-    explicit SettingsDialog(QWidget *parent = 0);
+    explicit SettingsDialog(AppSettings * settings, QWidget *parent = 0);
     ~SettingsDialog();
 
-    const QSettings *settings();
-
 protected:
     virtual void showEvent(QShowEvent * pe);
 
 private slots:
     void slotSettingsAccepted();
     void slotSettingsRejected();
+    void slotAddSyncJob();
+    void slotRemoveSyncJob();
 
 signals:
     void settingsAccepted();
 
 private:
     Ui::SettingsDialog *ui;
-    QSettings * m_pSettings;
+    AppSettings * m_pSettings;
 
 
     void writeSettings();
     void readSettings();
+    void addSyncJobRow(const QString& uuid, const QString& local_dir, const QString& device_dir, bool from_device);
 };
 
 #endif // SETTINGSDIALOG_H
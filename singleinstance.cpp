@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "singleinstance.h"
+
+const char * LOCK_NAME = "mountain.lock";
+const char * SOCKET_NAME = "mountain.sock";
+const int CONNECT_RETRIES = 40;
+const int CONNECT_RETRY_USEC = 50000;
+// The running instance listens before it builds its window, but it only answers from its event
+// loop, which can take a while with a large device table.
+const int REPLY_TIMEOUT_MS = 30000;
+
+// Commands are a few lines, one field per line, closed by an empty line.
+// The reply is a single line, "ok" or "error <message>".
+
+bool SingleInstance::parseCommand(int argc, char *argv[], QList<QByteArray> &command)
+{
+    if (argc <= 1)
+        return true;
+
+    QByteArray opt = argv[1];
+
+    if ("--show-menu" == opt && 2 == argc)
+        command << "show-menu";
+    else if ("--unmount-all" == opt && 2 == argc)
+        command << "unmount-all";
+    else if (("--mount" == opt || "--unmount" == opt) && 3 == argc && 0 == strchr(argv[2], '\n'))
+        command << opt.mid(2) << argv[2];
+    else return false;
+
+    return true;
+}
+
+bool SingleInstance::acquire()
+{
+    // The lock lives as long as the process, the kernel drops it whichever way we exit.
+    int fd = ::open(runtimePath(LOCK_NAME).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return true;
+
+    if (0 == ::flock(fd, LOCK_EX | LOCK_NB))
+        return true;
+
+    ::close(fd);
+    return false;
+}
+
+int SingleInstance::forward(const QList<QByteArray> &command)
+{
+    QByteArray path = runtimePath(SOCKET_NAME);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.constData(), sizeof(addr.sun_path) - 1);
+
+    int fd = -1;
+
+    // The running instance may still be starting up and not listening yet.
+    for (int i = 0; i < CONNECT_RETRIES && fd < 0; ++i)
+    {
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && ::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+        {
+            ::close(fd);
+            fd = -1;
+            ::usleep(CONNECT_RETRY_USEC);
+        }
+    }
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "mountain is already running but doesn't answer on %s\n", path.constData());
+        return 1;
+    }
+
+    QByteArray msg;
+    foreach (const QByteArray& field, command.isEmpty() ? QList<QByteArray>() << "show-menu" : command)
+        msg += field + "\n";
+    msg += "\n";
+
+    QByteArray reply;
+    bool sent = ::send(fd, msg.constData(), msg.size(), MSG_NOSIGNAL) == msg.size();
+
+    struct pollfd p = { fd, POLLIN, 0 };
+    while (sent && !reply.endsWith('\n') && ::poll(&p, 1, REPLY_TIMEOUT_MS) > 0)
+    {
+        char buf[256];
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        reply.append(buf, n);
+    }
+    ::close(fd);
+
+    if ("ok\n" == reply)
+        return 0;
+
+    fprintf(stderr, "%s\n", reply.isEmpty() ? "No reply from the running mountain" : reply.trimmed().constData());
+    return 1;
+}
+
+void SingleInstance::usage()
+{
+    fprintf(stderr, "Usage: mountain [--profile-startup] [--show-menu | --mount <device> | --unmount <device> | --unmount-all]\n"
+                    "       mountain --write-image <image> <target>\n"
+                    "       mountain --create-image <device> <output> [threads]\n"
+                    "       mountain --bench-devices [count]   (CONFIG+=bench builds)\n"
+                    "       mountain --cache-service\n"
+                    "       mountain --automount-dry-run [all | <device file>] [padding]\n"
+                    "<device> is a device file, UUID or label.\n");
+}
+
+SingleInstance::SingleInstance(QObject *parent) :
+    QObject(parent),
+    m_deliver(false)
+{
+    m_pserver = new QLocalServer(this);
+    QObject::connect(m_pserver, SIGNAL(newConnection()), this, SLOT(slotNewConnection()));
+}
+
+bool SingleInstance::listen()
+{
+    // Holding the lock means whatever socket file is left over belongs to a dead instance.
+    QString path = QFile::decodeName(runtimePath(SOCKET_NAME));
+    QLocalServer::removeServer(path);
+    m_pserver->setSocketOptions(QLocalServer::UserAccessOption);
+
+    if (!m_pserver->listen(path))
+    {
+        qWarning() << "Can't listen on " << path << ": " << m_pserver->errorString();
+        return false;
+    }
+    return true;
+}
+
+void SingleInstance::slotNewConnection()
+{
+    while (QLocalSocket * socket = m_pserver->nextPendingConnection())
+    {
+        QObject::connect(socket, SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
+        QObject::connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+void SingleInstance::slotReadyRead()
+{
+    QLocalSocket * socket = qobject_cast<QLocalSocket*>(sender());
+    QByteArray data = socket->peek(socket->bytesAvailable());
+
+    int end = data.indexOf("\n\n");
+    if (end < 0)
+        return;
+
+    socket->read(end + 2);
+    QStringList command = QString::fromLocal8Bit(data.left(end)).split('\n');
+
+    QString cmd = command.first();
+    if (("show-menu" == cmd || "unmount-all" == cmd) && 1 == command.size())
+        socket->write("ok\n");
+    else if (("mount" == cmd || "unmount" == cmd) && 2 == command.size())
+        socket->write("ok\n");
+    else
+    {
+        socket->write("error unknown command\n");
+        socket->disconnectFromServer();
+        return;
+    }
+
+    socket->disconnectFromServer();
+
+    if (m_deliver)
+        emit commandReceived(command);
+    else m_held.append(command);
+}
+
+void SingleInstance::deliverCommands()
+{
+    m_deliver = true;
+    while (!m_held.isEmpty())
+        emit commandReceived(m_held.takeFirst());
+}
+
+QByteArray SingleInstance::runtimePath(const char *name)
+{
+    const char * dir = getenv("XDG_RUNTIME_DIR");
+    if (0 != dir && 0 != *dir)
+        return QByteArray(dir) + "/" + name;
+    return "/tmp/" + QByteArray::number(::getuid()) + "-" + name;
+}
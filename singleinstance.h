@@ -0,0 +1,45 @@
+#ifndef SINGLEINSTANCE_H
+#define SINGLEINSTANCE_H
+
+#include <QObject>
+#include <QtCore>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+// One tray per session. The first process takes a lock and listens on a local socket,
+// later ones forward their command line through it and exit before any Qt setup.
+class SingleInstance : public QObject
+{
+    Q_OBJECT
+public:
+    // Plain POSIX, these run before QApplication exists.
+    static bool parseCommand(int argc, char * argv[], QList<QByteArray>& command);
+    static bool acquire();
+    static int forward(const QList<QByteArray>& command);
+    static void usage();
+
+    explicit SingleInstance(QObject *parent = 0);
+
+    // Called as early as possible, commands are accepted and held from here on.
+    bool listen();
+
+public slots:
+    // Emits the commands held so far and any later ones as they arrive.
+    void deliverCommands();
+
+signals:
+    void commandReceived(const QStringList& command);
+
+private slots:
+    void slotNewConnection();
+    void slotReadyRead();
+
+private:
+    QLocalServer * m_pserver;
+    bool m_deliver;
+    QList<QStringList> m_held;
+
+    static QByteArray runtimePath(const char * name);
+};
+
+#endif // SINGLEINSTANCE_H
@@ -0,0 +1,43 @@
+#include "startupprofile.h"
+
+#include <stdio.h>
+#include <QElapsedTimer>
+
+namespace
+{
+QElapsedTimer clock;
+qint64 lastMark = 0;
+}
+
+void StartupProfile::enable()
+{
+    clock.start();
+    lastMark = 0;
+}
+
+bool StartupProfile::enabled()
+{
+    return clock.isValid();
+}
+
+void StartupProfile::mark(const char *phase)
+{
+    if (!enabled())
+        return;
+
+    qint64 now = clock.nsecsElapsed();
+    fprintf(stderr, "startup: %-16s %8.1f ms  (+%.1f ms)\n", phase, now / 1e6, (now - lastMark) / 1e6);
+    lastMark = now;
+}
+
+void StartupProfile::finish()
+{
+    if (!enabled())
+        return;
+
+    mark("event loop");
+
+    qint64 total = clock.elapsed();
+    fprintf(stderr, "startup: tray icon visible after %lld ms, target %d ms%s\n", (long long)total, int(TrayVisibleTargetMs),
+            total > TrayVisibleTargetMs ? " - over target" : "");
+}
@@ -0,0 +1,19 @@
+#ifndef STARTUPPROFILE_H
+#define STARTUPPROFILE_H
+
+// Wall clock marks for the phases of startup, printed to stderr with --profile-startup.
+// Everything is a no-op unless enabled, marks cost one branch in normal runs.
+class StartupProfile
+{
+public:
+    // Time from main() until the event loop runs and the tray icon can actually show up.
+    enum { TrayVisibleTargetMs = 250 };
+
+    static void enable();
+    static bool enabled();
+    static void mark(const char * phase);
+    // Queued on the event loop, reports the total once startup has handed control to it.
+    static void finish();
+};
+
+#endif // STARTUPPROFILE_H
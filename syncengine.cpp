@@ -0,0 +1,424 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "syncengine.h"
+#include "dirwalker.h"
+
+const int WALK_THREADS = 4;
+const int COPY_THREADS = 4;
+const size_t COPY_CHUNK = 8 * 1024 * 1024;
+const size_t BUFFER_ALIGNMENT = 4096;
+// FAT keeps modification times with two second granularity.
+const qint64 MTIME_TOLERANCE_SEC = 2;
+const char * PARTIAL_SUFFIX = ".mountain-part";
+const char * SYNC_JOBS_KEY = "/Settings/Sync/Jobs";
+
+namespace
+{
+
+struct CopyItem
+{
+    QByteArray path;
+    qint64 size;
+    qint64 mtimeNs;
+};
+
+class SyncPlanner : public DirWalker::Visitor
+{
+public:
+    explicit SyncPlanner(const QByteArray& dst_root) : m_dstRoot(dst_root) {}
+
+    void visit(const QByteArray& rel_dir, const QVector<DirWalker::Entry>& entries)
+    {
+        QVector<CopyItem> items;
+        QVector<QByteArray> dirs;
+        struct stat st;
+
+        foreach (const DirWalker::Entry& e, entries)
+        {
+            QByteArray rel = DirWalker::join(rel_dir, e.name);
+            bool exists = ::stat((m_dstRoot + '/' + rel).constData(), &st) == 0;
+
+            if (e.isDir)
+            {
+                if (!exists)
+                    dirs.append(rel);
+                continue;
+            }
+
+            if (exists && S_ISREG(st.st_mode) && st.st_size == e.size
+                    && qAbs(qint64(st.st_mtim.tv_sec) - e.mtimeNs / 1000000000) <= MTIME_TOLERANCE_SEC)
+                continue;
+
+            CopyItem item;
+            item.path = rel;
+            item.size = e.size;
+            item.mtimeNs = e.mtimeNs;
+            items.append(item);
+        }
+
+        QMutexLocker lock(&m_mutex);
+        m_items += items;
+        m_dirs += dirs;
+    }
+
+    QVector<CopyItem> m_items;
+    QVector<QByteArray> m_dirs;
+
+private:
+    QByteArray m_dstRoot;
+    QMutex m_mutex;
+};
+
+}
+
+class SyncWorker : public JobWorker
+{
+public:
+    SyncWorker(const QString& mount_path, const QList<SyncJobConfig>& jobs, QObject * parent) :
+        JobWorker(parent), m_mountPath(mount_path), m_jobs(jobs), m_failed(0) {}
+
+    void cancel() { m_cancel.store(1); }
+    bool cancelled() const { return 0 != m_cancel.load(); }
+    int failed() const { return m_failed.load(); }
+
+    SyncProgress progress() const
+    {
+        SyncProgress p;
+        p.filesDone = m_filesDone.load();
+        p.filesTotal = m_filesTotal.load();
+        p.bytesDone = m_bytesDone.load();
+        p.bytesTotal = m_bytesTotal.load();
+        return p;
+    }
+
+    QStringList errors;
+
+protected:
+    void run();
+
+private:
+    class CopyThread : public QThread
+    {
+    public:
+        explicit CopyThread(SyncWorker * worker) : m_pworker(worker) {}
+    protected:
+        void run() { m_pworker->copyLoop(); }
+    private:
+        SyncWorker * m_pworker;
+    };
+
+    QString m_mountPath;
+    QList<SyncJobConfig> m_jobs;
+    QAtomicInt m_cancel;
+    QAtomicInt m_failed;
+    QAtomicInteger<qint64> m_filesDone;
+    QAtomicInteger<qint64> m_filesTotal;
+    QAtomicInteger<qint64> m_bytesDone;
+    QAtomicInteger<qint64> m_bytesTotal;
+
+    // State of the job being copied, read only while copy threads run.
+    QByteArray m_srcRoot;
+    QByteArray m_dstRoot;
+    QVector<CopyItem> m_items;
+    QAtomicInt m_next;
+
+    void copyLoop();
+    bool copyFile(const CopyItem& item, char *& buf);
+    ssize_t readWrite(int in, int out, off_t offset, char *& buf);
+};
+
+void SyncWorker::run()
+{
+    foreach (const SyncJobConfig& job, m_jobs)
+    {
+        if (cancelled())
+            break;
+
+        QString device_dir = job.deviceDir.isEmpty() ? m_mountPath : m_mountPath + "/" + job.deviceDir;
+        QString src = SyncJobConfig::ToDevice == job.direction ? job.localDir : device_dir;
+        QString dst = SyncJobConfig::ToDevice == job.direction ? device_dir : job.localDir;
+
+        if (!QFileInfo(src).isDir() || !QDir().mkpath(dst))
+        {
+            errors << "Can't sync " + src + " to " + dst;
+            m_failed.ref();
+            continue;
+        }
+
+        m_srcRoot = QFile::encodeName(QDir(src).absolutePath());
+        m_dstRoot = QFile::encodeName(QDir(dst).absolutePath());
+
+        SyncPlanner planner(m_dstRoot);
+        DirWalker walker(src, WALK_THREADS);
+        walker.setCancelFlag(&m_cancel);
+        if (!walker.walk(&planner))
+            break;
+
+        // Sorted order creates parents before their children.
+        std::sort(planner.m_dirs.begin(), planner.m_dirs.end());
+        foreach (const QByteArray& dir, planner.m_dirs)
+            ::mkdir((m_dstRoot + '/' + dir).constData(), 0755);
+
+        m_items.swap(planner.m_items);
+        m_next.store(0);
+        m_filesTotal.fetchAndAddRelaxed(m_items.size());
+        foreach (const CopyItem& item, m_items)
+            m_bytesTotal.fetchAndAddRelaxed(item.size);
+
+        QList<CopyThread*> threads;
+        for (int i = 1; i < qMin(COPY_THREADS, m_items.size()); ++i)
+        {
+            threads.append(new CopyThread(this));
+            threads.last()->start();
+        }
+        copyLoop();
+        foreach (CopyThread * t, threads)
+        {
+            t->wait();
+            delete t;
+        }
+        m_items.clear();
+
+        if (!cancelled() && SyncJobConfig::ToDevice == job.direction)
+        {
+            int fd = ::open(QFile::encodeName(m_mountPath).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd >= 0)
+            {
+                ::syncfs(fd);
+                ::close(fd);
+            }
+        }
+    }
+}
+
+void SyncWorker::copyLoop()
+{
+    char * buf = 0;
+    int i;
+
+    while (!cancelled() && (i = m_next.fetchAndAddRelaxed(1)) < m_items.size())
+    {
+        if (copyFile(m_items.at(i), buf))
+            m_filesDone.ref();
+        else if (!cancelled())
+            m_failed.ref();
+    }
+
+    free(buf);
+}
+
+bool SyncWorker::copyFile(const CopyItem &item, char *&buf)
+{
+    enum CopyMethod { CopyFileRange, SendFile, ReadWrite };
+
+    QByteArray dst = m_dstRoot + '/' + item.path;
+    QByteArray tmp = dst + PARTIAL_SUFFIX;
+
+    int in = ::open((m_srcRoot + '/' + item.path).constData(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+        return false;
+
+    int out = ::open(tmp.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0)
+    {
+        ::close(in);
+        return false;
+    }
+
+    ::posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // copy_file_range() keeps the data in the kernel and lets the filesystem reflink or offload it,
+    // sendfile() is the next best thing across filesystems and the plain loop is the last resort.
+    CopyMethod method = CopyFileRange;
+    off_t offset = 0;
+    bool ok = true;
+
+    while (!cancelled())
+    {
+        ssize_t n;
+
+        if (CopyFileRange == method)
+        {
+            n = ::copy_file_range(in, 0, out, 0, COPY_CHUNK, 0);
+            if (n < 0 && 0 == offset && (ENOSYS == errno || EXDEV == errno || EINVAL == errno || EOPNOTSUPP == errno))
+            {
+                method = SendFile;
+                continue;
+            }
+        }
+        else if (SendFile == method)
+        {
+            n = ::sendfile(out, in, 0, COPY_CHUNK);
+            if (n < 0 && 0 == offset && (ENOSYS == errno || EINVAL == errno))
+            {
+                method = ReadWrite;
+                continue;
+            }
+        }
+        else n = readWrite(in, out, offset, buf);
+
+        if (n < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            ok = false;
+            break;
+        }
+        if (0 == n)
+            break;
+
+        offset += n;
+        m_bytesDone.fetchAndAddRelaxed(n);
+    }
+
+    ok = ok && !cancelled();
+
+    if (ok)
+    {
+        // Carry the source mtime over, that's what makes the next run skip the file.
+        struct timespec times[2];
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_OMIT;
+        times[1].tv_sec = item.mtimeNs / 1000000000;
+        times[1].tv_nsec = item.mtimeNs % 1000000000;
+        ::futimens(out, times);
+    }
+
+    ::close(in);
+    ok = (::close(out) == 0) && ok;
+
+    if (ok && ::rename(tmp.constData(), dst.constData()) == 0)
+        return true;
+
+    ::unlink(tmp.constData());
+    return false;
+}
+
+ssize_t SyncWorker::readWrite(int in, int out, off_t offset, char *&buf)
+{
+    if (0 == buf && ::posix_memalign(reinterpret_cast<void**>(&buf), BUFFER_ALIGNMENT, COPY_CHUNK) != 0)
+    {
+        buf = 0;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ssize_t n = ::read(in, buf, COPY_CHUNK);
+    if (n <= 0)
+        return n;
+
+    // Start reading the next chunk while this one is being written.
+    ::posix_fadvise(in, offset + n, COPY_CHUNK, POSIX_FADV_WILLNEED);
+
+    for (ssize_t written = 0; written < n; )
+    {
+        ssize_t w = ::write(out, buf + written, n - written);
+        if (w < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        written += w;
+    }
+    return n;
+}
+
+SyncEngine::SyncEngine(DeviceWatcher *watcher, QObject *parent) :
+    JobManager(watcher, parent)
+{
+}
+
+QList<SyncJobConfig> SyncEngine::loadJobs(const QSettings *settings)
+{
+    // Same layout as QSettings::beginWriteArray(), which needs a non-const object to read back.
+    QList<SyncJobConfig> jobs;
+    int size = settings->value(QString(SYNC_JOBS_KEY) + "/size").toInt();
+
+    for (int i = 1; i <= size; ++i)
+    {
+        QString prefix = QString(SYNC_JOBS_KEY) + "/" + QString::number(i) + "/";
+        SyncJobConfig job;
+        job.uuid = settings->value(prefix + "Uuid").toString();
+        job.localDir = settings->value(prefix + "LocalDir").toString();
+        job.deviceDir = settings->value(prefix + "DeviceDir").toString();
+        job.direction = "FromDevice" == settings->value(prefix + "Direction").toString() ?
+                    SyncJobConfig::FromDevice : SyncJobConfig::ToDevice;
+
+        if (!job.uuid.isEmpty() && !job.localDir.isEmpty())
+            jobs.append(job);
+    }
+    return jobs;
+}
+
+void SyncEngine::saveJobs(QSettings *settings, const QList<SyncJobConfig> &jobs)
+{
+    settings->remove(SYNC_JOBS_KEY);
+    settings->beginWriteArray(SYNC_JOBS_KEY, jobs.size());
+
+    for (int i = 0; i < jobs.size(); ++i)
+    {
+        settings->setArrayIndex(i);
+        settings->setValue("Uuid", jobs.at(i).uuid);
+        settings->setValue("LocalDir", jobs.at(i).localDir);
+        settings->setValue("DeviceDir", jobs.at(i).deviceDir);
+        settings->setValue("Direction", SyncJobConfig::FromDevice == jobs.at(i).direction ? "FromDevice" : "ToDevice");
+    }
+
+    settings->endArray();
+}
+
+QList<SyncJobConfig> SyncEngine::jobsForDevice(const QSettings *settings, const QString &uuid)
+{
+    QList<SyncJobConfig> jobs;
+
+    if (uuid.isEmpty())
+        return jobs;
+
+    foreach (const SyncJobConfig& job, loadJobs(settings))
+    {
+        if (0 == job.uuid.compare(uuid, Qt::CaseInsensitive))
+            jobs.append(job);
+    }
+    return jobs;
+}
+
+bool SyncEngine::start(const DeviceInfo &dev, const QString &mount_path, const QList<SyncJobConfig> &jobs)
+{
+    if (jobs.isEmpty() || mount_path.isEmpty() || isRunning(dev.udisksPath))
+        return false;
+
+    qDebug() << "Sync started: " << dev.udisksPath << " (" << jobs.size() << " jobs)";
+    return startJob(dev.udisksPath, dev, new SyncWorker(mount_path, jobs, this), QThread::LowPriority);
+}
+
+SyncProgress SyncEngine::progress(const QString &dev_path) const
+{
+    SyncWorker * w = static_cast<SyncWorker*>(worker(dev_path));
+    return 0 == w ? SyncProgress() : w->progress();
+}
+
+void SyncEngine::jobFinished(const DeviceInfo &dev, JobWorker *job_worker)
+{
+    SyncWorker * worker = static_cast<SyncWorker*>(job_worker);
+    SyncProgress p = worker->progress();
+    bool ok = !worker->cancelled() && 0 == worker->failed();
+    QString message;
+
+    if (worker->cancelled())
+        message = "Sync cancelled after " + QString::number(p.filesDone) + " of " + QString::number(p.filesTotal) + " files.";
+    else
+        message = QString::number(p.filesDone) + " files copied, " + QString::number(worker->failed()) + " failed.";
+
+    foreach (const QString& err, worker->errors)
+        qWarning() << err;
+
+    emit finished(dev, ok, message);
+}
@@ -0,0 +1,52 @@
+#ifndef SYNCENGINE_H
+#define SYNCENGINE_H
+
+#include <QObject>
+#include <QtCore>
+
+#include "jobmanager.h"
+
+struct SyncJobConfig
+{
+    enum Direction
+    {
+        ToDevice, FromDevice
+    };
+
+    QString uuid;
+    QString localDir;
+    QString deviceDir;
+    Direction direction;
+};
+
+struct SyncProgress
+{
+    SyncProgress() : filesDone(0), filesTotal(0), bytesDone(0), bytesTotal(0) {}
+
+    qint64 filesDone;
+    qint64 filesTotal;
+    qint64 bytesDone;
+    qint64 bytesTotal;
+};
+
+class SyncEngine : public JobManager
+{
+    Q_OBJECT
+public:
+    explicit SyncEngine(DeviceWatcher * watcher, QObject *parent = 0);
+
+    static QList<SyncJobConfig> loadJobs(const QSettings * settings);
+    static void saveJobs(QSettings * settings, const QList<SyncJobConfig>& jobs);
+    static QList<SyncJobConfig> jobsForDevice(const QSettings * settings, const QString& uuid);
+
+    bool start(const DeviceInfo& dev, const QString& mount_path, const QList<SyncJobConfig>& jobs);
+    SyncProgress progress(const QString& dev_path) const;
+
+signals:
+    void finished(const DeviceInfo& dev, bool ok, QString message);
+
+protected:
+    void jobFinished(const DeviceInfo& dev, JobWorker * worker);
+};
+
+#endif // SYNCENGINE_H